@@ -0,0 +1,52 @@
+/*
+ * bench_alloc.c
+ *
+ * Churn of short lived numeric datums, the pattern of a pipeline stage that
+ * creates a batch of values, uses them and drops them. Run with
+ * `make bench-alloc`, which builds it once on the slabs and once on plain
+ * malloc/free (-DDATUM_NO_SLAB).
+ */
+#include <stdio.h>
+#include <time.h>
+#include "datum.h"
+
+#define BATCH   1000
+#define ROUNDS  20000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    static Datum_T batch[BATCH];
+    Datum_AllocStats st;
+    long long sum = 0;
+
+    Datum_resetAllocStats();
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++)
+            batch[i] = (i & 1) ? Datum_asInteger(r + i) : Datum_asDouble(r * 0.5);
+        for (int i = 0; i < BATCH; i++)
+            sum += Datum_getAsInteger(batch[i]);
+        for (int i = 0; i < BATCH; i++)
+            Datum_free(&batch[i]);
+    }
+    t = now() - t;
+
+    Datum_getAllocStats(&st);
+#ifdef DATUM_NO_SLAB
+    const char *alloc = "malloc";
+#else
+    const char *alloc = "slab";
+#endif
+    printf("%-7s %6.1f M datums/s  %5.1f ns new+free  hit rate %5.1f%%  "
+           "slabs %llu  system allocations %llu  (%lld)\n",
+           alloc, BATCH * (double)ROUNDS / t / 1e6, t * 1e9 / (BATCH * (double)ROUNDS),
+           st.allocs ? 100.0 * st.hits / st.allocs : 0.0, st.slabs, st.sysAllocs, sum);
+    return 0;
+}
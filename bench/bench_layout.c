@@ -0,0 +1,93 @@
+/*
+ * bench_layout.c
+ *
+ * Footprint and scan cost of struct Datum in the layout the library was
+ * built with. Build and run both layouts with `make bench-layout`.
+ *
+ * The random scan touches the datums in shuffled order, so its cost is
+ * dominated by cache misses; fewer bytes per datum means more datums per
+ * cache line and fewer lines pulled from memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "datum.h"
+#include "datum_int.h"
+
+#define N_DATUMS (4 * 1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* resident set size in bytes, from /proc/self/statm */
+static long rss(void)
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static long long scan(Datum_T *dtms, const size_t *order, size_t n)
+{
+    long long sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += Datum_getAsInteger(dtms[order[i]]);
+    return sum;
+}
+
+int main(void)
+{
+    Datum_T *dtms = malloc(N_DATUMS * sizeof(Datum_T));
+    size_t *order = malloc(N_DATUMS * sizeof(size_t));
+    if (!dtms || !order)
+        return 1;
+
+    long before = rss();
+    for (size_t i = 0; i < N_DATUMS; i++)
+        dtms[i] = Datum_asInteger((long long)i);
+    long after = rss();
+
+    for (size_t i = 0; i < N_DATUMS; i++)
+        order[i] = i;
+    double t = now();
+    long long seq = scan(dtms, order, N_DATUMS);
+    double t_seq = now() - t;
+
+    srand(20260117);
+    for (size_t i = N_DATUMS - 1; i > 0; i--) {
+        size_t j = ((size_t)rand() * RAND_MAX + rand()) % (i + 1);
+        size_t tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+    }
+    t = now();
+    long long rnd = scan(dtms, order, N_DATUMS);
+    double t_rnd = now() - t;
+
+#ifdef DATUM_COMPACT
+    const char *layout = "compact";
+#else
+    const char *layout = "default";
+#endif
+    printf("layout %-8s sizeof(struct Datum) %3zu  bytes/datum incl. malloc %6.1f  "
+           "datums/cache line %4.2f\n",
+           layout, sizeof(struct Datum), (double)(after - before) / N_DATUMS,
+           64.0 / sizeof(struct Datum));
+    printf("layout %-8s sequential scan %6.2f ns/datum  random scan %6.2f ns/datum%s\n",
+           layout, t_seq * 1e9 / N_DATUMS, t_rnd * 1e9 / N_DATUMS,
+           seq == rnd ? "" : "  (sum mismatch!)");
+
+    for (size_t i = 0; i < N_DATUMS; i++)
+        Datum_free(&dtms[i]);
+    free(dtms);
+    free(order);
+    return 0;
+}
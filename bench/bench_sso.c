@@ -0,0 +1,59 @@
+/*
+ * bench_sso.c
+ *
+ * Builds datums from the short strings typical for person registers:
+ * first names, postcodes and 11 digit national identity numbers. Run with
+ * `make bench-sso`, which builds it once with short strings inline in the
+ * datum and once with every string on the heap (-DDATUM_NO_INLINE).
+ */
+#include <stdio.h>
+#include <time.h>
+#include "datum.h"
+
+#define N_DATUMS (1000 * 1000)
+
+static const char *samples[] = {
+    "Kari", "Ola", "Ingrid", "M\xc3\xa1htte", "Bj\xc3\xb8rn", "Siv", "\xc3\x85se",
+    "0150", "9520", "7010", "5003",
+    "01017012345", "24128932177", "15066544321",
+};
+#define N_SAMPLES (sizeof samples / sizeof samples[0])
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    static Datum_T dtms[N_DATUMS];
+    Datum_AllocStats st;
+    size_t bytes = 0;
+
+    Datum_resetAllocStats();
+    double t = now();
+    for (size_t i = 0; i < N_DATUMS; i++)
+        dtms[i] = Datum_asString(samples[i % N_SAMPLES], -1, DTM_ENC_UTF8);
+    double t_new = now() - t;
+
+    t = now();
+    for (size_t i = 0; i < N_DATUMS; i++)
+        bytes += Datum_getAsString(dtms[i], DTM_ENC_UTF8)[0];
+    double t_get = now() - t;
+
+    Datum_getAllocStats(&st);
+    for (size_t i = 0; i < N_DATUMS; i++)
+        Datum_free(&dtms[i]);
+
+#ifdef DATUM_NO_INLINE
+    const char *mode = "heap";
+#else
+    const char *mode = "inline";
+#endif
+    printf("%-6s allocations/datum %4.2f  create %5.1f ns  first byte %5.2f ns  (%zu)\n",
+           mode, (double)st.allocs / N_DATUMS, t_new * 1e9 / N_DATUMS,
+           t_get * 1e9 / N_DATUMS, bytes);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * bench_transcode.c
+ *
+ * Transcoding throughput between utf-8, utf-16LE and utf-32LE for a 16 MiB
+ * text column, once mostly ASCII with Nordic and Sami letters mixed in and
+ * once in Cyrillic. Run with `make bench-transcode`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "datum.h"
+#include "datum_int.h"
+
+#define N_BYTES (16 * 1024 * 1024)
+#define ROUNDS  5
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t fill(char *buf, const char *const *words, size_t nwords)
+{
+    size_t len = 0;
+    for (size_t i = 0; ; i++) {
+        const char *w = words[(i * 7) % nwords];
+        size_t wlen = strlen(w);
+        if (len + wlen + 1 > N_BYTES)
+            break;
+        memcpy(buf + len, w, wlen);
+        len += wlen;
+        buf[len++] = ' ';
+    }
+    return len;
+}
+
+static void run(const char *name, dtm_encoding_t from, dtm_encoding_t to,
+                const char *src, size_t len, char *dst)
+{
+    size_t out = 0;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++)
+        out = dtm_transcode(from, to, src, len, dst, NULL);
+    t = now() - t;
+    printf("  %-16s %6.2f GB/s of input  (%zu -> %zu bytes)\n", name,
+           (double)len * ROUNDS / t / 1e9, len, out);
+}
+
+static void suite(const char *title, const char *utf8, size_t len)
+{
+    char *u16 = malloc(dtm_transcodeBound(DTM_ENC_UTF8, DTM_ENC_UTF16LE, len));
+    char *u32 = malloc(dtm_transcodeBound(DTM_ENC_UTF8, DTM_ENC_UTF32LE, len));
+    char *back = malloc(len);
+    size_t l16 = dtm_transcode(DTM_ENC_UTF8, DTM_ENC_UTF16LE, utf8, len, u16, NULL);
+    size_t l32 = dtm_transcode(DTM_ENC_UTF8, DTM_ENC_UTF32LE, utf8, len, u32, NULL);
+
+    printf("%s\n", title);
+    run("utf-8 -> utf-16", DTM_ENC_UTF8, DTM_ENC_UTF16LE, utf8, len, u16);
+    run("utf-16 -> utf-8", DTM_ENC_UTF16LE, DTM_ENC_UTF8, u16, l16, back);
+    run("utf-8 -> utf-32", DTM_ENC_UTF8, DTM_ENC_UTF32LE, utf8, len, u32);
+    run("utf-32 -> utf-8", DTM_ENC_UTF32LE, DTM_ENC_UTF8, u32, l32, back);
+    run("utf-16 -> utf-32", DTM_ENC_UTF16LE, DTM_ENC_UTF32LE, u16, l16, u32);
+    free(u16);
+    free(u32);
+    free(back);
+}
+
+int main(void)
+{
+    static char buf[N_BYTES];
+    static const char *nordic[] = {
+        "Kautokeino", "kommune", "Troms\xc3\xb8", "Bj\xc3\xb8rn", "\xc3\x85se", "0150", "Oslo",
+        "M\xc3\xa1htte", "\xc4\x8c\xc3\xa1hcesuolu", "Ingrid", "gate", "24128932177", "Finnmark",
+    };
+    static const char *cyrillic[] = {
+        "\xd0\x9c\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0",
+        "\xd0\x9c\xd1\x83\xd1\x80\xd0\xbc\xd0\xb0\xd0\xbd\xd1\x81\xd0\xba",
+    };
+
+    suite("nordic", buf, fill(buf, nordic, sizeof nordic / sizeof nordic[0]));
+    suite("cyrillic", buf, fill(buf, cyrillic, sizeof cyrillic / sizeof cyrillic[0]));
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * bench_utf8.c
+ *
+ * Validation throughput of a 16 MiB text column, mostly ASCII with Nordic
+ * and Sami letters mixed in, and of the same amount of text in Cyrillic.
+ * Compares the old check one character at a time (utf8_valid) with the
+ * scalar kernel and with dtm_utf8_validate, which picks the SIMD kernel,
+ * and counting code points byte by byte with dtm_utf8_count.
+ * Run with `make bench-utf8`.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "datum.h"
+#include "datum_int.h"
+
+#define N_BYTES (16 * 1024 * 1024)
+#define ROUNDS  10
+
+extern size_t utf8_valid(const uint8_t *c);
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(char *buf, const char *const *words, size_t nwords)
+{
+    size_t len = 0;
+    for (size_t i = 0; ; i++) {
+        const char *w = words[(i * 7) % nwords];
+        size_t wlen = strlen(w);
+        if (len + wlen + 1 > N_BYTES)
+            break;
+        memcpy(buf + len, w, wlen);
+        len += wlen;
+        buf[len++] = ' ';
+    }
+    memset(buf + len, ' ', N_BYTES - len);
+}
+
+static bool perChar(const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; ) {
+        size_t clen = utf8_valid((const uint8_t *)buf + i);
+        if (!clen || clen > len - i)
+            return false;
+        i += clen;
+    }
+    return true;
+}
+
+static size_t countPerByte(const char *buf, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += (buf[i] & 0xc0) != 0x80;
+    return n;
+}
+
+static void runCount(const char *name, size_t (*fn)(const char *, size_t), const char *buf)
+{
+    size_t n = 0;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++)
+        n += fn(buf, N_BYTES);
+    t = now() - t;
+    printf("  %-18s %6.2f GB/s  (%zu)\n", name, (double)N_BYTES * ROUNDS / t / 1e9, n / ROUNDS);
+}
+
+static void run(const char *name, bool (*fn)(const char *, size_t), const char *buf)
+{
+    size_t ok = 0;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++)
+        ok += fn(buf, N_BYTES);
+    t = now() - t;
+    printf("  %-18s %6.2f GB/s  (%zu)\n", name, (double)N_BYTES * ROUNDS / t / 1e9, ok);
+}
+
+int main(void)
+{
+    static char buf[N_BYTES];
+    static const char *nordic[] = {
+        "Kautokeino", "kommune", "Troms\xc3\xb8", "Bj\xc3\xb8rn", "\xc3\x85se", "0150", "Oslo",
+        "M\xc3\xa1htte", "\xc4\x8c\xc3\xa1hcesuolu", "Ingrid", "gate", "24128932177", "Finnmark",
+    };
+    static const char *cyrillic[] = {
+        "\xd0\x9c\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0",
+        "\xd0\x9c\xd1\x83\xd1\x80\xd0\xbc\xd0\xb0\xd0\xbd\xd1\x81\xd0\xba",
+    };
+
+    fill(buf, nordic, sizeof nordic / sizeof nordic[0]);
+    printf("nordic\n");
+    run("per character", perChar, buf);
+    run("scalar", dtm_utf8_validateScalar, buf);
+    run("dtm_utf8_validate", dtm_utf8_validate, buf);
+    runCount("count per byte", countPerByte, buf);
+    runCount("dtm_utf8_count", dtm_utf8_count, buf);
+
+    fill(buf, cyrillic, sizeof cyrillic / sizeof cyrillic[0]);
+    printf("cyrillic\n");
+    run("per character", perChar, buf);
+    run("scalar", dtm_utf8_validateScalar, buf);
+    run("dtm_utf8_validate", dtm_utf8_validate, buf);
+    runCount("count per byte", countPerByte, buf);
+    runCount("dtm_utf8_count", dtm_utf8_count, buf);
+    return 0;
+}
@@ -54,8 +54,13 @@
  * - wchar_t*       : Wide strings, 16-bit on Windows (UTF-16LE native), 32-bit on Linux/macOS
  * - uint32_t*      : UTF-32 (used internally or for portable wide strings)
  *
- * All internal string processing uses UTF-16 as canonical form to simplify
- * conversion and ensure consistent behavior across platforms.
+ * Narrow strings are kept in the encoding they are given in. UTF-16 and
+ * UTF-32 strings, wchar_t ones included, are kept in the narrowest fixed
+ * width that holds their widest character: Latin-1, UTF-16 without
+ * surrogates or UTF-32, so Norwegian text takes one byte per character and
+ * Datum_getCharAt is O(1). Datum_getEncoding tells the form chosen, and
+ * Datum_getAsStringW and friends convert on request. Build with
+ * -DDATUM_NO_ADAPTIVE to keep them as given.
  *
  * References:
  * - Microsoft UCRT / Win32 wide-char API uses UTF-16LE
@@ -65,8 +70,12 @@ typedef enum {
     DTM_ENC_NONE        = 0         /* either utf-8 or ISO_8859-15      */
   , DTM_ENC_UTF8        = DATUM_UTF8
   , DTM_ENC_UTF16       = DATUM_UTF16
+  , DTM_ENC_UTF16LE     = DATUM_UTF16LE
+  , DTM_ENC_UTF16BE     = DATUM_UTF16BE
   , DTM_ENC_ASCII       = DATUM_ASCII
   , DTM_ENC_UTF32       = DATUM_UTF32 
+  , DTM_ENC_UTF32LE     = DATUM_UTF32LE
+  , DTM_ENC_UTF32BE     = DATUM_UTF32BE
   , DTM_ENC_ISO8859_1   = DATUM_ISO8859_1
   , DTM_ENC_ISO8859_2   = DATUM_ISO8859_2
   , DTM_ENC_ISO8859_15  = DATUM_ISO8859_15
@@ -86,6 +95,12 @@ typedef enum {
 #define DATUM_Array     0x4000      /* Value is an array */
 #define DATUM_UINTPTR	0x8000	    /* value is an universal void ptr */
 #define DATUM_StrU      0x0010000   /* Value is string on utf32 */
+#define DATUM_Inline    0x00000080  /* Short string stored in the datum itself */
+#define DATUM_Arena     0x00000100  /* Datum lives in an arena or a view, not on the heap */
+#define DATUM_Interned  0x00000200  /* Payload is owned by the intern table */
+#define DATUM_Raw       0x00000400  /* String not yet checked against its encoding nor counted */
+#define DATUM_Converted 0x00000800  /* The string is kept in other encodings too */
+#define DATUM_Malformed 0x00001000  /* DATUM_Raw string found not valid in its encoding */
 
 #define DATUM_Invalid   0x00800000  /* Value is undefined */
 
@@ -101,6 +116,15 @@ typedef enum {
 #define DATUM_Agg       0x10000000   /* Mem.z points to an agg function context */
 #define DATUM_Zero      0x20000000   /* Mem.i contains count of 0s appended to blob */
 
+/* Layout
+** ------
+** By default struct Datum keeps each property in its own field. Building
+** the library with -DDATUM_COMPACT selects a 16 byte layout where encoding,
+** lock state and type tag are packed into the flag word. In that layout the
+** bits 0x003e0000, 0x00400000 and 0xc0000000 are taken, new flags must keep
+** clear of them.
+*/
+
 typedef struct Datum *Datum_T;
 
 extern Datum_T Datum_new(void);
@@ -110,13 +134,25 @@ extern const char* Datum_typeof(void *dtm);
 extern Datum_T Datum_asString(const char *str, int len, dtm_encoding_t encoding);
 extern Datum_T Datum_asStringW(const wchar_t *str, int len);
 extern Datum_T Datum_asStringU(const unsigned int *str, int len);
+extern Datum_T Datum_asRawBytes(const char *buf, int len, dtm_encoding_t encoding);
 extern Datum_T Datum_asInteger(long long val);
 extern Datum_T Datum_asDouble(double val);
+extern Datum_T Datum_asDecimal(double val, short dec);
 extern Datum_T Datum_asVoidPtr(void *val);
+
+/* Wrap memory owned by someone else without copying: DATUM_Static for
+** memory that lives as long as the program, DATUM_Ephem (borrowed) for
+** memory the caller keeps valid while the datum is used. */
+extern Datum_T Datum_asStringStatic(const char *str, int len, dtm_encoding_t encoding);
+extern Datum_T Datum_asStringBorrowed(const char *str, int len, dtm_encoding_t encoding);
+extern Datum_T Datum_asBLOBStatic(const void *str, int len, short enc);
+extern Datum_T Datum_asBLOBBorrowed(const void *str, int len, short enc);
+extern Datum_T Datum_promote(Datum_T datum);
 extern Datum_T Datum_asBLOB(void *str, int len, short enc);
 extern Datum_T Datum_newAsTimestamp();
 extern Datum_T Datum_asArray(void *arr, int len);
 extern Datum_T Datum_asDatums(Datum_T *datums, int len);
+extern Datum_T Datum_asNull(void);
 
 extern long Datum_getType(Datum_T datum);
 
@@ -132,8 +168,12 @@ extern bool Datum_isDatums(Datum_T datum);    // new
 
 extern bool Datum_isNull(Datum_T datum);
 extern bool Datum_isEqual(Datum_T datum_1, Datum_T datum_2);
+extern uint64_t Datum_hash(Datum_T datum);
+extern int Datum_compare(Datum_T a, Datum_T b);
+extern bool Datum_sortArray(Datum_T *datums, size_t n);
 
 extern unsigned char *Datum_getAsString(Datum_T datum, dtm_encoding_t encoding);
+extern size_t Datum_formatNumber(Datum_T datum, dtm_encoding_t encoding, void *buf, size_t cap);
 extern wchar_t *Datum_getAsStringW(Datum_T datum);
 extern uint32_t *Datum_getAsStringU(Datum_T datum);
 extern void *Datum_getAsBlob(Datum_T datum);
@@ -143,9 +183,124 @@ extern Datum_T *Datum_getAsDatums(Datum_T datum); // new
 
 extern long Datum_getSize(Datum_T datum);               //!new number of bytes 
 extern long Datum_getLength(Datum_T datum);             //!new number of characters
+extern long Datum_getCharAt(Datum_T datum, long i);     //!new code point of character i
 extern dtm_encoding_t Datum_getEncoding(Datum_T datum); //!new
 extern long Datum_getDatatype(Datum_T datum);           //!new
 
+extern dtm_encoding_t Datum_detectEncoding(const void *buf, size_t len, int *confidence);
+
+/* Orderings of text for Datum_collationKey, see src/datum_collate.c */
+typedef enum {
+    DTM_COLLATE_NB      = 1         /* Norwegian: .. z æ ø å            */
+  , DTM_COLLATE_SE      = 2         /* Swedish: .. z å ä ö              */
+  , DTM_COLLATE_SMI     = 3         /* Northern Sami: a á b c č d đ ..  */
+} dtm_collation_t;
+
+extern const uint8_t *Datum_collationKey(Datum_T datum, dtm_collation_t collation, size_t *len);
+
+/* Decimal separator of numbers read from text, see src/datum_number.c */
+typedef enum {
+    DTM_NUM_POINT       = 0         /* 1234.5, 1 234.5, 1,234.5         */
+  , DTM_NUM_COMMA       = 1         /* 1234,5, 1 234,5, 1.234,5         */
+} dtm_numformat_t;
+
+extern dtm_numformat_t Datum_setNumberFormat(dtm_numformat_t format);
+
 extern Datum_T Datum_copy(Datum_T datum);
 
-extern void Datum_free(Datum_T *datum);
\ No newline at end of file
+/* Datum_intern changes the datum in place: no other thread may use it meanwhile */
+extern Datum_T Datum_intern(Datum_T datum);
+extern bool Datum_isInterned(Datum_T datum);
+
+extern void Datum_free(Datum_T *datum);
+
+/* Arenas: datums created in an arena are released all at once by
+** Datum_Arena_reset or Datum_Arena_free; Datum_free on them only clears the
+** caller's pointer. An arena must not be used by several threads at once.
+*/
+typedef struct Datum_Arena *Datum_Arena_T;
+
+extern Datum_Arena_T Datum_Arena_new(size_t blockSize);
+extern void Datum_Arena_reset(Datum_Arena_T arena);
+extern void Datum_Arena_free(Datum_Arena_T *arena);
+extern size_t Datum_Arena_used(Datum_Arena_T arena);
+
+extern Datum_T Datum_asInteger_in(Datum_Arena_T arena, long long val);
+extern Datum_T Datum_asDouble_in(Datum_Arena_T arena, double val);
+extern Datum_T Datum_asString_in(Datum_Arena_T arena, const char *str, int len, dtm_encoding_t encoding);
+extern Datum_T Datum_asBLOB_in(Datum_Arena_T arena, void *str, int len, short enc);
+
+/* Columnar vectors: the values of one column stored contiguously, see
+** src/datum_vector.c. DatumVector_at fills a caller provided Datum_View
+** with a datum that reads the element in place.
+*/
+typedef struct DatumVector *DatumVector_T;
+
+typedef struct Datum_View {
+#ifdef DATUM_COMPACT
+    uint64_t opaque[4];
+#else
+    uint64_t opaque[12];
+#endif
+} Datum_View;
+
+extern DatumVector_T DatumVector_new(long type, dtm_encoding_t encoding);
+extern void DatumVector_free(DatumVector_T *vec);
+extern size_t DatumVector_length(DatumVector_T vec);
+extern long DatumVector_getType(DatumVector_T vec);
+
+extern bool DatumVector_appendNull(DatumVector_T vec);
+extern bool DatumVector_appendInteger(DatumVector_T vec, long long val);
+extern bool DatumVector_appendDouble(DatumVector_T vec, double val);
+extern bool DatumVector_appendString(DatumVector_T vec, const char *str, int len);
+extern bool DatumVector_appendIntegers(DatumVector_T vec, const long long *vals, size_t n);
+extern bool DatumVector_appendDoubles(DatumVector_T vec, const double *vals, size_t n);
+extern bool DatumVector_appendStrings(DatumVector_T vec, const char *const *strs, const int *lens, size_t n);
+extern bool DatumVector_appendDatums(DatumVector_T vec, Datum_T *dtms, size_t n);
+
+extern bool DatumVector_isNull(DatumVector_T vec, size_t i);
+extern Datum_T DatumVector_at(DatumVector_T vec, size_t i, Datum_View *view);
+extern const long long *DatumVector_integers(DatumVector_T vec);
+extern const double *DatumVector_doubles(DatumVector_T vec);
+extern const char *DatumVector_bytes(DatumVector_T vec, const uint32_t **offsets);
+extern size_t DatumVector_toDatums(DatumVector_T vec, size_t from, size_t count, Datum_T *out);
+
+/* Hash map from datums to datums, see src/datum_map.c. Keys are matched
+** by Datum_hash and Datum_isEqual; put keeps copies of key and value,
+** lookups borrow the key and do not allocate.
+*/
+typedef struct DatumMap *DatumMap_T;
+
+extern DatumMap_T DatumMap_new(size_t capacity);
+extern void DatumMap_free(DatumMap_T *map);
+extern size_t DatumMap_length(DatumMap_T map);
+extern bool DatumMap_put(DatumMap_T map, Datum_T key, Datum_T value);
+extern Datum_T DatumMap_get(DatumMap_T map, Datum_T key);
+extern bool DatumMap_contains(DatumMap_T map, Datum_T key);
+extern bool DatumMap_remove(DatumMap_T map, Datum_T key);
+extern size_t DatumMap_putAll(DatumMap_T map, Datum_T *keys, Datum_T *values, size_t n);
+extern size_t DatumMap_getAll(DatumMap_T map, Datum_T *keys, size_t n, Datum_T *out);
+
+/* Streaming conversion between encodings, for input too big for a datum,
+** see src/datum_transcode.c. Characters split between chunks are carried
+** over; nothing is allocated per chunk.
+*/
+typedef struct dtm_transcoder *dtm_transcoder_T;
+
+extern dtm_transcoder_T dtm_transcoder_new(dtm_encoding_t from, dtm_encoding_t to);
+extern size_t dtm_transcoder_feed(dtm_transcoder_T tc, const char **src, size_t *len, char *dst, size_t size);
+extern size_t dtm_transcoder_flush(dtm_transcoder_T tc);
+extern void dtm_transcoder_free(dtm_transcoder_T *tc);
+
+/* Allocation counters of the calling thread, see src/datum_alloc.c */
+typedef struct Datum_AllocStats {
+    unsigned long long allocs;      /* allocations made */
+    unsigned long long hits;        /* served from a free list */
+    unsigned long long carved;      /* new objects cut from a slab */
+    unsigned long long sysAllocs;   /* too big for a slab, passed to malloc */
+    unsigned long long frees;       /* releases made */
+    unsigned long long slabs;       /* slabs taken from the system, all threads */
+} Datum_AllocStats;
+
+extern void Datum_getAllocStats(Datum_AllocStats *stats);
+extern void Datum_resetAllocStats(void);
\ No newline at end of file
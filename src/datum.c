@@ -9,42 +9,16 @@
 #include <uchar.h>
 // #include <common/utils.h>
 #include <datum.h>
+#include "datum_int.h"
 // #include <common/converters.h>
 
-#define DATUM_STRUCTID 20260117
-const size_t THIS_DATUM_TP = 0xe3eceee64a2b360; // sha1 hash from git
 static const char *DatumTypeName = "datum";
 
-struct Datum {
-    size_t thisTp;
-    size_t structId;
-    union Value {
-        double r;           /* value as double */
-        long long i;        /* integer value */
-        char *z;            /* string or BLOB value */
-        uintptr_t *uptr;    /* value is an universal pointer */
-        wchar_t *zW;        /* value as widecharacter string */
-    } value;
-    size_t n;               /* Number of characters in string value, excluding '\0' */
-    size_t sz;              /* number of bytes occupied by string */
-    short dec;              /* number of digits after decimalpoint */
-    size_t flags;           /* Some combination of DATUM_Null, DATUM_Str, etc. */
-    dtm_encoding_t enc;     /* DT_UTF8, DT_UTF16BE, DT_UTF16LE */
-    short type;             /* One of DT_NULL, DT_TEXT, DT_INTEGER, etc */
-    short isLocked;         /* the value can not be changed */
-    unsigned long hash;     /* hashed version of value when char */
-};
-
 // Returns the number of characters in an UTF-8 encoded string.
 // (Does not check for encoding validity)
 int utf8_strlen(const char *s)
 {
-    int len = 0;
-    while (*s) {
-        if ((*s & 0xC0) != 0x80) len++;
-        s++;
-    }
-    return len;
+    return (int)dtm_utf8_count(s, strlen(s));
 }
 
 /*
@@ -65,6 +39,9 @@ size_t utf8_charlen(uint8_t c)
 
 /**
  * @brief checks if the given utf8 character is valid
+ *
+ * Overlong forms, surrogates and code points above U+10FFFF are refused, as
+ * in dtm_utf8_validate.
  */
 size_t utf8_valid(const uint8_t *c)
 {
@@ -77,6 +54,12 @@ size_t utf8_valid(const uint8_t *c)
             return 0;
         }
     }
+    if ((clen == 2 && c[0] < 0xc2)                          /* overlong */
+        || (c[0] == 0xe0 && c[1] < 0xa0)                    /* overlong */
+        || (c[0] == 0xed && c[1] > 0x9f)                    /* surrogate */
+        || (c[0] == 0xf0 && c[1] < 0x90)                    /* overlong */
+        || (c[0] == 0xf4 && c[1] > 0x8f))                   /* above U+10FFFF */
+        return 0;
     return clen;
 }
 
@@ -116,7 +99,7 @@ const char* Datum_typeof(void *val)
  */
 bool Datum_isDatum(void *val)
 {
-    return (val && ((Datum_T)val)->thisTp == THIS_DATUM_TP) ? true : false;
+    return (val && dtm_isTagged((Datum_T)val)) ? true : false;
 }
 
 /**
@@ -126,11 +109,11 @@ bool Datum_isDatum(void *val)
  */
 Datum_T Datum_new(void)
 {
-    Datum_T datum = calloc(1, sizeof(struct Datum));
+    Datum_T datum = dtm_alloc(sizeof(struct Datum));
     if (datum)
     {
-        datum->thisTp = THIS_DATUM_TP;
-        datum->structId = DATUM_STRUCTID;
+        memset(datum, 0, sizeof(struct Datum));
+        dtm_init(datum);
         datum->flags |= DATUM_Dyn;
         return datum;
     }
@@ -152,37 +135,59 @@ void Datum_free(Datum_T *datum)
     else
         return; //-- return()
 
-    if ((*datum)->flags & DATUM_Str)
+    if ((*datum)->flags & DATUM_Arena)
     {
-        free((*datum)->value.z);
-        (*datum)->value.z = NULL;
+        /* header and payload go with the arena */
+        *datum = NULL;
+        return;
     }
-    else if ((*datum)->flags & DATUM_StrW)
+
+    if ((*datum)->flags & (DATUM_Inline | DATUM_Interned | DATUM_Static | DATUM_Ephem))
     {
-        free((*datum)->value.zW);
-        (*datum)->value.zW = NULL;
+        /* nothing but the header to release, the payload is not ours */
     }
-    else if ((*datum)->flags & DATUM_StrU)
+    else if ((*datum)->flags & (DATUM_Text | DATUM_Blob))
     {
-        uint32_t *ustr = (uint32_t *)(*datum)->value.uptr;
-        if (ustr)
-            free(ustr);
-        (*datum)->value.uptr = NULL;
+        /* strings of any width and blobs, possibly shared with copies */
+        dtm_payloadRelease((*datum)->value.z);
+        (*datum)->value.z = NULL;
     }
-    else if ((*datum)->flags & DATUM_Blob)
+    else if ((*datum)->flags & DATUM_Datums)
     {
-        free((*datum)->value.z);
-        (*datum)->value.z = NULL;
+        Datum_T *dtms = (*datum)->value.dtms;
+        if (dtms && dtm_payloadUnref((char *)dtms))
+        {
+            /* last copy of the array, the datums in it go too */
+            for (size_t i = 0; i < dtm_n(*datum); i++)
+                Datum_free(&dtms[i]);
+            dtm_payloadFree((char *)dtms);
+        }
+        (*datum)->value.dtms = NULL;
     };
 
-    free(*datum);
+    dtm_convRelease(*datum);
+    dtm_release(*datum, sizeof(struct Datum));
     *datum = NULL;
     return;
 }
 
 bool Datum_isLocked(Datum_T datum)
 {
-    return (Datum_isDatum(datum) && datum->isLocked) ? true : false;
+    return (Datum_isDatum(datum) && dtm_locked(datum)) ? true : false;
+}
+
+/**
+ * @brief Flips the locked state of the datum
+ *
+ * @return the new state, 1 locked, 0 unlocked, -1 if not a datum
+ */
+short Datum_toggleLocked(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return -1;
+
+    dtm_setLocked(datum, !dtm_locked(datum));
+    return dtm_locked(datum) ? 1 : 0;
 }
 
 bool Datum_isString(Datum_T datum)
@@ -210,6 +215,16 @@ bool Datum_isNull(Datum_T datum)
     return (Datum_isDatum(datum) && datum->flags & DATUM_Null) ? true : false;
 }
 
+bool Datum_isBlob(Datum_T datum)
+{
+    return (Datum_isDatum(datum) && datum->flags & DATUM_Blob) ? true : false;
+}
+
+bool Datum_isDatums(Datum_T datum)
+{
+    return (Datum_isDatum(datum) && datum->flags & DATUM_Datums) ? true : false;
+}
+
 /**
  * @brief Creates a new Datum as an integer and sets its value to val
  * @param val The integer value to store
@@ -223,7 +238,7 @@ Datum_T Datum_asInteger(long long val)
     }
 
     datum->value.i = val;
-    datum->flags |= DATUM_Int | DATUM_Dyn;  // Dyn fordi vi allokerte med calloc
+    datum->flags |= DATUM_Int | DATUM_Dyn;  // Dyn fordi vi allokerte headeren selv
     // type-feltet ditt kan også settes her hvis du bruker det: datum->type = DATUM_Int;
 
     return datum;
@@ -248,11 +263,34 @@ Datum_T Datum_asDouble(double val)
     return datum;
 }
 
+/**
+ * @brief Creates a new Datum as a double written with dec decimals
+ *
+ * Datum_getAsString writes it with exactly dec digits after the decimal
+ * separator, rounded half away from zero from the shortest decimal of val;
+ * dec 0 writes it as Datum_asDouble does, as short as reads back as val.
+ *
+ * @param val The double value to store
+ * @param dec Number of decimals, 0 for the shortest
+ * @return New Datum_T or NULL on allocation failure
+ */
+Datum_T Datum_asDecimal(double val, short dec)
+{
+    Datum_T datum = Datum_asDouble(val);
+    if (datum) {
+        dtm_setDec(datum, dec > 0 ? dec : 0);
+    }
+
+    return datum;
+}
+
 /**
  * @brief Returns the value as double.
  *
  * If the datum is a double, returns it directly.
  * If the datum is an integer, converts it to double.
+ * If the datum is text holding a number, reads it, correctly rounded, with
+ * the decimal separator set by Datum_setNumberFormat.
  * Otherwise (not numeric, NULL, or invalid datum), returns DBL_MAX as error indicator.
  *
  * @param datum Valid Datum pointer
@@ -272,6 +310,11 @@ double Datum_getAsDouble(Datum_T datum)
         return (double)datum->value.i;  // Konverter int til double
     }
 
+    double r;
+    if (dtm_textToDouble(datum, &r)) {
+        return r;  // Tall skrevet som tekst
+    }
+
     return DBL_MAX;  // Ikke numerisk type
 }
 
@@ -280,6 +323,8 @@ double Datum_getAsDouble(Datum_T datum)
  *
  * - If the datum is an integer, returns it directly.
  * - If the datum is a double, converts it to long long (truncates decimal part).
+ * - If the datum is text holding a number, reads it as Datum_getAsDouble does;
+ *   whole numbers exactly, others truncated. LONG_MAX if it does not fit.
  * - Otherwise (not numeric, NULL, or invalid datum), returns LONG_MAX as error indicator.
  *
  * @note Converting from double may lose precision or cause overflow (no range check).
@@ -300,5 +345,1024 @@ long long Datum_getAsInteger(Datum_T datum)
         return (long long)datum->value.r;  // Truncates toward zero
     }
 
+    long long i;
+    if (dtm_textToInteger(datum, &i)) {
+        return i;
+    }
+
     return LONG_MAX;
 }
+
+/**
+ * @brief returns the size in bytes of one code unit in the given encoding
+ */
+size_t dtm_unitSize(dtm_encoding_t encoding)
+{
+    switch ((int)encoding)
+    {
+        case DATUM_UTF16:
+        case DATUM_UTF16LE:
+        case DATUM_UTF16BE:
+            return 2;
+        case DATUM_UTF32:
+        case DATUM_UTF32LE:
+        case DATUM_UTF32BE:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief maps the native byte order encodings to the LE or BE one they are
+ */
+static dtm_encoding_t dtm_canonical(dtm_encoding_t encoding)
+{
+    if (encoding == DTM_ENC_UTF16)
+        return DTM_HOST_BE ? DTM_ENC_UTF16BE : DTM_ENC_UTF16LE;
+    if (encoding == DTM_ENC_UTF32)
+        return DTM_HOST_BE ? DTM_ENC_UTF32BE : DTM_ENC_UTF32LE;
+    return encoding;
+}
+
+/**
+ * @brief reads code unit i of a 16 or 32 bit string in the given byte order
+ */
+static uint32_t dtm_unit(const uint8_t *s, size_t i, int encoding)
+{
+    switch (encoding)
+    {
+        case DATUM_UTF16LE: return s[2*i] | (s[2*i+1] << 8);
+        case DATUM_UTF16BE: return (s[2*i] << 8) | s[2*i+1];
+        case DATUM_UTF16:   { uint16_t u; memcpy(&u, s + 2*i, 2); return u; }
+        case DATUM_UTF32LE: return s[4*i] | (s[4*i+1] << 8) | (s[4*i+2] << 16) | ((uint32_t)s[4*i+3] << 24);
+        case DATUM_UTF32BE: return ((uint32_t)s[4*i] << 24) | (s[4*i+1] << 16) | (s[4*i+2] << 8) | s[4*i+3];
+        default:            { uint32_t u; memcpy(&u, s + 4*i, 4); return u; }
+    }
+}
+
+/**
+ * @brief counts the characters of str and checks that it is valid in the
+ * given encoding
+ *
+ * @return number of characters, or (size_t)-1 if str is not valid
+ */
+static size_t dtm_charCount(const char *str, size_t sz, dtm_encoding_t encoding)
+{
+    const uint8_t *s = (const uint8_t *)str;
+    size_t n = 0;
+
+    switch ((int)encoding)
+    {
+        case DATUM_UTF8:
+        case DTM_ENC_NONE:
+            if (!dtm_utf8_validate(str, sz))
+                return (encoding == DTM_ENC_NONE) ? sz : (size_t)-1;
+            return dtm_utf8_count(str, sz);
+
+        case DATUM_ASCII:
+            for (size_t i = 0; i < sz; i++)
+                if (s[i] & 0x80) return (size_t)-1;
+            return sz;
+
+        case DATUM_UTF16:
+        case DATUM_UTF16LE:
+        case DATUM_UTF16BE:
+            if (sz % 2) return (size_t)-1;
+            for (size_t i = 0; i < sz / 2; i++, n++)
+            {
+                uint32_t u = dtm_unit(s, i, encoding);
+                if (u >= 0xd800 && u <= 0xdbff)
+                {
+                    if (i + 1 >= sz / 2) return (size_t)-1;
+                    uint32_t l = dtm_unit(s, ++i, encoding);
+                    if (l < 0xdc00 || l > 0xdfff) return (size_t)-1;
+                }
+                else if (u >= 0xdc00 && u <= 0xdfff)
+                    return (size_t)-1;
+            }
+            return n;
+
+        case DATUM_UTF32:
+        case DATUM_UTF32LE:
+        case DATUM_UTF32BE:
+            if (sz % 4) return (size_t)-1;
+            for (size_t i = 0; i < sz / 4; i++)
+            {
+                uint32_t u = dtm_unit(s, i, encoding);
+                if (u > 0x10ffff || (u >= 0xd800 && u <= 0xdfff)) return (size_t)-1;
+            }
+            return sz / 4;
+
+        default:                                    /* single byte encodings */
+            return dtm_sbcs_supported(encoding) ? dtm_sbcs_check(encoding, str, sz) : sz;
+    }
+}
+
+/**
+ * @brief allocates a heap payload of size bytes with one reference
+ */
+char *dtm_payloadNew(size_t size)
+{
+    size_t total = offsetof(struct dtm_payload, z) + size;
+    struct dtm_payload *p = dtm_alloc(total);
+    if (!p)
+        return NULL;
+
+    atomic_init(&p->refs, 1);
+    p->size = (uint32_t)total;
+    return p->z;
+}
+
+/**
+ * @brief gives back a heap payload once its last reference is gone
+ */
+void dtm_payloadFree(char *z)
+{
+    struct dtm_payload *p = DTM_PAYLOAD(z);
+    dtm_release(p, p->size);
+}
+
+/**
+ * @brief copies sz bytes into a new payload followed by DATUM_TERM_BYTES zeros
+ */
+static char *dtm_dupPayload(const void *src, size_t sz)
+{
+    char *z = dtm_payloadNew(sz + DATUM_TERM_BYTES);
+    if (!z)
+        return NULL;
+    if (sz)
+        memcpy(z, src, sz);
+    memset(z + sz, 0, DATUM_TERM_BYTES);
+    return z;
+}
+
+/**
+ * @brief stores a short string in the datum itself
+ *
+ * The type flag (DATUM_Str, DATUM_StrW or DATUM_StrU) must already be set.
+ *
+ * @return false, leaving the datum untouched, if the string does not fit
+ */
+bool dtm_setInline(Datum_T datum, const void *src, size_t sz, size_t n, dtm_encoding_t encoding)
+{
+    if (!dtm_fitsInline(sz, dtm_unitSize(encoding)))
+        return false;
+
+    datum->flags |= DATUM_Inline | DATUM_Term;
+    dtm_setEnc(datum, encoding);
+    dtm_setSize(datum, sz, n);
+
+    char *s = dtm_bytes(datum);
+    memcpy(s, src, sz);
+    memset(s + sz, 0, DTM_INLINE_SIZE - sz);
+    return true;
+}
+
+/**
+ * @brief gives the datum its own copy of the string or blob bytes at src
+ *
+ * Used where a datum has to outlive memory it does not own. Short text goes
+ * inline, everything else to a new heap payload.
+ */
+static bool dtm_own(Datum_T datum, const char *src)
+{
+    size_t sz = dtm_sz(datum), n = dtm_n(datum);
+
+    if ((datum->flags & DATUM_Text) && dtm_setInline(datum, src, sz, n, dtm_enc(datum)))
+        return true;
+
+    char *z = dtm_dupPayload(src, sz);
+    if (!z)
+        return false;
+    datum->value.z = z;
+    datum->flags |= DATUM_Dyn | DATUM_Term;
+    return true;
+}
+
+/**
+ * @brief stores text in the datum, inline when short, otherwise in a copy
+ * on the heap
+ *
+ * The type flag (DATUM_Str, DATUM_StrW or DATUM_StrU) must already be set.
+ */
+static bool dtm_setText(Datum_T datum, const void *src, size_t sz, size_t n, dtm_encoding_t encoding)
+{
+    if (dtm_setInline(datum, src, sz, n, encoding))
+        return true;
+
+    datum->value.z = dtm_dupPayload(src, sz);
+    if (!datum->value.z)
+        return false;
+    datum->flags |= DATUM_Term | DATUM_Dyn;
+    dtm_setEnc(datum, encoding);
+    dtm_setSize(datum, sz, n);
+    return true;
+}
+
+#ifndef DATUM_NO_ADAPTIVE
+
+/**
+ * @brief the narrowest fixed width encoding that holds every character of
+ * a valid utf-16 or utf-32 string: Latin-1, utf-16 without surrogates or
+ * utf-32, the last two in native byte order
+ */
+static dtm_encoding_t dtm_narrowest(const char *str, size_t sz, dtm_encoding_t encoding)
+{
+    const uint8_t *s = (const uint8_t *)str;
+    size_t unit = dtm_unitSize(encoding);
+    uint32_t max = 0;
+
+    for (size_t i = 0; i < sz / unit; i++) {
+        uint32_t u = dtm_unit(s, i, encoding);
+        if (unit == 2 && u >= 0xd800 && u <= 0xdfff)
+            return DTM_ENC_UTF32;                   /* a surrogate pair */
+        max |= u;
+    }
+    return max < 0x100 ? DTM_ENC_ISO8859_1 : max < 0x10000 ? DTM_ENC_UTF16 : DTM_ENC_UTF32;
+}
+
+#endif /* DATUM_NO_ADAPTIVE */
+
+/**
+ * @brief stores utf-16 or utf-32 text in the narrowest fixed width that
+ * holds its widest character, so each character takes one code unit and
+ * Latin-1 text one byte
+ *
+ * The type flag must already be set. Built with -DDATUM_NO_ADAPTIVE the
+ * text is kept as given.
+ */
+static bool dtm_setWide(Datum_T datum, const void *src, size_t sz, size_t n, dtm_encoding_t encoding)
+{
+#ifndef DATUM_NO_ADAPTIVE
+    dtm_encoding_t narrow = dtm_narrowest(src, sz, encoding);
+    if (dtm_canonical(narrow) != dtm_canonical(encoding)) {
+        size_t nsz = n * dtm_unitSize(narrow);
+        char buf[DTM_INLINE_SIZE > 0 ? DTM_INLINE_SIZE : 1];
+
+        /* every character becomes exactly one unit, so nsz bytes is room enough */
+        if (dtm_fitsInline(nsz, dtm_unitSize(narrow))) {
+            dtm_transcode(encoding, narrow, src, sz, buf, NULL);
+            return dtm_setInline(datum, buf, nsz, n, narrow);
+        }
+        char *z = dtm_payloadNew(nsz + DATUM_TERM_BYTES);
+        if (!z)
+            return false;
+        dtm_transcode(encoding, narrow, src, sz, z, NULL);
+        memset(z + nsz, 0, DATUM_TERM_BYTES);
+        datum->value.z = z;
+        datum->flags |= DATUM_Term | DATUM_Dyn;
+        dtm_setEnc(datum, narrow);
+        dtm_setSize(datum, nsz, n);
+        return true;
+    }
+#endif
+    return dtm_setText(datum, src, sz, n, encoding);
+}
+
+/**
+ * @brief measures and checks a string for the string constructors
+ *
+ * @param str the string
+ * @param len number of bytes, or -1 when str is nul terminated
+ * @param encoding encoding of str
+ * @param n receives the number of characters
+ * @return number of bytes, or (size_t)-1 if str is too long or not valid
+ */
+size_t dtm_strMeasure(const char *str, int len, dtm_encoding_t encoding, size_t *n)
+{
+    size_t unit = dtm_unitSize(encoding);
+    size_t sz = (size_t)len;
+    if (len < 0)
+    {
+        for (sz = 0; sz <= DATUM_STR_MAXSIZE && memcmp(str + sz, "\0\0\0\0", unit); sz += unit)
+            ;
+    }
+    if (sz > DATUM_STR_MAXSIZE)
+        return (size_t)-1;
+
+    *n = dtm_charCount(str, sz, encoding);
+    return (*n == (size_t)-1) ? (size_t)-1 : sz;
+}
+
+/**
+ * @brief checks and counts the string of a DATUM_Raw datum, once
+ *
+ * Threads that get here at the same time may both do the work; they store
+ * the same count with an atomic store and leave the size alone. The count
+ * is in place before DATUM_Raw is cleared with release order, so a reader
+ * that finds it cleared in dtm_ready sees the count.
+ *
+ * @return false if the bytes are not valid in the datum's encoding
+ */
+bool dtm_settle(struct Datum *d)
+{
+    size_t n = dtm_charCount(dtm_bytes(d), dtm_sz(d), dtm_enc(d));
+
+    if (n == (size_t)-1) {
+        __atomic_fetch_or(&d->flags, DATUM_Malformed, __ATOMIC_RELAXED);
+        __atomic_fetch_and(&d->flags, ~DATUM_Raw, __ATOMIC_RELEASE);
+        return false;
+    }
+    dtm_setCount(d, n);
+    __atomic_fetch_and(&d->flags, ~DATUM_Raw, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Creates a new Datum holding a copy of str in the given encoding
+ *
+ * The bytes are checked against the encoding; strings that are not valid
+ * are refused. DTM_ENC_NONE accepts anything, counting characters as
+ * utf-8 when the bytes are valid utf-8.
+ *
+ * @param str the string
+ * @param len number of bytes, or -1 when str is nul terminated
+ * @param encoding encoding of str
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asString(const char *str, int len, dtm_encoding_t encoding)
+{
+    size_t n;
+    if (!str)
+        return NULL;
+
+    size_t sz = dtm_strMeasure(str, len, encoding, &n);
+    if (sz == (size_t)-1)
+        return NULL;
+
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->flags |= DATUM_Str;
+    if (!(dtm_unitSize(encoding) > 1 ? dtm_setWide(datum, str, sz, n, encoding)
+                                     : dtm_setText(datum, str, sz, n, encoding))) {
+        Datum_free(&datum);
+        return NULL;
+    }
+
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum holding a copy of a wide character string
+ *
+ * @param str the string
+ * @param len number of wide characters, or -1 when str is nul terminated
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asStringW(const wchar_t *str, int len)
+{
+    if (!str)
+        return NULL;
+
+    size_t cnt = (len < 0) ? wcslen(str) : (size_t)len;
+    size_t sz = cnt * sizeof(wchar_t);
+    if (sz > DATUM_STR_MAXSIZE)
+        return NULL;
+
+    dtm_encoding_t enc = (sizeof(wchar_t) == 2) ? DTM_ENC_UTF16 : DTM_ENC_UTF32;
+    size_t n = dtm_charCount((const char *)str, sz, enc);
+    if (n == (size_t)-1)
+        return NULL;
+
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->flags |= DATUM_StrW;
+    if (!dtm_setWide(datum, str, sz, n, enc)) {
+        Datum_free(&datum);
+        return NULL;
+    }
+
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum holding a copy of an utf-32 string
+ *
+ * @param str the string
+ * @param len number of code points, or -1 when str is nul terminated
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asStringU(const unsigned int *str, int len)
+{
+    if (!str)
+        return NULL;
+
+    size_t cnt = (size_t)len;
+    if (len < 0)
+        for (cnt = 0; str[cnt]; cnt++)
+            ;
+    size_t sz = cnt * sizeof(uint32_t);
+    if (sz > DATUM_STR_MAXSIZE)
+        return NULL;
+
+    if (dtm_charCount((const char *)str, sz, DTM_ENC_UTF32) == (size_t)-1)
+        return NULL;
+
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->flags |= DATUM_StrU;
+    if (!dtm_setWide(datum, str, sz, cnt, DTM_ENC_UTF32)) {
+        Datum_free(&datum);
+        return NULL;
+    }
+
+    return datum;
+}
+
+/**
+ * @brief Creates a new string Datum holding a copy of the bytes, unchecked
+ *
+ * Nothing is validated, counted or converted here: the bytes are checked
+ * against the encoding and their characters counted the first time the
+ * length or the string itself is asked for, and only then. Meant for
+ * columns that are passed through and seldom looked at. Bytes that prove
+ * not valid leave the datum DATUM_Malformed, with no string or length.
+ * Wide encodings are kept as given, not narrowed as in Datum_asString.
+ *
+ * @param buf the bytes
+ * @param len number of bytes, or -1 when buf is nul terminated
+ * @param encoding declared encoding of buf
+ * @return New Datum_T or NULL if buf is too long or on allocation failure
+ */
+Datum_T Datum_asRawBytes(const char *buf, int len, dtm_encoding_t encoding)
+{
+    if (!buf)
+        return NULL;
+
+    size_t unit = dtm_unitSize(encoding), sz = (size_t)len;
+    if (len < 0)
+        for (sz = 0; sz <= DATUM_STR_MAXSIZE && memcmp(buf + sz, "\0\0\0\0", unit); sz += unit)
+            ;
+    if (sz > DATUM_STR_MAXSIZE)
+        return NULL;
+
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->flags |= DATUM_Str | DATUM_Raw;
+    if (!dtm_setText(datum, buf, sz, 0, encoding)) {
+        Datum_free(&datum);
+        return NULL;
+    }
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum holding a copy of len bytes
+ *
+ * @param str the bytes
+ * @param len number of bytes
+ * @param enc encoding of the content, if it is text, otherwise DTM_ENC_NONE
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asBLOB(void *str, int len, short enc)
+{
+    if ((!str && len) || len < 0)
+        return NULL;
+
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->value.z = dtm_dupPayload(str, (size_t)len);
+    if (!datum->value.z) {
+        Datum_free(&datum);
+        return NULL;
+    }
+    datum->flags |= DATUM_Blob | DATUM_Dyn;
+    dtm_setEnc(datum, (dtm_encoding_t)enc);
+    dtm_setSize(datum, (size_t)len, (size_t)len);
+
+    return datum;
+}
+
+/**
+ * @brief wraps caller owned bytes in a new datum without copying them
+ *
+ * @param type DATUM_Str or DATUM_Blob
+ * @param owner DATUM_Static or DATUM_Ephem
+ */
+static Datum_T dtm_borrow(const char *str, size_t sz, size_t n, dtm_encoding_t encoding,
+                          size_t type, size_t owner, bool terminated)
+{
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->flags &= ~DATUM_Dyn;
+    datum->flags |= type | owner | (terminated ? DATUM_Term : 0);
+    datum->value.z = (char *)str;
+    dtm_setEnc(datum, encoding);
+    dtm_setSize(datum, sz, n);
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum wrapping a string that lives for the rest of
+ * the program, e.g. a literal, without copying it
+ *
+ * The string is checked as in Datum_asString. It is only nul terminated if
+ * the source is, which is known when len is -1.
+ *
+ * @param str the string
+ * @param len number of bytes, or -1 when str is nul terminated
+ * @param encoding encoding of str
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asStringStatic(const char *str, int len, dtm_encoding_t encoding)
+{
+    size_t n;
+    if (!str)
+        return NULL;
+
+    size_t sz = dtm_strMeasure(str, len, encoding, &n);
+    if (sz == (size_t)-1)
+        return NULL;
+
+    return dtm_borrow(str, sz, n, encoding, DATUM_Str, DATUM_Static, len < 0);
+}
+
+/**
+ * @brief Creates a new Datum wrapping a string owned by the caller, e.g. a
+ * field of a memory mapped record, without copying it
+ *
+ * The caller keeps str valid for as long as the datum is used, or calls
+ * Datum_promote first. Datum_copy gives copies their own bytes.
+ *
+ * @param str the string
+ * @param len number of bytes, or -1 when str is nul terminated
+ * @param encoding encoding of str
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asStringBorrowed(const char *str, int len, dtm_encoding_t encoding)
+{
+    size_t n;
+    if (!str)
+        return NULL;
+
+    size_t sz = dtm_strMeasure(str, len, encoding, &n);
+    if (sz == (size_t)-1)
+        return NULL;
+
+    return dtm_borrow(str, sz, n, encoding, DATUM_Str, DATUM_Ephem, len < 0);
+}
+
+/**
+ * @brief As Datum_asStringStatic, for len bytes of any content
+ */
+Datum_T Datum_asBLOBStatic(const void *str, int len, short enc)
+{
+    if ((!str && len) || len < 0)
+        return NULL;
+
+    return dtm_borrow(str, (size_t)len, (size_t)len, (dtm_encoding_t)enc,
+                      DATUM_Blob, DATUM_Static, false);
+}
+
+/**
+ * @brief As Datum_asStringBorrowed, for len bytes of any content
+ */
+Datum_T Datum_asBLOBBorrowed(const void *str, int len, short enc)
+{
+    if ((!str && len) || len < 0)
+        return NULL;
+
+    return dtm_borrow(str, (size_t)len, (size_t)len, (dtm_encoding_t)enc,
+                      DATUM_Blob, DATUM_Ephem, false);
+}
+
+/**
+ * @brief Gives a datum wrapping caller owned bytes (DATUM_Ephem) its own
+ * copy, so that it can outlive the source
+ *
+ * Other datums are returned as they are. The datum must not be read by
+ * other threads while it is promoted.
+ *
+ * @param datum Valid Datum pointer
+ * @return datum, or NULL if it is not a datum or on allocation failure
+ */
+Datum_T Datum_promote(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return NULL;
+    if (!(datum->flags & DATUM_Ephem))
+        return datum;
+
+    const char *src = datum->value.z;
+    datum->flags &= ~DATUM_Ephem;
+    if (!dtm_own(datum, src)) {
+        datum->flags |= DATUM_Ephem;
+        return NULL;
+    }
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum holding null
+ */
+Datum_T Datum_asNull(void)
+{
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->flags |= DATUM_Null;
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum holding the pointer val; the pointee is not owned
+ */
+Datum_T Datum_asVoidPtr(void *val)
+{
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->value.uptr = val;
+    datum->flags |= DATUM_UINTPTR;
+
+    return datum;
+}
+
+/**
+ * @brief Creates a new Datum holding an array of datums
+ *
+ * The array itself is copied, the datums in it are taken over and freed
+ * together with the new datum.
+ *
+ * @param datums array of len datums
+ * @param len number of datums
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_asDatums(Datum_T *datums, int len)
+{
+    if ((!datums && len) || len < 0)
+        return NULL;
+    for (int i = 0; i < len; i++)
+        if (!Datum_isDatum(datums[i]))
+            return NULL;
+
+    Datum_T datum = Datum_new();
+    if (!datum)
+        return NULL;
+
+    datum->value.dtms = (Datum_T *)dtm_payloadNew(((size_t)len + 1) * sizeof(Datum_T));
+    if (!datum->value.dtms) {
+        Datum_free(&datum);
+        return NULL;
+    }
+    if (len)
+        memcpy(datum->value.dtms, datums, (size_t)len * sizeof(Datum_T));
+    datum->value.dtms[len] = NULL;
+    datum->flags |= DATUM_Datums | DATUM_Dyn;
+    dtm_setSize(datum, (size_t)len, (size_t)len);
+
+    return datum;
+}
+
+/**
+ * @brief tells if text stored as `from` can be handed out unchanged as `to`
+ */
+static bool dtm_isCompatible(dtm_encoding_t from, dtm_encoding_t to)
+{
+    if (to == DTM_ENC_NONE || dtm_canonical(from) == dtm_canonical(to))
+        return true;
+    if (from != DTM_ENC_ASCII)
+        return false;
+
+    /* ascii is a subset of every single byte encoding and of utf-8 */
+    return dtm_unitSize(to) == 1;
+}
+
+/**
+ * @brief Returns the string held by the datum
+ *
+ * The string is owned by the datum and stays valid until Datum_free. It is
+ * nul terminated unless it wraps caller memory of an explicit length
+ * (Datum_asStringStatic/Borrowed), use Datum_getSize for its length.
+ *
+ * Strings of any width are converted to the wanted encoding on request:
+ * utf-8, utf-16 or utf-32 in either byte order, or one of the single byte
+ * encodings. Text stored as DTM_ENC_NONE is read as utf-8 when it is valid
+ * utf-8 and as ISO-8859-15 otherwise. The converted string is kept with the
+ * datum. Datums in an arena or a view are only given in their own encoding.
+ *
+ * Integers and doubles are written as text, doubles as short as reads back
+ * as the same double, or with the decimals given to Datum_asDecimal, and
+ * the decimal separator of Datum_setNumberFormat. The text is kept with the
+ * datum, see Datum_formatNumber for numbers in an arena or a view.
+ *
+ * @param datum Valid Datum pointer
+ * @param encoding wanted encoding, DTM_ENC_NONE for the stored one, utf-8
+ * for numbers
+ * @return the nul terminated string, or NULL if the datum is not a string
+ * or a number, or can not be given in the wanted encoding
+ */
+unsigned char *Datum_getAsString(Datum_T datum, dtm_encoding_t encoding)
+{
+    if (!Datum_isDatum(datum))
+        return NULL;
+    if (datum->flags & (DATUM_Int | DATUM_Double))
+        return (unsigned char *)dtm_numberText(datum, encoding);
+    if (!(datum->flags & DATUM_Text) || !dtm_ready(datum))
+        return NULL;
+
+    if (encoding == DTM_ENC_NONE || dtm_isCompatible(dtm_textEnc(datum), encoding))
+        return (unsigned char *)dtm_bytes(datum);
+
+    /* the native byte order shares its copy with the LE or BE twin */
+    return (unsigned char *)dtm_convTo(datum, dtm_canonical(encoding), NULL);
+}
+
+/**
+ * @brief Returns the string held by the datum as wide characters, owned by
+ * the datum; converted as in Datum_getAsString when it is stored otherwise
+ */
+wchar_t *Datum_getAsStringW(Datum_T datum)
+{
+    dtm_encoding_t wenc = (sizeof(wchar_t) == 2) ? DTM_ENC_UTF16 : DTM_ENC_UTF32;
+
+    return (wchar_t *)Datum_getAsString(datum, wenc);
+}
+
+/**
+ * @brief Returns the string held by the datum in utf-32, owned by the
+ * datum; converted as in Datum_getAsString when it is stored otherwise
+ */
+uint32_t *Datum_getAsStringU(Datum_T datum)
+{
+    return (uint32_t *)Datum_getAsString(datum, DTM_ENC_UTF32);
+}
+
+/**
+ * @brief Returns the bytes of a blob datum, owned by the datum
+ */
+void *Datum_getAsBlob(Datum_T datum)
+{
+    if (!Datum_isDatum(datum) || !(datum->flags & DATUM_Blob))
+        return NULL;
+
+    return datum->value.z;
+}
+
+/**
+ * @brief Returns the NULL terminated array of an array of datums, owned by the datum
+ */
+Datum_T *Datum_getAsDatums(Datum_T datum)
+{
+    if (!Datum_isDatum(datum) || !(datum->flags & DATUM_Datums))
+        return NULL;
+
+    return datum->value.dtms;
+}
+
+/**
+ * @brief Returns the number of bytes occupied by the value
+ *
+ * Strings and blobs report their payload without the terminator, arrays of
+ * datums the size of the pointer array.
+ *
+ * @return number of bytes, or -1 if datum is not a datum
+ */
+long Datum_getSize(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return -1;
+
+    if (datum->flags & (DATUM_Text | DATUM_Blob))
+        return (long)dtm_sz(datum);
+    if (datum->flags & DATUM_Datums)
+        return (long)(dtm_n(datum) * sizeof(Datum_T));
+    if (datum->flags & DATUM_Int)
+        return sizeof(long long);
+    if (datum->flags & DATUM_Double)
+        return sizeof(double);
+    if (datum->flags & DATUM_UINTPTR)
+        return sizeof(void *);
+
+    return 0;
+}
+
+/**
+ * @brief Returns the number of characters of a string datum
+ *
+ * The count is taken once when the datum is made, so this is O(1) in every
+ * encoding: code points for text, bytes for blobs and elements for an
+ * array of datums.
+ *
+ * Raw strings (Datum_asRawBytes) are checked and counted on the first call.
+ *
+ * @return the length, 0 for values that have none, -1 if not a datum or
+ * the raw bytes are not valid
+ */
+long Datum_getLength(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return -1;
+
+    if ((datum->flags & DATUM_Text) && !dtm_ready(datum))
+        return -1;
+    if (datum->flags & (DATUM_Text | DATUM_Blob | DATUM_Datums))
+        return (long)dtm_n(datum);
+
+    return 0;
+}
+
+/**
+ * @brief Returns character i of a string datum as a code point
+ *
+ * O(1) for text in a fixed width form, which is how utf-16 and utf-32
+ * strings are stored (see dtm_setWide), and for single byte encodings and
+ * ASCII-only utf-8; other utf-8 is walked from the start. DTM_ENC_NONE
+ * text is read as in Datum_getAsString.
+ *
+ * @return the code point, or -1 if the datum is not a string or i is out
+ * of range
+ */
+long Datum_getCharAt(Datum_T datum, long i)
+{
+    if (!Datum_isDatum(datum) || !(datum->flags & DATUM_Text) || !dtm_ready(datum)
+        || i < 0 || (size_t)i >= dtm_n(datum))
+        return -1;
+
+    const uint8_t *s = (const uint8_t *)dtm_bytes(datum);
+    dtm_encoding_t enc = dtm_textEnc(datum);
+    size_t sz = dtm_sz(datum), n = dtm_n(datum), unit = dtm_unitSize(enc);
+
+    if (sz == n * unit) {
+        /* one unit per character */
+        if (unit > 1)
+            return (long)dtm_unit(s, (size_t)i, enc);
+        return enc == DTM_ENC_UTF8 || enc == DTM_ENC_ASCII || !dtm_sbcs_supported(enc)
+               ? (long)s[i] : (long)dtm_sbcs_decode(enc, s[i]);
+    }
+    if (unit == 2) {
+        size_t k = 0;
+        for (long c = 0; c < i; c++) {
+            uint32_t u = dtm_unit(s, k, enc);
+            k += (u >= 0xd800 && u <= 0xdbff) ? 2 : 1;
+        }
+        uint32_t u = dtm_unit(s, k, enc);
+        if (u < 0xd800 || u > 0xdbff)
+            return (long)u;
+        return (long)(0x10000 + ((u - 0xd800) << 10) + (dtm_unit(s, k + 1, enc) - 0xdc00));
+    }
+    size_t k = 0;                                   /* utf-8, valid as it has fewer characters than bytes */
+    for (long c = 0; c < i; c++)
+        k += utf8_charlen(s[k]);
+    return (long)utf8_to_32(s + k);
+}
+
+/**
+ * @brief Returns the encoding of a string or blob, DTM_ENC_NONE otherwise
+ */
+dtm_encoding_t Datum_getEncoding(Datum_T datum)
+{
+    return Datum_isDatum(datum) ? dtm_enc(datum) : DTM_ENC_NONE;
+}
+
+/**
+ * @brief Returns the type flag of the datum, one of DATUM_Int, DATUM_Str, ..
+ *
+ * @return the type flag, or DATUM_Invalid if datum is not a datum
+ */
+long Datum_getType(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return DATUM_Invalid;
+
+    return (long)(datum->flags & DATUM_TYPEMASK);
+}
+
+/**
+ * @brief Tells if two strings hold the same text, whatever their encodings
+ */
+static bool dtm_textEqual(Datum_T datum_1, Datum_T datum_2)
+{
+    size_t sz1 = dtm_sz(datum_1), sz2 = dtm_sz(datum_2);
+
+    if (dtm_enc(datum_1) == dtm_enc(datum_2))
+        return sz1 == sz2 && memcmp(dtm_bytes(datum_1), dtm_bytes(datum_2), sz1) == 0;
+
+    /* bytes that are not valid have no text to compare */
+    if (!dtm_ready(datum_1) || !dtm_ready(datum_2) || dtm_n(datum_1) != dtm_n(datum_2))
+        return false;
+    return dtm_compareText(dtm_textEnc(datum_1), dtm_bytes(datum_1), sz1,
+                           dtm_textEnc(datum_2), dtm_bytes(datum_2), sz2) == 0;
+}
+
+/**
+ * @brief Tells if two datums hold the same value
+ *
+ * Integers and doubles compare by exact numeric value, as in
+ * Datum_compare: NaN equals NaN, and 2^53 + 1 does not equal the double
+ * 2^53. Strings compare by their code points whatever encoding each is kept
+ * in, DTM_ENC_NONE read as in Datum_getAsString; blobs by their bytes,
+ * arrays of datums element by element. Two interned strings are equal
+ * exactly when they share their payload. Type, length and a hash already
+ * computed by Datum_hash rule out most unequal pairs before any byte is
+ * read.
+ *
+ * @return true if equal, false if not or if either is not a datum
+ */
+bool Datum_isEqual(Datum_T datum_1, Datum_T datum_2)
+{
+    if (!Datum_isDatum(datum_1) || !Datum_isDatum(datum_2))
+        return false;
+    if (datum_1 == datum_2)
+        return true;
+
+    size_t f1 = datum_1->flags, f2 = datum_2->flags;
+
+    if ((f1 & f2 & DATUM_Interned) && dtm_enc(datum_1) == dtm_enc(datum_2))
+        return datum_1->value.z == datum_2->value.z;
+
+    if ((f1 & (DATUM_Int | DATUM_Double)) && (f2 & (DATUM_Int | DATUM_Double)))
+        return dtm_numCompare(datum_1, datum_2) == 0;
+
+    uint64_t h1 = dtm_hash(datum_1), h2 = dtm_hash(datum_2);
+    if (h1 && h2 && h1 != h2)
+        return false;
+
+    if ((f1 & DATUM_Text) && (f2 & DATUM_Text))
+        return dtm_textEqual(datum_1, datum_2);
+
+    if ((f1 & DATUM_TYPEMASK) != (f2 & DATUM_TYPEMASK))
+        return false;
+
+    if (f1 & DATUM_Blob)
+    {
+        size_t sz = dtm_sz(datum_1);
+        return dtm_enc(datum_1) == dtm_enc(datum_2) && sz == dtm_sz(datum_2)
+            && memcmp(dtm_bytes(datum_1), dtm_bytes(datum_2), sz) == 0;
+    }
+    if (f1 & DATUM_Datums)
+    {
+        if (dtm_n(datum_1) != dtm_n(datum_2))
+            return false;
+        for (size_t i = 0; i < dtm_n(datum_1); i++)
+            if (!Datum_isEqual(datum_1->value.dtms[i], datum_2->value.dtms[i]))
+                return false;
+        return true;
+    }
+    if (f1 & DATUM_UINTPTR)
+        return datum_1->value.uptr == datum_2->value.uptr;
+
+    return (f1 & DATUM_Null) ? true : false;
+}
+
+/**
+ * @brief Returns a copy of the datum
+ *
+ * Datums are immutable, so the copy shares the payload of a string, blob
+ * or array of datums with the original through a reference count instead
+ * of duplicating it; the payload is released with the last of them. Only
+ * payloads living in an arena are duplicated, as the copy may outlive the
+ * arena.
+ *
+ * @param datum Valid Datum pointer
+ * @return New Datum_T or NULL on invalid input or allocation failure
+ */
+Datum_T Datum_copy(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return NULL;
+
+    Datum_T copy = dtm_alloc(sizeof(struct Datum));
+    if (!copy)
+        return NULL;
+    memcpy(copy, datum, sizeof(struct Datum));
+
+    size_t flags = datum->flags;
+    copy->flags &= ~(DATUM_Arena | DATUM_Converted);
+#ifndef DATUM_COMPACT
+    copy->conv = NULL;
+#endif
+    if (flags & (DATUM_Inline | DATUM_Interned | DATUM_Static))
+        return copy;                                /* nothing shared to account for */
+
+    if ((flags & (DATUM_Arena | DATUM_Ephem)) && (flags & (DATUM_Text | DATUM_Blob)))
+    {
+        /* the source may go away before the copy does */
+        copy->flags &= ~DATUM_Ephem;
+        if (!dtm_own(copy, datum->value.z)) {
+            dtm_release(copy, sizeof(struct Datum));
+            return NULL;
+        }
+        return copy;
+    }
+
+    copy->flags |= DATUM_Dyn;
+    if (flags & (DATUM_Text | DATUM_Blob | DATUM_Datums))
+        dtm_payloadRetain(datum->value.z);
+    return copy;
+}
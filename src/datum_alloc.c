@@ -0,0 +1,260 @@
+/*
+ * datum_alloc.c
+ *
+ * Slab allocator behind Datum_new/Datum_free and the small payloads.
+ *
+ * Memory is handed out in size classes of 16 byte steps up to
+ * DTM_SLAB_MAXSIZE bytes. Each thread keeps one free list per class and
+ * carves new objects from its current slab, so the common case of freeing
+ * a datum and creating the next one never reaches malloc. Free lists that
+ * grow past DTM_TCACHE_MAX objects hand a batch over to a shared depot,
+ * which also receives the free lists of threads that exit; threads that run
+ * dry refill from the depot before they carve a new slab.
+ *
+ * Slabs are never given back to the system. Larger requests go straight to
+ * malloc. Build with -DDATUM_NO_SLAB to use plain malloc/free for
+ * everything, e.g. under valgrind or the address sanitizer.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#define DTM_SLAB_SIZE     (64 * 1024)
+#define DTM_SLAB_STEP     16
+#define DTM_SLAB_CLASSES  (DTM_SLAB_MAXSIZE / DTM_SLAB_STEP)
+#define DTM_TCACHE_MAX    4096      /* objects per class before spilling to the depot */
+#define DTM_BATCH         1024      /* objects moved between thread and depot at a time */
+
+struct dtm_free {
+    struct dtm_free *next;
+};
+
+struct dtm_tcache {
+    struct dtm_free *list[DTM_SLAB_CLASSES];
+    size_t count[DTM_SLAB_CLASSES];
+    char *cur[DTM_SLAB_CLASSES];    /* next unused object in the current slab */
+    char *end[DTM_SLAB_CLASSES];
+    Datum_AllocStats stats;
+    bool registered;
+};
+
+static _Thread_local struct dtm_tcache tcache;
+
+static atomic_ullong slabs;
+
+#ifndef DATUM_NO_SLAB
+
+static struct {
+    pthread_mutex_t lock;
+    struct dtm_free *list;
+    atomic_size_t count;
+} depot[DTM_SLAB_CLASSES];
+
+static pthread_once_t depot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+
+static inline size_t dtm_class(size_t size)
+{
+    return (size + DTM_SLAB_STEP - 1) / DTM_SLAB_STEP - 1;
+}
+
+/**
+ * @brief moves up to max objects from the front of the thread list to the depot
+ */
+static void dtm_spill(struct dtm_tcache *tc, size_t cls, size_t max)
+{
+    struct dtm_free *head = tc->list[cls], *tail = head;
+    size_t moved = 1;
+
+    if (!head)
+        return;
+    while (moved < max && tail->next) {
+        tail = tail->next;
+        moved++;
+    }
+    tc->list[cls] = tail->next;
+    tc->count[cls] -= moved;
+
+    pthread_mutex_lock(&depot[cls].lock);
+    tail->next = depot[cls].list;
+    depot[cls].list = head;
+    atomic_fetch_add_explicit(&depot[cls].count, moved, memory_order_relaxed);
+    pthread_mutex_unlock(&depot[cls].lock);
+}
+
+/**
+ * @brief takes up to DTM_BATCH objects from the depot into the thread list
+ */
+static bool dtm_refill(struct dtm_tcache *tc, size_t cls)
+{
+    struct dtm_free *head, *tail;
+    size_t moved = 1;
+
+    pthread_mutex_lock(&depot[cls].lock);
+    head = tail = depot[cls].list;
+    if (head) {
+        while (moved < DTM_BATCH && tail->next) {
+            tail = tail->next;
+            moved++;
+        }
+        depot[cls].list = tail->next;
+        atomic_fetch_sub_explicit(&depot[cls].count, moved, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&depot[cls].lock);
+
+    if (!head)
+        return false;
+    tail->next = tc->list[cls];
+    tc->list[cls] = head;
+    tc->count[cls] += moved;
+    return true;
+}
+
+/* pthread key destructor: the free lists of an exiting thread go to the depot */
+static void dtm_tcacheExit(void *arg)
+{
+    struct dtm_tcache *tc = arg;
+
+    for (size_t cls = 0; cls < DTM_SLAB_CLASSES; cls++)
+        dtm_spill(tc, cls, SIZE_MAX);
+}
+
+static void dtm_depotInit(void)
+{
+    for (size_t cls = 0; cls < DTM_SLAB_CLASSES; cls++)
+        pthread_mutex_init(&depot[cls].lock, NULL);
+    pthread_key_create(&tcache_key, dtm_tcacheExit);
+}
+
+/* makes sure the thread's free lists reach the depot when the thread exits */
+static void dtm_register(struct dtm_tcache *tc)
+{
+    pthread_once(&depot_once, dtm_depotInit);
+    pthread_setspecific(tcache_key, tc);
+    tc->registered = true;
+}
+
+/**
+ * @brief allocates size bytes, uninitialized
+ *
+ * Objects up to DTM_SLAB_MAXSIZE come from the size class slabs, anything
+ * larger from malloc. The memory must be given back with dtm_release and
+ * the same size.
+ */
+void *dtm_alloc(size_t size)
+{
+    struct dtm_tcache *tc = &tcache;
+
+    tc->stats.allocs++;
+    if (size > DTM_SLAB_MAXSIZE || size == 0) {
+        tc->stats.sysAllocs++;
+        return malloc(size ? size : 1);
+    }
+
+    size_t cls = dtm_class(size);
+    struct dtm_free *obj = tc->list[cls];
+    if (!obj) {
+        if (!tc->registered)
+            dtm_register(tc);
+        if (atomic_load_explicit(&depot[cls].count, memory_order_relaxed)
+            && dtm_refill(tc, cls))
+            obj = tc->list[cls];
+    }
+    if (obj) {
+        tc->list[cls] = obj->next;
+        tc->count[cls]--;
+        tc->stats.hits++;
+        return obj;
+    }
+
+    size_t objsize = (cls + 1) * DTM_SLAB_STEP;
+    if (!tc->cur[cls] || (size_t)(tc->end[cls] - tc->cur[cls]) < objsize) {
+        char *slab = malloc(DTM_SLAB_SIZE);
+        if (!slab)
+            return NULL;
+        atomic_fetch_add_explicit(&slabs, 1, memory_order_relaxed);
+        tc->cur[cls] = slab;
+        tc->end[cls] = slab + DTM_SLAB_SIZE;
+    }
+    obj = (struct dtm_free *)tc->cur[cls];
+    tc->cur[cls] += objsize;
+    tc->stats.carved++;
+    return obj;
+}
+
+/**
+ * @brief gives back memory from dtm_alloc; size must match the allocation
+ */
+void dtm_release(void *ptr, size_t size)
+{
+    struct dtm_tcache *tc = &tcache;
+
+    if (!ptr)
+        return;
+    tc->stats.frees++;
+    if (size > DTM_SLAB_MAXSIZE || size == 0) {
+        free(ptr);
+        return;
+    }
+
+    if (!tc->registered)
+        dtm_register(tc);
+
+    size_t cls = dtm_class(size);
+    struct dtm_free *obj = ptr;
+    obj->next = tc->list[cls];
+    tc->list[cls] = obj;
+    if (++tc->count[cls] > DTM_TCACHE_MAX)
+        dtm_spill(tc, cls, DTM_BATCH);
+}
+
+#else /* DATUM_NO_SLAB */
+
+void *dtm_alloc(size_t size)
+{
+    tcache.stats.allocs++;
+    tcache.stats.sysAllocs++;
+    return malloc(size ? size : 1);
+}
+
+void dtm_release(void *ptr, size_t size)
+{
+    (void)size;
+    if (!ptr)
+        return;
+    tcache.stats.frees++;
+    free(ptr);
+}
+
+#endif /* DATUM_NO_SLAB */
+
+/**
+ * @brief Returns the allocation counters of the calling thread
+ *
+ * The slab count covers all threads. The hit rate of the slabs is
+ * hits / allocs: the share of allocations served from a free list.
+ *
+ * @param stats receives the counters
+ */
+void Datum_getAllocStats(Datum_AllocStats *stats)
+{
+    if (!stats)
+        return;
+
+    *stats = tcache.stats;
+    stats->slabs = atomic_load_explicit(&slabs, memory_order_relaxed);
+}
+
+/**
+ * @brief Clears the allocation counters of the calling thread
+ */
+void Datum_resetAllocStats(void)
+{
+    memset(&tcache.stats, 0, sizeof(tcache.stats));
+}
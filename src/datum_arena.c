@@ -0,0 +1,218 @@
+/*
+ * datum_arena.c
+ *
+ * Arenas for datums that share one lifetime, e.g. the values of one row
+ * group. Headers and payloads are bumped out of large blocks; reset rewinds
+ * the arena in O(1) and keeps its blocks for the next batch, free gives the
+ * blocks back to the system.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#define DTM_ARENA_BLOCK   (64 * 1024)
+#define DTM_ARENA_ALIGN   16
+
+struct dtm_block {
+    struct dtm_block *next;
+    size_t size;                    /* usable bytes in data */
+    _Alignas(DTM_ARENA_ALIGN) char data[];
+};
+
+struct Datum_Arena {
+    struct dtm_block *first;        /* all blocks, in the order they were added */
+    struct dtm_block *cur;          /* block being filled */
+    char *ptr;                      /* next free byte in cur */
+    char *end;
+    size_t blockSize;
+    size_t used;                    /* bytes handed out since the last reset */
+};
+
+/**
+ * @brief Creates a new arena
+ *
+ * @param blockSize bytes per block, 0 for the default of 64 KiB
+ * @return New arena or NULL on allocation failure
+ */
+Datum_Arena_T Datum_Arena_new(size_t blockSize)
+{
+    Datum_Arena_T arena = calloc(1, sizeof(struct Datum_Arena));
+    if (!arena)
+        return NULL;
+
+    arena->blockSize = blockSize ? blockSize : DTM_ARENA_BLOCK;
+    return arena;
+}
+
+/**
+ * @brief Releases every datum of the arena at once, keeping its blocks
+ */
+void Datum_Arena_reset(Datum_Arena_T arena)
+{
+    if (!arena)
+        return;
+
+    arena->cur = arena->first;
+    arena->ptr = arena->first ? arena->first->data : NULL;
+    arena->end = arena->first ? arena->first->data + arena->first->size : NULL;
+    arena->used = 0;
+}
+
+/**
+ * @brief Releases the arena with every datum in it
+ */
+void Datum_Arena_free(Datum_Arena_T *arena)
+{
+    if (!arena || !*arena)
+        return;
+
+    struct dtm_block *b = (*arena)->first;
+    while (b) {
+        struct dtm_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(*arena);
+    *arena = NULL;
+}
+
+/**
+ * @brief Returns the number of bytes handed out since the last reset
+ */
+size_t Datum_Arena_used(Datum_Arena_T arena)
+{
+    return arena ? arena->used : 0;
+}
+
+/**
+ * @brief moves to the next kept block that can hold size bytes, or adds one
+ */
+static bool dtm_arenaGrow(Datum_Arena_T arena, size_t size)
+{
+    struct dtm_block *b = arena->cur ? arena->cur->next : arena->first;
+
+    /* after a reset the kept blocks are reused in order */
+    while (b && b->size < size)
+        b = b->next;
+
+    if (!b) {
+        size_t bsize = size > arena->blockSize ? size : arena->blockSize;
+        b = malloc(sizeof(struct dtm_block) + bsize);
+        if (!b)
+            return false;
+        b->size = bsize;
+        b->next = NULL;
+
+        /* append after the last block so reset walks them all */
+        struct dtm_block **pp = &arena->first;
+        while (*pp)
+            pp = &(*pp)->next;
+        *pp = b;
+    }
+    arena->cur = b;
+    arena->ptr = b->data;
+    arena->end = b->data + b->size;
+    return true;
+}
+
+static void *dtm_arenaAlloc(Datum_Arena_T arena, size_t size)
+{
+    size = (size + DTM_ARENA_ALIGN - 1) & ~(size_t)(DTM_ARENA_ALIGN - 1);
+    if (!arena->ptr || (size_t)(arena->end - arena->ptr) < size)
+        if (!dtm_arenaGrow(arena, size))
+            return NULL;
+
+    void *p = arena->ptr;
+    arena->ptr += size;
+    arena->used += size;
+    return p;
+}
+
+static Datum_T dtm_arenaDatum(Datum_Arena_T arena, size_t flags)
+{
+    Datum_T datum = arena ? dtm_arenaAlloc(arena, sizeof(struct Datum)) : NULL;
+    if (!datum)
+        return NULL;
+
+    memset(datum, 0, sizeof(struct Datum));
+    dtm_init(datum);
+    datum->flags |= DATUM_Arena | flags;
+    return datum;
+}
+
+/**
+ * @brief As Datum_asInteger, with the datum in the arena
+ */
+Datum_T Datum_asInteger_in(Datum_Arena_T arena, long long val)
+{
+    Datum_T datum = dtm_arenaDatum(arena, DATUM_Int);
+    if (datum)
+        datum->value.i = val;
+    return datum;
+}
+
+/**
+ * @brief As Datum_asDouble, with the datum in the arena
+ */
+Datum_T Datum_asDouble_in(Datum_Arena_T arena, double val)
+{
+    Datum_T datum = dtm_arenaDatum(arena, DATUM_Double);
+    if (datum)
+        datum->value.r = val;
+    return datum;
+}
+
+/**
+ * @brief As Datum_asString, with the datum and its copy of str in the arena
+ */
+Datum_T Datum_asString_in(Datum_Arena_T arena, const char *str, int len, dtm_encoding_t encoding)
+{
+    size_t n;
+    if (!arena || !str)
+        return NULL;
+
+    size_t sz = dtm_strMeasure(str, len, encoding, &n);
+    if (sz == (size_t)-1)
+        return NULL;
+
+    Datum_T datum = dtm_arenaDatum(arena, DATUM_Str | DATUM_Term);
+    if (datum && dtm_setInline(datum, str, sz, n, encoding))
+        return datum;
+
+    char *z = datum ? dtm_arenaAlloc(arena, sz + DATUM_TERM_BYTES) : NULL;
+    if (!z)
+        return NULL;
+
+    memcpy(z, str, sz);
+    memset(z + sz, 0, DATUM_TERM_BYTES);
+    datum->value.z = z;
+    dtm_setEnc(datum, encoding);
+    dtm_setSize(datum, sz, n);
+    return datum;
+}
+
+/**
+ * @brief As Datum_asBLOB, with the datum and its copy of the bytes in the arena
+ */
+Datum_T Datum_asBLOB_in(Datum_Arena_T arena, void *str, int len, short enc)
+{
+    if (!arena || (!str && len) || len < 0)
+        return NULL;
+
+    Datum_T datum = dtm_arenaDatum(arena, DATUM_Blob);
+    char *z = datum ? dtm_arenaAlloc(arena, (size_t)len + DATUM_TERM_BYTES) : NULL;
+    if (!z)
+        return NULL;
+
+    if (len)
+        memcpy(z, str, (size_t)len);
+    memset(z + len, 0, DATUM_TERM_BYTES);
+    datum->value.z = z;
+    dtm_setEnc(datum, (dtm_encoding_t)enc);
+    dtm_setSize(datum, (size_t)len, (size_t)len);
+    return datum;
+}
@@ -0,0 +1,359 @@
+/*
+ * datum_codec.c
+ *
+ * Codec engine for the single byte encodings: ASCII, ISO-8859-1/2/15,
+ * Windows-1252, ISO-IR-197 and Windows Sami 2 (DTM_ENC_ISO_IR_197W).
+ *
+ * Every encoding is described by one table of the code points of bytes
+ * 0x80..0xff; the lower half is ASCII in all of them. Decoding is a lookup
+ * in that table. For encoding, the tables are turned around once into
+ * pages of 256 bytes indexed by the high byte of the code point, so that
+ * encoding is two lookups as well. Only the pages an encoding uses are
+ * filled, the rest point at one shared page of zeros.
+ *
+ * Extracts from legacy Nordic systems are mostly ASCII, so both directions
+ * copy runs of ASCII sixteen bytes at a time (SSE2) or eight bytes at a
+ * time and only look at the tables for the bytes in between.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DTM_SBCS_PAGES  64          /* encoder pages for all encodings together */
+
+/* ISO-8859-2, Latin-2 */
+static const uint16_t cp_iso8859_2[128] = {
+    0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087, 0x0088, 0x0089, 0x008a, 0x008b, 0x008c, 0x008d, 0x008e, 0x008f,
+    0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097, 0x0098, 0x0099, 0x009a, 0x009b, 0x009c, 0x009d, 0x009e, 0x009f,
+    0x00a0, 0x0104, 0x02d8, 0x0141, 0x00a4, 0x013d, 0x015a, 0x00a7, 0x00a8, 0x0160, 0x015e, 0x0164, 0x0179, 0x00ad, 0x017d, 0x017b,
+    0x00b0, 0x0105, 0x02db, 0x0142, 0x00b4, 0x013e, 0x015b, 0x02c7, 0x00b8, 0x0161, 0x015f, 0x0165, 0x017a, 0x02dd, 0x017e, 0x017c,
+    0x0154, 0x00c1, 0x00c2, 0x0102, 0x00c4, 0x0139, 0x0106, 0x00c7, 0x010c, 0x00c9, 0x0118, 0x00cb, 0x011a, 0x00cd, 0x00ce, 0x010e,
+    0x0110, 0x0143, 0x0147, 0x00d3, 0x00d4, 0x0150, 0x00d6, 0x00d7, 0x0158, 0x016e, 0x00da, 0x0170, 0x00dc, 0x00dd, 0x0162, 0x00df,
+    0x0155, 0x00e1, 0x00e2, 0x0103, 0x00e4, 0x013a, 0x0107, 0x00e7, 0x010d, 0x00e9, 0x0119, 0x00eb, 0x011b, 0x00ed, 0x00ee, 0x010f,
+    0x0111, 0x0144, 0x0148, 0x00f3, 0x00f4, 0x0151, 0x00f6, 0x00f7, 0x0159, 0x016f, 0x00fa, 0x0171, 0x00fc, 0x00fd, 0x0163, 0x02d9,
+};
+
+/* ISO-8859-15, Latin-9 */
+static const uint16_t cp_iso8859_15[128] = {
+    0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087, 0x0088, 0x0089, 0x008a, 0x008b, 0x008c, 0x008d, 0x008e, 0x008f,
+    0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097, 0x0098, 0x0099, 0x009a, 0x009b, 0x009c, 0x009d, 0x009e, 0x009f,
+    0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x20ac, 0x00a5, 0x0160, 0x00a7, 0x0161, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x017d, 0x00b5, 0x00b6, 0x00b7, 0x017e, 0x00b9, 0x00ba, 0x00bb, 0x0152, 0x0153, 0x0178, 0x00bf,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7, 0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7, 0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+};
+
+/* Windows-1252; 0x81, 0x8d, 0x8f, 0x90 and 0x9d are undefined */
+static const uint16_t cp_cp1252[128] = {
+    0x20ac, 0x0000, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021, 0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017d, 0x0000,
+    0x0000, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014, 0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x0000, 0x017e, 0x0178,
+    0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7, 0x00a8, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7, 0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7, 0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7, 0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+};
+
+/* ISO-IR-197, the Sami supplement to Latin-1, with the C1 controls */
+static const uint16_t cp_iso_ir_197[128] = {
+    0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087, 0x0088, 0x0089, 0x008a, 0x008b, 0x008c, 0x008d, 0x008e, 0x008f,
+    0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097, 0x0098, 0x0099, 0x009a, 0x009b, 0x009c, 0x009d, 0x009e, 0x009f,
+    0x00a0, 0x010c, 0x010d, 0x0110, 0x0111, 0x01e4, 0x01e5, 0x00a7, 0x01e6, 0x00a9, 0x01e7, 0x00ab, 0x01e8, 0x00ad, 0x01e9, 0x014a,
+    0x00b0, 0x014b, 0x0160, 0x0161, 0x00b4, 0x0166, 0x00b6, 0x00b7, 0x0167, 0x017d, 0x017e, 0x00bb, 0x01b7, 0x0292, 0x01ee, 0x01ef,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7, 0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7, 0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+};
+
+/* Windows Sami 2 (WinSami2), the Windows code page for ISO-IR-197 */
+static const uint16_t cp_iso_ir_197w[128] = {
+    0x20ac, 0x0000, 0x010c, 0x0192, 0x010d, 0x01b7, 0x0292, 0x01ee, 0x01ef, 0x0110, 0x0160, 0x2039, 0x0152, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014, 0x0111, 0x01e6, 0x0161, 0x203a, 0x0153, 0x0000, 0x0000, 0x0178,
+    0x00a0, 0x01e7, 0x01e4, 0x00a3, 0x00a4, 0x01e5, 0x00a6, 0x00a7, 0x00a8, 0x00a9, 0x021e, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x021f,
+    0x00b0, 0x00b1, 0x01e8, 0x01e9, 0x00b4, 0x00b5, 0x00b6, 0x00b7, 0x014a, 0x014b, 0x0166, 0x00bb, 0x0167, 0x00bd, 0x017d, 0x017e,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7, 0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7, 0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+};
+
+static uint16_t cp_iso8859_1[128];  /* U+0080..U+00FF, filled in by dtm_sbcsInit */
+
+struct dtm_sbcs {
+    const uint16_t *high;           /* code points of 0x80..0xff, 0 where undefined; NULL for ASCII */
+    const uint8_t *page[256];       /* byte of code point cp at page[cp >> 8][cp & 0xff], 0 if none */
+};
+
+static struct dtm_sbcs sbcs_ascii, sbcs_iso8859_1, sbcs_iso8859_2, sbcs_iso8859_15,
+                       sbcs_cp1252, sbcs_iso_ir_197, sbcs_iso_ir_197w;
+
+static const uint8_t zeroPage[256];
+static uint8_t pagePool[DTM_SBCS_PAGES][256];
+static size_t pagesUsed;
+static pthread_once_t sbcs_once = PTHREAD_ONCE_INIT;
+
+static void dtm_sbcsBuild(struct dtm_sbcs *cs, const uint16_t *high)
+{
+    uint8_t *pages[256] = { NULL };
+
+    cs->high = high;
+    pages[0] = pagePool[pagesUsed++];
+    for (size_t c = 1; c < 0x80; c++)
+        pages[0][c] = (uint8_t)c;
+
+    for (size_t b = 0; high && b < 128; b++) {
+        uint16_t cp = high[b];
+        if (!cp)
+            continue;
+        if (!pages[cp >> 8])
+            pages[cp >> 8] = pagePool[pagesUsed++];
+        pages[cp >> 8][cp & 0xff] = (uint8_t)(0x80 + b);
+    }
+    for (size_t p = 0; p < 256; p++)
+        cs->page[p] = pages[p] ? pages[p] : zeroPage;
+}
+
+static void dtm_sbcsInit(void)
+{
+    for (size_t b = 0; b < 128; b++)
+        cp_iso8859_1[b] = (uint16_t)(0x80 + b);
+
+    dtm_sbcsBuild(&sbcs_ascii, NULL);
+    dtm_sbcsBuild(&sbcs_iso8859_1, cp_iso8859_1);
+    dtm_sbcsBuild(&sbcs_iso8859_2, cp_iso8859_2);
+    dtm_sbcsBuild(&sbcs_iso8859_15, cp_iso8859_15);
+    dtm_sbcsBuild(&sbcs_cp1252, cp_cp1252);
+    dtm_sbcsBuild(&sbcs_iso_ir_197, cp_iso_ir_197);
+    dtm_sbcsBuild(&sbcs_iso_ir_197w, cp_iso_ir_197w);
+}
+
+/**
+ * @brief returns the codec of a single byte encoding, NULL for any other
+ */
+static const struct dtm_sbcs *dtm_sbcs(dtm_encoding_t encoding)
+{
+    const struct dtm_sbcs *cs;
+
+    switch ((int)encoding)
+    {
+        case DATUM_ASCII:         cs = &sbcs_ascii; break;
+        case DATUM_ISO8859_1:     cs = &sbcs_iso8859_1; break;
+        case DATUM_ISO8859_2:     cs = &sbcs_iso8859_2; break;
+        case DATUM_ISO8859_15:    cs = &sbcs_iso8859_15; break;
+        case DATUM_CH_1252:       cs = &sbcs_cp1252; break;
+        case DATUM_ISO_IR_197:    cs = &sbcs_iso_ir_197; break;
+        case DATUM_ISO_IR_197WIN: cs = &sbcs_iso_ir_197w; break;
+        default:                  return NULL;
+    }
+    pthread_once(&sbcs_once, dtm_sbcsInit);
+    return cs;
+}
+
+/**
+ * @brief Tells if the encoding is one of the single byte encodings of this engine
+ */
+bool dtm_sbcs_supported(dtm_encoding_t encoding)
+{
+    return dtm_sbcs(encoding) != NULL;
+}
+
+/**
+ * @brief Returns the code point of byte b, or -1 if b is undefined
+ */
+int32_t dtm_sbcs_decode(dtm_encoding_t encoding, uint8_t b)
+{
+    const struct dtm_sbcs *cs = dtm_sbcs(encoding);
+
+    if (!cs)
+        return -1;
+    if (b < 0x80)
+        return b;
+    return (cs->high && cs->high[b - 0x80]) ? cs->high[b - 0x80] : -1;
+}
+
+/**
+ * @brief Returns the byte of code point cp, or -1 if the encoding lacks it
+ */
+int dtm_sbcs_encode(dtm_encoding_t encoding, uint32_t cp)
+{
+    const struct dtm_sbcs *cs = dtm_sbcs(encoding);
+
+    if (!cs || cp > 0xffff)
+        return -1;
+    if (cp < 0x80)
+        return (int)cp;
+    return cs->page[cp >> 8][cp & 0xff] ? cs->page[cp >> 8][cp & 0xff] : -1;
+}
+
+/**
+ * @brief copies the ASCII bytes at the start of src to dst; returns how many
+ */
+static size_t dtm_asciiRun(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(v))
+            break;
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        if (w & 0x8080808080808080ull)
+            break;
+        memcpy(dst + i, &w, 8);
+    }
+    for (; i < len && src[i] < 0x80; i++)
+        dst[i] = src[i];
+    return i;
+}
+
+/**
+ * @brief Checks that every byte is defined in the encoding
+ *
+ * @return number of characters, i.e. len, or (size_t)-1 if a byte is
+ * undefined
+ */
+size_t dtm_sbcs_check(dtm_encoding_t encoding, const char *buf, size_t len)
+{
+    const struct dtm_sbcs *cs = dtm_sbcs(encoding);
+    const uint8_t *s = (const uint8_t *)buf;
+
+    if (!cs)
+        return (size_t)-1;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < 0x80)
+            continue;
+        if (!cs->high || !cs->high[s[i] - 0x80])
+            return (size_t)-1;
+    }
+    return len;
+}
+
+/**
+ * @brief Converts len bytes in a single byte encoding to utf-8
+ *
+ * @param dst room for 3 * len bytes
+ * @return bytes written, or (size_t)-1 if src holds an undefined byte
+ */
+size_t dtm_sbcs_toUtf8(dtm_encoding_t encoding, const char *src, size_t len, char *dst)
+{
+    const struct dtm_sbcs *cs = dtm_sbcs(encoding);
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    size_t i = 0, o = 0;
+
+    if (!cs)
+        return (size_t)-1;
+    while (i < len) {
+        size_t run = dtm_asciiRun(s + i, len - i, d + o);
+        i += run;
+        o += run;
+        if (i == len)
+            break;
+
+        uint32_t cp = cs->high ? cs->high[s[i++] - 0x80] : 0;
+        if (!cp)
+            return (size_t)-1;
+        if (cp < 0x800) {
+            d[o++] = (uint8_t)(0xc0 | (cp >> 6));
+            d[o++] = (uint8_t)(0x80 | (cp & 0x3f));
+        }
+        else {
+            d[o++] = (uint8_t)(0xe0 | (cp >> 12));
+            d[o++] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+            d[o++] = (uint8_t)(0x80 | (cp & 0x3f));
+        }
+    }
+    return o;
+}
+
+/**
+ * @brief Converts len bytes of well formed utf-8 to a single byte encoding
+ *
+ * @param dst room for len bytes
+ * @return bytes written, or (size_t)-1 if a character has no byte in the
+ * encoding
+ */
+size_t dtm_sbcs_fromUtf8(dtm_encoding_t encoding, const char *src, size_t len, char *dst)
+{
+    const struct dtm_sbcs *cs = dtm_sbcs(encoding);
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    size_t i = 0, o = 0;
+
+    if (!cs)
+        return (size_t)-1;
+    while (i < len) {
+        size_t run = dtm_asciiRun(s + i, len - i, d + o);
+        i += run;
+        o += run;
+        if (i == len)
+            break;
+
+        uint32_t cp;
+        if (s[i] < 0xe0) {
+            cp = ((uint32_t)(s[i] & 0x1f) << 6) | (s[i + 1] & 0x3f);
+            i += 2;
+        }
+        else if (s[i] < 0xf0) {
+            cp = ((uint32_t)(s[i] & 0x0f) << 12) | ((uint32_t)(s[i + 1] & 0x3f) << 6) | (s[i + 2] & 0x3f);
+            i += 3;
+        }
+        else
+            return (size_t)-1;                      /* no single byte encoding goes beyond the BMP */
+
+        uint8_t b = cs->page[cp >> 8][cp & 0xff];
+        if (!b)
+            return (size_t)-1;
+        d[o++] = b;
+    }
+    return o;
+}
+
+/**
+ * @brief Converts len bytes from one single byte encoding to another
+ *
+ * @param dst room for len bytes
+ * @return len, or (size_t)-1 if a byte is undefined in from or has no
+ * counterpart in to
+ */
+size_t dtm_sbcs_convert(dtm_encoding_t from, dtm_encoding_t to, const char *src, size_t len, char *dst)
+{
+    const struct dtm_sbcs *in = dtm_sbcs(from), *out = dtm_sbcs(to);
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    size_t i = 0;
+
+    if (!in || !out)
+        return (size_t)-1;
+    while (i < len) {
+        i += dtm_asciiRun(s + i, len - i, d + i);
+        if (i == len)
+            break;
+
+        uint16_t cp = in->high ? in->high[s[i] - 0x80] : 0;
+        uint8_t b = cp ? out->page[cp >> 8][cp & 0xff] : 0;
+        if (!b)
+            return (size_t)-1;
+        d[i++] = b;
+    }
+    return len;
+}
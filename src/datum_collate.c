@@ -0,0 +1,248 @@
+/*
+ * datum_collate.c
+ *
+ * Collation keys for Norwegian, Swedish and Northern Sami ordering. The
+ * alphabets end differently from code point order and from each other:
+ *
+ *   DTM_COLLATE_NB   a .. z æ ø å       ä sorts with æ, ö with ø, ü with y
+ *   DTM_COLLATE_SE   a .. z å ä ö       æ sorts with ä, ø with ö
+ *   DTM_COLLATE_SMI  a á b c č d đ .. n ŋ .. s š t ŧ .. z ž æ ø å
+ *
+ * Datum_collationKey turns a string into bytes that memcmp orders the way
+ * the language does, so a collated sort or a B-tree lookup compares keys
+ * with memcmp and nothing else. The key has three levels, as in the Unicode
+ * Collation Algorithm, each ended by zero bytes:
+ *
+ *  1. the letter, two bytes per character: punctuation and space, then
+ *     digits, then the alphabet, then every other character by code point
+ *     (four bytes for those past the Latin letters),
+ *  2. the accent, one byte per character: e and é differ only here,
+ *  3. the case, one byte per character: lower case before upper case.
+ *
+ * So "ole" < "Ole" < "olé" < "Olsen" < "Ødegård" in Norwegian. Control
+ * characters are ignored. Letters of other languages without a place in
+ * the tables (ł, ß, þ) sort by code point after the alphabet.
+ *
+ * The key is made on first use and kept with the datum in the same list as
+ * its converted strings (datum_conv.c), until Datum_free.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#define DTM_COLL_N      3
+#define DTM_COLL_CPS    0x180       /* Basic Latin, Latin-1 and Latin Extended-A */
+#define DTM_COLL_STACK  256         /* characters decoded on the stack */
+
+/* primary weights */
+#define DTM_W_PUNCT     0x0010      /* + code point, below 0x0200 */
+#define DTM_W_DIGIT     0x0200
+#define DTM_W_LETTER    0x0300      /* + place in the alphabet */
+#define DTM_W_OTHER     0x8000      /* two units: 0x8000 + cp >> 15, 0x8000 + the low 15 bits */
+
+/*
+ * The alphabets, lower case. Letters in one group share the primary weight
+ * and differ by accent, in the order given; groups are separated by 0.
+ */
+static const uint16_t alpha_nb[] = {
+    'a', 0xe1, 0xe0, 0xe2, 0xe3, 0x101, 0x103, 0x105, 0, 'b', 0,
+    'c', 0xe7, 0x107, 0x10d, 0, 'd', 0x111, 0xf0, 0x10f, 0,
+    'e', 0xe9, 0xe8, 0xea, 0xeb, 0x113, 0x117, 0x119, 0x11b, 0, 'f', 0, 'g', 0, 'h', 0,
+    'i', 0xed, 0xec, 0xee, 0xef, 0x12b, 0, 'j', 0, 'k', 0, 'l', 0, 'm', 0,
+    'n', 0xf1, 0x144, 0x148, 0x14b, 0, 'o', 0xf3, 0xf2, 0xf4, 0xf5, 0x14d, 0, 'p', 0, 'q', 0,
+    'r', 0x159, 0, 's', 0x15b, 0x161, 0, 't', 0x165, 0x167, 0,
+    'u', 0xfa, 0xf9, 0xfb, 0x16b, 0x16f, 0, 'v', 0, 'w', 0, 'x', 0,
+    'y', 0xfd, 0xfc, 0xff, 0x171, 0, 'z', 0x17a, 0x17c, 0x17e, 0,
+    0xe6, 0xe4, 0, 0xf8, 0xf6, 0x151, 0, 0xe5, 0, 0
+};
+
+static const uint16_t alpha_se[] = {
+    'a', 0xe1, 0xe0, 0xe2, 0xe3, 0x101, 0x103, 0x105, 0, 'b', 0,
+    'c', 0xe7, 0x107, 0x10d, 0, 'd', 0x111, 0xf0, 0x10f, 0,
+    'e', 0xe9, 0xe8, 0xea, 0xeb, 0x113, 0x117, 0x119, 0x11b, 0, 'f', 0, 'g', 0, 'h', 0,
+    'i', 0xed, 0xec, 0xee, 0xef, 0x12b, 0, 'j', 0, 'k', 0, 'l', 0, 'm', 0,
+    'n', 0xf1, 0x144, 0x148, 0x14b, 0, 'o', 0xf3, 0xf2, 0xf4, 0xf5, 0x14d, 0, 'p', 0, 'q', 0,
+    'r', 0x159, 0, 's', 0x15b, 0x161, 0, 't', 0x165, 0x167, 0,
+    'u', 0xfa, 0xf9, 0xfb, 0x16b, 0x16f, 0, 'v', 0, 'w', 0, 'x', 0,
+    'y', 0xfd, 0xfc, 0xff, 0x171, 0, 'z', 0x17a, 0x17c, 0x17e, 0,
+    0xe5, 0, 0xe4, 0xe6, 0, 0xf6, 0xf8, 0x151, 0, 0
+};
+
+/* Northern Sami as in Norway: á č đ ŋ š ŧ ž are letters of their own */
+static const uint16_t alpha_smi[] = {
+    'a', 0xe0, 0xe2, 0xe3, 0x101, 0x103, 0x105, 0, 0xe1, 0, 'b', 0,
+    'c', 0xe7, 0x107, 0, 0x10d, 0, 'd', 0xf0, 0x10f, 0, 0x111, 0,
+    'e', 0xe9, 0xe8, 0xea, 0xeb, 0x113, 0x117, 0x119, 0x11b, 0, 'f', 0, 'g', 0, 'h', 0,
+    'i', 0xed, 0xec, 0xee, 0xef, 0x12b, 0, 'j', 0, 'k', 0, 'l', 0, 'm', 0,
+    'n', 0xf1, 0x144, 0x148, 0, 0x14b, 0, 'o', 0xf3, 0xf2, 0xf4, 0xf5, 0x14d, 0, 'p', 0, 'q', 0,
+    'r', 0x159, 0, 's', 0x15b, 0, 0x161, 0, 't', 0x165, 0, 0x167, 0,
+    'u', 0xfa, 0xf9, 0xfb, 0x16b, 0x16f, 0, 'v', 0, 'w', 0, 'x', 0,
+    'y', 0xfd, 0xfc, 0xff, 0x171, 0, 'z', 0x17a, 0x17c, 0, 0x17e, 0,
+    0xe6, 0xe4, 0, 0xf8, 0xf6, 0x151, 0, 0xe5, 0, 0
+};
+
+struct dtm_collWeight {
+    uint16_t primary;               /* 0: not a letter of the alphabet */
+    uint8_t secondary;
+};
+
+static struct dtm_collWeight coll_table[DTM_COLL_N][DTM_COLL_CPS];
+static pthread_once_t coll_once = PTHREAD_ONCE_INIT;
+
+static void dtm_collInit(void)
+{
+    static const uint16_t *const alphabets[DTM_COLL_N] = { alpha_nb, alpha_se, alpha_smi };
+
+    for (int c = 0; c < DTM_COLL_N; c++) {
+        const uint16_t *a = alphabets[c];
+        uint16_t primary = DTM_W_LETTER;
+        uint8_t secondary = 1;
+        for (; a[0] || a[1]; a++) {
+            if (!*a) {
+                primary++;
+                secondary = 1;
+                continue;
+            }
+            coll_table[c][*a] = (struct dtm_collWeight){ primary, secondary++ };
+        }
+    }
+}
+
+/* the lower case letter of cp in Latin-1 and Latin Extended-A; *upper is
+   set if cp was upper case */
+static uint32_t dtm_collLower(uint32_t cp, bool *upper)
+{
+    uint32_t lo = cp;
+
+    if ((cp >= 'A' && cp <= 'Z') || (cp >= 0xc0 && cp <= 0xde && cp != 0xd7))
+        lo = cp + 32;
+    else if ((cp >= 0x100 && cp <= 0x137) || (cp >= 0x14a && cp <= 0x177))
+        lo = cp | 1;
+    else if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17e))
+        lo = cp + (cp & 1);
+    else if (cp == 0x178)
+        lo = 0xff;
+    *upper = lo != cp;
+    return lo;
+}
+
+/* appends the weights of one character to the three levels */
+static void dtm_collChar(const struct dtm_collWeight *table, uint32_t cp,
+                         uint8_t **l1, uint8_t **l2, uint8_t **l3)
+{
+    bool upper = false;
+    uint32_t lo = cp < DTM_COLL_CPS ? dtm_collLower(cp, &upper) : cp;
+    uint32_t p;
+    uint8_t s = 1;
+
+    if (lo < DTM_COLL_CPS && table[lo].primary) {
+        p = table[lo].primary;
+        s = table[lo].secondary;
+    }
+    else if (cp >= '0' && cp <= '9')
+        p = DTM_W_DIGIT + (cp - '0');
+    else if (cp < 0x100 && !(cp >= 0xc0 && cp != 0xd7 && cp != 0xf7))
+        p = DTM_W_PUNCT + cp;                       /* space, punctuation and symbols */
+    else {
+        uint16_t hi = (uint16_t)(DTM_W_OTHER + (lo >> 15)), low = (uint16_t)(DTM_W_OTHER + (lo & 0x7fff));
+        *(*l1)++ = (uint8_t)(hi >> 8);
+        *(*l1)++ = (uint8_t)hi;
+        *(*l1)++ = (uint8_t)(low >> 8);
+        *(*l1)++ = (uint8_t)low;
+        *(*l2)++ = 1;
+        *(*l3)++ = upper ? 2 : 1;
+        return;
+    }
+    *(*l1)++ = (uint8_t)(p >> 8);
+    *(*l1)++ = (uint8_t)p;
+    *(*l2)++ = s;
+    *(*l3)++ = upper ? 2 : 1;
+}
+
+/* the key of n code points, in a new dtm_conv tagged for collation c */
+static struct dtm_conv *dtm_collMake(const uint32_t *cps, size_t n, dtm_collation_t collation)
+{
+    const struct dtm_collWeight *table = coll_table[collation - DTM_COLLATE_NB];
+    size_t max = 6 * n + 3;                         /* 4 + 1 + 1 per character, separators */
+    struct dtm_conv *c = malloc(sizeof(struct dtm_conv) + max + DATUM_TERM_BYTES);
+    uint8_t *l2, *l3;
+
+    if (!c)
+        return NULL;
+    l2 = malloc(2 * n + 1);
+    if (!l2) {
+        free(c);
+        return NULL;
+    }
+    l3 = l2 + n;
+
+    uint8_t *l1 = (uint8_t *)c->z, *p2 = l2, *p3 = l3;
+    for (size_t i = 0; i < n; i++)
+        if (cps[i] >= 0x20 && !(cps[i] >= 0x7f && cps[i] < 0xa0))
+            dtm_collChar(table, cps[i], &l1, &p2, &p3);
+
+    /* levels end with zero bytes, so a shorter string sorts first */
+    *l1++ = 0;
+    *l1++ = 0;
+    memcpy(l1, l2, (size_t)(p2 - l2));
+    l1 += p2 - l2;
+    *l1++ = 0;
+    memcpy(l1, l3, (size_t)(p3 - l3));
+    l1 += p3 - l3;
+    free(l2);
+
+    c->enc = (dtm_encoding_t)(DTM_CONV_COLLATE + collation);
+    c->sz = (uint32_t)((char *)l1 - c->z);
+    memset(l1, 0, DATUM_TERM_BYTES);
+    return c;
+}
+
+/**
+ * @brief Returns a key that memcmp orders the way the language orders
+ * the string
+ *
+ * The key is made on first use and kept with the datum, so sorting and
+ * searching on it costs one memcmp per comparison. Keys of different
+ * collations must not be compared with each other. Safe to call from
+ * several threads on the same datum.
+ *
+ * @param collation DTM_COLLATE_NB, DTM_COLLATE_SE or DTM_COLLATE_SMI
+ * @param len receives the number of bytes of the key
+ * @return the key, owned by the datum; NULL if datum is not text, its bytes
+ * are not valid, it lives in an arena or a view, or on allocation failure
+ */
+const uint8_t *Datum_collationKey(Datum_T datum, dtm_collation_t collation, size_t *len)
+{
+    if (!Datum_isDatum(datum) || !(datum->flags & DATUM_Text) || !len
+        || collation < DTM_COLLATE_NB || collation > DTM_COLLATE_SMI)
+        return NULL;
+
+    dtm_encoding_t tag = (dtm_encoding_t)(DTM_CONV_COLLATE + collation);
+    const struct dtm_conv *c = dtm_convGet(datum, tag);
+    if (!c) {
+        if ((datum->flags & DATUM_Arena) || !dtm_ready(datum))
+            return NULL;
+        pthread_once(&coll_once, dtm_collInit);
+
+        /* code points of the string, native utf-32 */
+        dtm_encoding_t enc = dtm_textEnc(datum);
+        size_t sz = dtm_sz(datum);
+        size_t bound = dtm_transcodeBound(enc, DTM_ENC_UTF32, sz);
+        uint32_t stack[DTM_COLL_STACK], *cps = bound <= sizeof stack ? stack : malloc(bound);
+        if (!cps)
+            return NULL;
+        size_t out = dtm_transcode(enc, DTM_ENC_UTF32, dtm_bytes(datum), sz, (char *)cps, NULL);
+        struct dtm_conv *made = out == (size_t)-1 ? NULL : dtm_collMake(cps, out / 4, collation);
+        if (cps != stack)
+            free(cps);
+        if (!made || !(c = dtm_convKeep(datum, made)))
+            return NULL;
+    }
+    *len = c->sz;
+    return (const uint8_t *)c->z;
+}
@@ -0,0 +1,271 @@
+/*
+ * datum_conv.c
+ *
+ * Converted copies of a datum's string. Datum_getAsString hands out a
+ * pointer owned by the datum, so when the datum has to be given in another
+ * encoding the converted bytes are kept with it, one copy per encoding,
+ * until Datum_free. An exporter writing the same value in several encodings
+ * converts it once per encoding.
+ *
+ * In the default layout the copies hang off the datum itself. The compact
+ * layout has no room for the pointer, so there they are kept in a side
+ * table keyed by the datum's address; DATUM_Converted tells Datum_free
+ * that there is something to look up.
+ *
+ * Datums do not change, so a copy once made stays right, and any number of
+ * threads may ask for copies of the same datum at once. The list of copies
+ * only grows: a new copy is pushed with a compare and swap on the head, and
+ * a thread that loses the race to convert to the same encoding drops its own
+ * copy and returns the winner's. Readers walk the list without a lock. The
+ * side table of the compact layout is split in shards behind read/write
+ * locks, taken for writing only when a datum gets its first copy.
+ *
+ * The same list keeps other things derived from the string, under tags
+ * that are not encodings: collation keys, see datum_collate.c.
+ *
+ * Datums in an arena or a view are not freed one by one and get no copies.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <datum.h>
+#include "datum_int.h"
+
+typedef struct dtm_conv *_Atomic dtm_convHead_t;
+
+#ifdef DATUM_COMPACT
+
+#define DTM_CONV_BUCKETS 1024
+#define DTM_CONV_SHARDS  64         /* locks, each guarding every 64th bucket */
+
+struct dtm_convSide {
+    struct dtm_convSide *next;
+    const struct Datum *owner;
+    dtm_convHead_t list;
+};
+
+static struct dtm_convSide *side[DTM_CONV_BUCKETS];
+static pthread_rwlock_t sideLock[DTM_CONV_SHARDS];
+static pthread_once_t side_once = PTHREAD_ONCE_INIT;
+
+static void dtm_convInit(void)
+{
+    for (size_t i = 0; i < DTM_CONV_SHARDS; i++)
+        pthread_rwlock_init(&sideLock[i], NULL);
+}
+
+static inline size_t dtm_convBucket(const struct Datum *d)
+{
+    return ((uintptr_t)d >> 4) % DTM_CONV_BUCKETS;
+}
+
+static struct dtm_convSide *dtm_convFindSide(const struct Datum *d, size_t b)
+{
+    struct dtm_convSide *e = side[b];
+    while (e && e->owner != d)
+        e = e->next;
+    return e;
+}
+
+/* the head of the datum's list, added to the side table if create is set */
+static dtm_convHead_t *dtm_convHead(const struct Datum *d, bool create)
+{
+    size_t b = dtm_convBucket(d);
+    pthread_rwlock_t *lock = &sideLock[b % DTM_CONV_SHARDS];
+    struct dtm_convSide *e;
+
+    pthread_once(&side_once, dtm_convInit);
+    pthread_rwlock_rdlock(lock);
+    e = dtm_convFindSide(d, b);
+    pthread_rwlock_unlock(lock);
+    if (e || !create)
+        return e ? &e->list : NULL;
+
+    pthread_rwlock_wrlock(lock);
+    e = dtm_convFindSide(d, b);
+    if (!e && (e = malloc(sizeof(struct dtm_convSide)))) {
+        e->owner = d;
+        atomic_init(&e->list, NULL);
+        e->next = side[b];
+        side[b] = e;
+    }
+    pthread_rwlock_unlock(lock);
+    return e ? &e->list : NULL;
+}
+
+static struct dtm_conv *dtm_convTake(struct Datum *d)
+{
+    size_t b = dtm_convBucket(d);
+    pthread_rwlock_t *lock = &sideLock[b % DTM_CONV_SHARDS];
+    struct dtm_convSide **pp = &side[b], *e;
+    struct dtm_conv *list = NULL;
+
+    pthread_once(&side_once, dtm_convInit);
+    pthread_rwlock_wrlock(lock);
+    while (*pp && (*pp)->owner != d)
+        pp = &(*pp)->next;
+    if ((e = *pp)) {
+        *pp = e->next;
+        list = atomic_load_explicit(&e->list, memory_order_acquire);
+        free(e);
+    }
+    pthread_rwlock_unlock(lock);
+    return list;
+}
+
+#else /* default layout */
+
+static dtm_convHead_t *dtm_convHead(struct Datum *d, bool create)
+{
+    (void)create;
+    return &d->conv;
+}
+
+static struct dtm_conv *dtm_convTake(struct Datum *d)
+{
+    struct dtm_conv *list = atomic_load_explicit(&d->conv, memory_order_acquire);
+    atomic_store_explicit(&d->conv, NULL, memory_order_relaxed);
+    return list;
+}
+
+#endif /* DATUM_COMPACT */
+
+/* DATUM_Converted is the one flag set after the datum is made, by readers */
+static inline bool dtm_converted(struct Datum *d)
+{
+    return (__atomic_load_n(&d->flags, __ATOMIC_ACQUIRE) & DATUM_Converted) ? true : false;
+}
+
+static struct dtm_conv *dtm_convFind(struct dtm_conv *c, dtm_encoding_t to)
+{
+    while (c && c->enc != to)
+        c = c->next;
+    return c;
+}
+
+/**
+ * @brief adds a new copy to the datum's list, unless another thread got
+ * there first; returns the copy in the list, NULL if there is no memory
+ */
+static struct dtm_conv *dtm_convPublish(struct Datum *d, struct dtm_conv *c)
+{
+    dtm_convHead_t *head = dtm_convHead(d, true);
+    if (!head) {
+        free(c);
+        return NULL;
+    }
+
+    struct dtm_conv *first = atomic_load_explicit(head, memory_order_acquire);
+    do {
+        struct dtm_conv *won = dtm_convFind(first, c->enc);
+        if (won) {
+            free(c);
+            return won;
+        }
+        c->next = first;
+    } while (!atomic_compare_exchange_weak_explicit(head, &first, c, memory_order_release,
+                                                    memory_order_acquire));
+
+    __atomic_fetch_or(&d->flags, DATUM_Converted, __ATOMIC_RELEASE);
+    return c;
+}
+
+/**
+ * @brief Releases the converted copies of a datum, from Datum_free
+ */
+void dtm_convRelease(struct Datum *d)
+{
+    if (!(d->flags & DATUM_Converted))
+        return;
+
+    struct dtm_conv *c = dtm_convTake(d);
+    while (c) {
+        struct dtm_conv *next = c->next;
+        free(c);
+        c = next;
+    }
+    d->flags &= ~DATUM_Converted;
+}
+
+/* a new copy of the datum's string in to, not yet in the list */
+static struct dtm_conv *dtm_convMake(struct Datum *d, dtm_encoding_t to)
+{
+    dtm_encoding_t from = dtm_textEnc(d);
+    size_t len = dtm_sz(d);
+    size_t cap = dtm_transcodeBound(from, to, len);
+    if (!cap && len)
+        return NULL;                                /* no conversion between these */
+
+    struct dtm_conv *c = malloc(sizeof(struct dtm_conv) + cap + DATUM_TERM_BYTES);
+    if (!c)
+        return NULL;
+
+    size_t out = dtm_transcode(from, to, dtm_bytes(d), len, c->z, NULL);
+    if (out == (size_t)-1) {
+        free(c);
+        return NULL;
+    }
+    memset(c->z + out, 0, DATUM_TERM_BYTES);
+    c->enc = to;
+    c->sz = (uint32_t)out;
+    return c;
+}
+
+/**
+ * @brief Returns what the datum keeps under tag, an encoding or another
+ * DTM_CONV_* key, or NULL if nothing yet
+ */
+const struct dtm_conv *dtm_convGet(struct Datum *d, dtm_encoding_t tag)
+{
+    dtm_convHead_t *head;
+
+    if (!dtm_converted(d) || !(head = dtm_convHead(d, false)))
+        return NULL;
+    return dtm_convFind(atomic_load_explicit(head, memory_order_acquire), tag);
+}
+
+/**
+ * @brief Keeps c, made by the caller with malloc, with the datum under
+ * c->enc; if another thread kept one first, c is freed and that one returned
+ *
+ * @return the entry kept, or NULL on allocation failure or for a datum in an
+ * arena or a view, which gets nothing kept and c freed
+ */
+const struct dtm_conv *dtm_convKeep(struct Datum *d, struct dtm_conv *c)
+{
+    if (d->flags & DATUM_Arena) {
+        free(c);
+        return NULL;
+    }
+    return dtm_convPublish(d, c);
+}
+
+/**
+ * @brief Returns the datum's string in the given encoding, converting it
+ * on first use
+ *
+ * Safe to call from several threads on the same datum.
+ *
+ * @return bytes owned by the datum followed by DATUM_TERM_BYTES zeros, or
+ * NULL if there is no conversion between the encodings, the string can not
+ * be given in the wanted one, or the datum lives in an arena or a view
+ */
+const char *dtm_convTo(struct Datum *d, dtm_encoding_t to, size_t *sz)
+{
+    const struct dtm_conv *c = dtm_convGet(d, to);
+    struct dtm_conv *made;
+
+    if (!c) {
+        if (d->flags & DATUM_Arena)
+            return NULL;
+        if (!(made = dtm_convMake(d, to)) || !(c = dtm_convPublish(d, made)))
+            return NULL;
+    }
+    if (sz)
+        *sz = c->sz;
+    return c->z;
+}
@@ -0,0 +1,254 @@
+/*
+ * datum_detect.c
+ *
+ * Guesses the encoding of a buffer of text, for input that arrives as
+ * DTM_ENC_NONE. The candidates are utf-8, utf-16 in either byte order, and
+ * the single byte encodings used for Nordic and Sami text: ISO-8859-15,
+ * Windows-1252, ISO-8859-1 and ISO-IR-197.
+ *
+ * One pass over the buffer, sixteen bytes at a time with SSE2, counts the
+ * zero bytes at even and odd offsets and keeps a histogram of the bytes
+ * above 0x7f; blocks of pure ASCII cost a load and a compare. The decision
+ * is made from these counts:
+ *
+ *  - a byte order mark settles it,
+ *  - zeros in every other byte mean utf-16 (Latin text has a zero high
+ *    byte), checked for unpaired surrogates,
+ *  - bytes above 0x7f that form valid utf-8 mean utf-8, as text in a
+ *    single byte encoding almost never does,
+ *  - otherwise each single byte encoding scores its reading of the
+ *    histogram: Nordic and Sami letters, the euro sign and typographic
+ *    quotes count for it, C1 control codes and undefined bytes against it.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* single byte candidates; on a tie the first one wins */
+static const dtm_encoding_t sbcs_candidates[] = {
+    DTM_ENC_ISO8859_15, DTM_ENC_CH1252, DTM_ENC_ISO8859_1, DTM_ENC_ISO_IR_197,
+};
+#define DTM_SBCS_CANDIDATES (sizeof sbcs_candidates / sizeof sbcs_candidates[0])
+
+struct dtm_byteStats {
+    size_t zeroEven;                /* zero bytes at even offsets */
+    size_t zeroOdd;                 /* zero bytes at odd offsets */
+    size_t high;                    /* bytes above 0x7f */
+    size_t hist[128];               /* each byte above 0x7f */
+};
+
+static void dtm_countScalar(const uint8_t *s, size_t from, size_t len, struct dtm_byteStats *st)
+{
+    for (size_t i = from; i < len; i++) {
+        if (s[i] & 0x80)
+            st->hist[s[i] - 0x80]++;
+        else if (!s[i]) {
+            if (i & 1)
+                st->zeroOdd++;
+            else
+                st->zeroEven++;
+        }
+    }
+}
+
+static void dtm_countBytes(const uint8_t *s, size_t len, struct dtm_byteStats *st)
+{
+    size_t i = 0;
+
+    memset(st, 0, sizeof *st);
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned z = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        unsigned h = (unsigned)_mm_movemask_epi8(v);
+        if (z) {
+            st->zeroEven += (size_t)__builtin_popcount(z & 0x5555);
+            st->zeroOdd += (size_t)__builtin_popcount(z & 0xaaaa);
+        }
+        while (h) {
+            st->hist[s[i + (size_t)__builtin_ctz(h)] - 0x80]++;
+            h &= h - 1;
+        }
+    }
+#endif
+    dtm_countScalar(s, i, len, st);
+    for (size_t b = 0; b < 128; b++)
+        st->high += st->hist[b];
+}
+
+/* true if the utf-16 units have no unpaired surrogates */
+static bool dtm_utf16Valid(const uint8_t *s, size_t len, bool be)
+{
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        uint32_t u = be ? (uint32_t)(s[i] << 8 | s[i + 1]) : (uint32_t)(s[i + 1] << 8 | s[i]);
+        if (u < 0xd800 || u > 0xdfff)
+            continue;
+        if (u > 0xdbff || i + 3 >= len)
+            return false;
+        i += 2;
+        uint32_t l = be ? (uint32_t)(s[i] << 8 | s[i + 1]) : (uint32_t)(s[i + 1] << 8 | s[i]);
+        if (l < 0xdc00 || l > 0xdfff)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief how much a character counts for an encoding that reads it from a
+ * byte above 0x7f
+ */
+static int dtm_charWeight(uint32_t cp)
+{
+    switch (cp)
+    {
+        case 0xe6: case 0xf8: case 0xe5: case 0xc6: case 0xd8: case 0xc5:   /* æ ø å */
+        case 0xe4: case 0xf6: case 0xc4: case 0xd6:                         /* ä ö */
+            return 10;
+        case 0x20ac:                                                        /* € */
+            return 8;
+        case 0x10c: case 0x10d: case 0x110: case 0x111: case 0x14a: case 0x14b:
+        case 0x160: case 0x161: case 0x166: case 0x167: case 0x17d: case 0x17e:
+            return 6;                                                       /* Sami č đ ŋ š ŧ ž */
+        case 0x2018: case 0x2019: case 0x201c: case 0x201d: case 0x201e:
+        case 0x2013: case 0x2014: case 0x2026: case 0x2022:
+            return 5;                                                       /* quotes, dashes, … • */
+        case 0xa4: case 0xa6: case 0xa8: case 0xb4: case 0xb8:             /* ¤ ¦ ¨ ´ ¸ */
+            return 0;
+        default:
+            break;
+    }
+    if (cp >= 0x80 && cp < 0xa0)
+        return -20;                                                         /* C1 controls */
+    if (cp >= 0xc0 && cp <= 0x17f && cp != 0xd7 && cp != 0xf7)
+        return 3;                                                           /* other Latin letters */
+    return 1;
+}
+
+/**
+ * @brief scores the single byte candidates; returns the best one and, via
+ * confidence, how clearly it beat the others
+ */
+static dtm_encoding_t dtm_guessSbcs(const struct dtm_byteStats *st, int *confidence)
+{
+    long long score[DTM_SBCS_CANDIDATES];
+    size_t letters = 0;
+    int best = -1, second = -1;
+
+    for (size_t c = 0; c < DTM_SBCS_CANDIDATES; c++) {
+        score[c] = 0;
+        for (size_t b = 0; b < 128 && score[c] != LLONG_MIN; b++) {
+            if (!st->hist[b])
+                continue;
+            int32_t cp = dtm_sbcs_decode(sbcs_candidates[c], (uint8_t)(b + 0x80));
+            if (cp < 0)
+                score[c] = LLONG_MIN;                       /* the byte means nothing here */
+            else
+                score[c] += (long long)st->hist[b] * dtm_charWeight((uint32_t)cp);
+        }
+        if (score[c] == LLONG_MIN)
+            continue;
+        if (best < 0 || score[c] > score[best]) {
+            second = best;
+            best = (int)c;
+        }
+        else if (second < 0 || score[c] > score[second])
+            second = (int)c;
+    }
+    if (best < 0) {
+        *confidence = 0;
+        return DTM_ENC_NONE;
+    }
+
+    for (size_t b = 0; b < 128; b++)
+        if (st->hist[b] && dtm_charWeight((uint32_t)dtm_sbcs_decode(sbcs_candidates[best], (uint8_t)(b + 0x80))) >= 3)
+            letters += st->hist[b];
+
+    /* half of it for looking like text, half for beating the runner up */
+    int conf = (int)(50 * letters / st->high);
+    if (score[best] <= 0)
+        conf /= 2;
+    else if (second < 0 || score[second] <= 0)
+        conf += 50;
+    else
+        conf += (int)(50 * (score[best] - score[second]) / score[best]);
+    if (conf > 95)
+        conf = 95;                                          /* a single byte guess is never certain */
+    *confidence = conf;
+    return sbcs_candidates[best];
+}
+
+/**
+ * @brief Guesses the encoding of a buffer of text
+ *
+ * Tells utf-8, utf-16 (with or without a byte order mark), ISO-8859-15,
+ * Windows-1252, ISO-8859-1 and ISO-IR-197 apart, at the speed of one pass
+ * over the bytes. Pure ASCII is DTM_ENC_ASCII, which any of them can read.
+ *
+ * @param buf the bytes
+ * @param len number of bytes
+ * @param confidence if not NULL, receives how sure the guess is, from 0 to
+ * 100; 100 only for a byte order mark, ASCII and utf-8
+ * @return the encoding, or DTM_ENC_NONE if the bytes do not look like text
+ * in any of them
+ */
+dtm_encoding_t Datum_detectEncoding(const void *buf, size_t len, int *confidence)
+{
+    const uint8_t *s = buf;
+    struct dtm_byteStats st;
+    int dummy;
+
+    if (!confidence)
+        confidence = &dummy;
+    *confidence = 100;
+    if (!s || !len)
+        return DTM_ENC_ASCII;
+
+    /* byte order marks */
+    if (len >= 3 && s[0] == 0xef && s[1] == 0xbb && s[2] == 0xbf)
+        return DTM_ENC_UTF8;
+    if (len >= 2 && s[0] == 0xff && s[1] == 0xfe)
+        return (len >= 4 && !s[2] && !s[3]) ? DTM_ENC_UTF32LE : DTM_ENC_UTF16LE;
+    if (len >= 4 && !s[0] && !s[1] && s[2] == 0xfe && s[3] == 0xff)
+        return DTM_ENC_UTF32BE;
+    if (len >= 2 && s[0] == 0xfe && s[1] == 0xff)
+        return DTM_ENC_UTF16BE;
+
+    dtm_countBytes(s, len, &st);
+
+    /* Latin text in utf-16 has a zero in most high bytes and almost none in the low ones */
+    size_t units = len / 2, zeros = st.zeroEven + st.zeroOdd;
+    if (zeros && !(len & 1)) {
+        bool le = st.zeroOdd * 4 >= units && st.zeroEven * 8 <= st.zeroOdd;
+        bool be = st.zeroEven * 4 >= units && st.zeroOdd * 8 <= st.zeroEven;
+        if ((le || be) && dtm_utf16Valid(s, len, be)) {
+            *confidence = (int)(50 + 45 * (be ? st.zeroEven : st.zeroOdd) / units);
+            return be ? DTM_ENC_UTF16BE : DTM_ENC_UTF16LE;
+        }
+    }
+    if (zeros) {
+        *confidence = 0;
+        return DTM_ENC_NONE;                                /* binary */
+    }
+
+    if (!st.high)
+        return DTM_ENC_ASCII;
+    if (dtm_utf8_validate((const char *)s, len)) {
+        /* lead bytes C2..F4; each one more makes chance less likely */
+        size_t leads = 0;
+        for (size_t b = 0x42; b <= 0x74; b++)
+            leads += st.hist[b];
+        *confidence = leads >= 4 ? 100 : 80 + 5 * (int)leads;
+        return DTM_ENC_UTF8;
+    }
+    return dtm_guessSbcs(&st, confidence);
+}
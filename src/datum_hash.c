@@ -0,0 +1,249 @@
+/*
+ * datum_hash.c
+ *
+ * Hashing of datums for hash joins, dedup sets and the intern table.
+ *
+ * dtm_hashBytes is wyhash (final version 4, public domain): one 64x64->128
+ * bit multiply per 16 bytes, three independent lanes above 48 bytes, and no
+ * byte at a time loop, so short keys cost a handful of instructions and long
+ * ones run at several bytes per cycle.
+ *
+ * Datum_hash hashes the value, not its storage, so that datums
+ * Datum_isEqual finds equal hash the same:
+ *
+ *  - integers and doubles with the same numeric value, 3 and 3.0, hash as
+ *    the integer; other doubles by their bits, with one NaN,
+ *  - strings by their code points, whatever encoding they are kept in: the
+ *    bytes are hashed as utf-8, which text in utf-8 and ASCII already is,
+ *  - arrays of datums from the hashes of their elements.
+ *
+ * The default layout caches the hash in the datum on first use; datums do
+ * not change, so it stays right. The compact layout has no room for it and
+ * computes it every time.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#define DTM_HASH_SEED   0x9e3779b97f4a7c15ULL
+#define DTM_HASH_STACK  256             /* strings converted to utf-8 on the stack up to this size */
+
+/* one seed per kind of value, so that an empty string, an empty blob and
+   NULL do not all collide */
+enum { DTM_HK_NULL = 1, DTM_HK_NUM, DTM_HK_TEXT, DTM_HK_BLOB, DTM_HK_DATUMS, DTM_HK_PTR, DTM_HK_BOOL };
+
+static const uint64_t wyp[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+/* a * b as 128 bits: low half in *a, high half in *b */
+static inline void dtm_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64_t c = t < rl, lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t dtm_mix(uint64_t a, uint64_t b)
+{
+    dtm_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t dtm_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t dtm_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/**
+ * @brief 64 bit wyhash over sz bytes, seeded
+ */
+uint64_t dtm_hashBytes(const void *buf, size_t sz, uint64_t seed)
+{
+    const uint8_t *p = buf;
+    uint64_t a, b;
+
+    seed ^= dtm_mix(seed ^ wyp[0], wyp[1]);
+    if (sz <= 16) {
+        if (sz >= 4) {
+            size_t k = (sz >> 3) << 2;
+            a = (dtm_r4(p) << 32) | dtm_r4(p + k);
+            b = (dtm_r4(p + sz - 4) << 32) | dtm_r4(p + sz - 4 - k);
+        }
+        else if (sz > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[sz >> 1] << 8) | p[sz - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else {
+        size_t i = sz;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = dtm_mix(dtm_r8(p) ^ wyp[1], dtm_r8(p + 8) ^ seed);
+                see1 = dtm_mix(dtm_r8(p + 16) ^ wyp[2], dtm_r8(p + 24) ^ see1);
+                see2 = dtm_mix(dtm_r8(p + 32) ^ wyp[3], dtm_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = dtm_mix(dtm_r8(p) ^ wyp[1], dtm_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = dtm_r8(p + i - 16);
+        b = dtm_r8(p + i - 8);
+    }
+    a ^= wyp[1];
+    b ^= seed;
+    dtm_mum(&a, &b);
+    return dtm_mix(a ^ wyp[0] ^ sz, b ^ wyp[1]);
+}
+
+static uint64_t dtm_hashWord(uint64_t v, uint64_t kind)
+{
+    return dtm_hashBytes(&v, sizeof v, DTM_HASH_SEED + kind);
+}
+
+/**
+ * @brief hash of a number; integers and doubles Datum_isEqual finds equal
+ * meet in the same key
+ */
+static uint64_t dtm_hashNumber(Datum_T d)
+{
+    double r;
+
+    if (d->flags & DATUM_Int) {
+        long long i = d->value.i;
+        if (i >= -(1LL << 53) && i <= (1LL << 53))
+            return dtm_hashWord((uint64_t)i, DTM_HK_NUM);
+        r = (double)i;                              /* compares as this double */
+    }
+    else
+        r = d->value.r;
+
+    if (r != r)
+        return dtm_hashWord(0x7ff8000000000000ULL, DTM_HK_NUM + 16);
+    if (r >= -9223372036854775808.0 && r < 9223372036854775808.0 && r == (double)(long long)r)
+        return dtm_hashWord((uint64_t)(long long)r, DTM_HK_NUM);   /* -0.0 too */
+
+    uint64_t bits;
+    memcpy(&bits, &r, sizeof bits);
+    return dtm_hashWord(bits, DTM_HK_NUM + 16);
+}
+
+static bool dtm_isAscii(const uint8_t *s, size_t sz)
+{
+    size_t i = 0;
+    uint64_t acc = 0;
+
+    for (; i + 8 <= sz; i += 8)
+        acc |= dtm_r8(s + i);
+    for (; i < sz; i++)
+        acc |= s[i];
+    return !(acc & 0x8080808080808080ULL);
+}
+
+/**
+ * @brief hash of a string's code points: of its bytes in utf-8
+ */
+static uint64_t dtm_hashText(Datum_T d)
+{
+    const uint64_t seed = DTM_HASH_SEED + DTM_HK_TEXT;
+    const char *z = dtm_bytes(d);
+    size_t sz = dtm_sz(d);
+
+    /* bytes that are not valid have no code points; they are only equal to themselves */
+    if (!dtm_ready(d))
+        return dtm_hashBytes(z, sz, seed + 16 + (uint64_t)dtm_enc(d));
+
+    dtm_encoding_t enc = dtm_textEnc(d);
+    if (enc == DTM_ENC_UTF8 || enc == DTM_ENC_ASCII
+        || !dtm_transcodable(enc)
+        || (dtm_unitSize(enc) == 1 && dtm_isAscii((const uint8_t *)z, sz)))
+        return dtm_hashBytes(z, sz, seed);
+
+    char stack[DTM_HASH_STACK];
+    size_t bound = dtm_transcodeBound(enc, DTM_ENC_UTF8, sz);
+    char *buf = bound <= sizeof stack ? stack : malloc(bound);
+    size_t out = buf ? dtm_transcode(enc, DTM_ENC_UTF8, z, sz, buf, NULL) : (size_t)-1;
+    uint64_t h = out != (size_t)-1 ? dtm_hashBytes(buf, out, seed)
+                                   : dtm_hashBytes(z, sz, seed + 16 + (uint64_t)enc);
+    if (buf != stack)
+        free(buf);
+    return h;
+}
+
+static uint64_t dtm_hashValue(Datum_T d)
+{
+    size_t flags = d->flags;
+
+    if (flags & (DATUM_Int | DATUM_Double))
+        return dtm_hashNumber(d);
+    if (flags & DATUM_Text)
+        return dtm_hashText(d);
+    if (flags & DATUM_Blob)
+        return dtm_hashBytes(dtm_bytes(d), dtm_sz(d), DTM_HASH_SEED + DTM_HK_BLOB);
+    if (flags & DATUM_Datums) {
+        uint64_t h = dtm_hashWord(dtm_n(d), DTM_HK_DATUMS);
+        for (size_t i = 0; i < dtm_n(d); i++)
+            h = dtm_mix(h ^ wyp[0], Datum_hash(d->value.dtms[i]) ^ wyp[2]);
+        return h;
+    }
+    if (flags & DATUM_UINTPTR)
+        return dtm_hashWord((uint64_t)(uintptr_t)d->value.uptr, DTM_HK_PTR);
+    if (flags & DATUM_Bool)
+        return dtm_hashWord((uint64_t)d->value.i, DTM_HK_BOOL);
+    return dtm_hashWord(0, DTM_HK_NULL);
+}
+
+/**
+ * @brief Returns a 64 bit hash of the datum's value
+ *
+ * Datums that Datum_isEqual finds equal hash the same: integers and doubles
+ * by numeric value, strings by their code points whatever the encoding.
+ * Computed on first use and kept in the datum, except in the compact
+ * layout. Not meant to withstand deliberate collisions.
+ *
+ * @return the hash, never 0; 0 if datum is not a datum
+ */
+uint64_t Datum_hash(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return 0;
+
+    uint64_t h = dtm_hash(datum);
+    if (h)
+        return h;
+    h = dtm_hashValue(datum);
+    if (!h)
+        h = 1;                                      /* 0 means not computed yet */
+    dtm_setHash(datum, h);
+    return h;
+}
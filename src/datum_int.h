@@ -0,0 +1,471 @@
+#pragma once
+/*
+ * datum_int.h
+ *
+ * Private layout of struct Datum, shared by the translation units in src/.
+ *
+ * Two layouts are available:
+ *
+ * - the default layout keeps every property in its own field. It is easy to
+ *   inspect in a debugger and is the one to use while developing.
+ *
+ * - the compact layout (build with -DDATUM_COMPACT) is 16 bytes: one 32 bit
+ *   word carrying the DATUM_* flags with the encoding, lock bit and type tag
+ *   packed into the flag bits that are otherwise unused, one 32 bit length
+ *   word, and the 8 byte payload. Numbers need nothing else, strings and
+ *   blobs keep their bytes behind value.z as before.
+ *
+ * Code outside this header must go through the dtm_* accessors below and
+ * never touch n, sz, enc, dec or isLocked directly, so that both layouts
+ * stay in step.
+ *
+ * Created by: p2hansen
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <wchar.h>
+#include <stdatomic.h>
+#include <datum.h>
+
+#define DATUM_STRUCTID 20260117
+#define THIS_DATUM_TP  ((size_t)0xe3eceee64a2b360) // sha1 hash from git
+
+/* Type bits, i.e. the flags that tell what value.* holds */
+#define DATUM_TYPEMASK  (DATUM_Null | DATUM_Int | DATUM_Double | DATUM_Bool \
+                        | DATUM_Str | DATUM_StrW | DATUM_Blob | DATUM_Datums \
+                        | DATUM_Array | DATUM_UINTPTR | DATUM_StrU | DATUM_Invalid)
+
+/* Byte order of the native utf-16 and utf-32 encodings */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define DTM_HOST_BE 1
+#else
+#define DTM_HOST_BE 0
+#endif
+
+/* Text of any width: char, wchar_t or uint32_t code units */
+#define DATUM_Text      (DATUM_Str | DATUM_StrW | DATUM_StrU)
+
+/* Strings this short are kept in the datum itself, see DATUM_Inline. The
+** capacity includes room for the terminating code unit. Build with
+** -DDATUM_NO_INLINE to always put the string behind value.z.
+*/
+#ifdef DATUM_NO_INLINE
+#define DTM_INLINE_SIZE 0
+#elif defined(DATUM_COMPACT)
+#define DTM_INLINE_SIZE 8
+#else
+#define DTM_INLINE_SIZE 24
+#endif
+
+union Value {
+    double r;           /* value as double */
+    long long i;        /* integer value */
+    char *z;            /* string or BLOB value */
+    uintptr_t *uptr;    /* value is an universal pointer */
+    wchar_t *zW;        /* value as widecharacter string */
+    Datum_T *dtms;      /* value as array of datums */
+};
+
+#ifdef DATUM_COMPACT
+
+/*
+ * flags, bit for bit:
+ *
+ *   0x0000007f  type flags           (DATUM_Null .. DATUM_Blob)
+ *   0x00001f80  storage flags        (DATUM_Inline, DATUM_Arena, DATUM_Interned, DATUM_Converted ..)
+ *   0x0001e000  type flags           (DATUM_Datums .. DATUM_StrU)
+ *   0x003e0000  encoding             (dtm_encoding_t, 5 bits)
+ *   0x00400000  locked
+ *   0x00800000  DATUM_Invalid
+ *   0x3f000000  ownership flags      (DATUM_Term .. DATUM_Zero)
+ *   0xc0000000  type tag             (10b)
+ *
+ * len holds the number of bytes of a blob, the number of elements of an
+ * array of datums and the number of decimals of a double. Strings are
+ * capped at DATUM_STR_MAXSIZE bytes, so for them the low half holds the
+ * number of bytes and the high half the number of characters.
+ *
+ * Short strings (DATUM_Inline) are stored in the 8 bytes of value.
+ */
+struct Datum {
+    uint32_t flags;         /* DATUM_* flags with enc, lock and tag packed in */
+    uint32_t len;           /* bytes, characters, elements or decimals */
+    union Value value;
+};
+
+#define DTM_ENC_SHIFT   17
+#define DTM_ENC_MASK    0x003e0000u
+#define DTM_LOCKED      0x00400000u
+#define DTM_TAG_MASK    0xc0000000u
+#define DTM_TAG         0x80000000u
+
+static inline void dtm_init(struct Datum *d)
+{
+    d->flags = DTM_TAG;
+}
+
+static inline bool dtm_isTagged(const struct Datum *d)
+{
+    return (d->flags & DTM_TAG_MASK) == DTM_TAG;
+}
+
+static inline dtm_encoding_t dtm_enc(const struct Datum *d)
+{
+    return (dtm_encoding_t)((d->flags & DTM_ENC_MASK) >> DTM_ENC_SHIFT);
+}
+
+static inline void dtm_setEnc(struct Datum *d, dtm_encoding_t enc)
+{
+    d->flags = (d->flags & ~DTM_ENC_MASK) | (((uint32_t)enc << DTM_ENC_SHIFT) & DTM_ENC_MASK);
+}
+
+static inline size_t dtm_sz(const struct Datum *d)
+{
+    return (d->flags & DATUM_Text) ? (d->len & 0xffff) : d->len;
+}
+
+/* a relaxed load, as dtm_setCount may store the same count meanwhile */
+static inline size_t dtm_n(const struct Datum *d)
+{
+    uint32_t len = __atomic_load_n(&d->len, __ATOMIC_RELAXED);
+    return (d->flags & DATUM_Text) ? (len >> 16) : len;
+}
+
+/* Sets bytes and characters together; for non-text both are the same */
+static inline void dtm_setSize(struct Datum *d, size_t sz, size_t n)
+{
+    d->len = (d->flags & DATUM_Text) ? (uint32_t)((n << 16) | (sz & 0xffff)) : (uint32_t)sz;
+}
+
+/* Sets the characters of text whose bytes are already set; an atomic
+   store, as threads settling a DATUM_Raw datum together may race on it */
+static inline void dtm_setCount(struct Datum *d, size_t n)
+{
+    __atomic_store_n(&d->len, (uint32_t)((n << 16) | (d->len & 0xffff)), __ATOMIC_RELAXED);
+}
+
+static inline char *dtm_bytes(struct Datum *d)
+{
+    return (d->flags & DATUM_Inline) ? (char *)&d->value : d->value.z;
+}
+
+static inline short dtm_dec(const struct Datum *d)
+{
+    return (d->flags & DATUM_Double) ? (short)d->len : 0;
+}
+
+static inline void dtm_setDec(struct Datum *d, short dec)
+{
+    d->len = (uint32_t)dec;
+}
+
+/* no room for a cached hash in 16 bytes */
+static inline uint64_t dtm_hash(struct Datum *d)
+{
+    (void)d;
+    return 0;
+}
+
+static inline void dtm_setHash(struct Datum *d, uint64_t hash)
+{
+    (void)d;
+    (void)hash;
+}
+
+static inline bool dtm_locked(const struct Datum *d)
+{
+    return (d->flags & DTM_LOCKED) ? true : false;
+}
+
+static inline void dtm_setLocked(struct Datum *d, bool locked)
+{
+    if (locked)
+        d->flags |= DTM_LOCKED;
+    else
+        d->flags &= ~DTM_LOCKED;
+}
+
+#else /* default layout */
+
+struct Datum {
+    size_t thisTp;
+    size_t structId;
+    union {
+        struct {
+            union Value value;
+            size_t n;       /* Number of characters in string value, excluding '\0' */
+            size_t sz;      /* number of bytes occupied by string */
+        };
+        char s[DTM_INLINE_SIZE > 0 ? DTM_INLINE_SIZE : 1]; /* DATUM_Inline: the string itself */
+    };
+    short dec;              /* number of digits after decimalpoint */
+    uint8_t isz;            /* DATUM_Inline: number of bytes in s */
+    uint8_t in;             /* DATUM_Inline: number of characters in s */
+    size_t flags;           /* Some combination of DATUM_Null, DATUM_Str, etc. */
+    dtm_encoding_t enc;     /* DT_UTF8, DT_UTF16BE, DT_UTF16LE */
+    short type;             /* One of DT_NULL, DT_TEXT, DT_INTEGER, etc */
+    short isLocked;         /* the value can not be changed */
+    uint64_t hash;          /* Datum_hash of the value, 0 until first asked for */
+    struct dtm_conv *_Atomic conv;  /* DATUM_Converted: the string in other encodings */
+};
+
+static inline void dtm_init(struct Datum *d)
+{
+    d->thisTp = THIS_DATUM_TP;
+    d->structId = DATUM_STRUCTID;
+}
+
+static inline bool dtm_isTagged(const struct Datum *d)
+{
+    return d->thisTp == THIS_DATUM_TP;
+}
+
+static inline dtm_encoding_t dtm_enc(const struct Datum *d)
+{
+    return d->enc;
+}
+
+static inline void dtm_setEnc(struct Datum *d, dtm_encoding_t enc)
+{
+    d->enc = enc;
+}
+
+static inline size_t dtm_sz(const struct Datum *d)
+{
+    return (d->flags & DATUM_Inline) ? d->isz : d->sz;
+}
+
+/* a relaxed load, as dtm_setCount may store the same count meanwhile */
+static inline size_t dtm_n(const struct Datum *d)
+{
+    return (d->flags & DATUM_Inline) ? __atomic_load_n(&d->in, __ATOMIC_RELAXED)
+                                     : __atomic_load_n(&d->n, __ATOMIC_RELAXED);
+}
+
+/* DATUM_Inline must be set before, as the inline string overlays n and sz */
+static inline void dtm_setSize(struct Datum *d, size_t sz, size_t n)
+{
+    if (d->flags & DATUM_Inline) {
+        d->isz = (uint8_t)sz;
+        d->in = (uint8_t)n;
+    }
+    else {
+        d->sz = sz;
+        d->n = n;
+    }
+}
+
+/* Sets the characters of text whose bytes are already set; an atomic
+   store, as threads settling a DATUM_Raw datum together may race on it */
+static inline void dtm_setCount(struct Datum *d, size_t n)
+{
+    if (d->flags & DATUM_Inline)
+        __atomic_store_n(&d->in, (uint8_t)n, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&d->n, n, __ATOMIC_RELAXED);
+}
+
+static inline char *dtm_bytes(struct Datum *d)
+{
+    return (d->flags & DATUM_Inline) ? d->s : d->value.z;
+}
+
+static inline short dtm_dec(const struct Datum *d)
+{
+    return d->dec;
+}
+
+static inline void dtm_setDec(struct Datum *d, short dec)
+{
+    d->dec = dec;
+}
+
+/* Datum_hash of the value, 0 until computed; racing readers store the same value */
+static inline uint64_t dtm_hash(struct Datum *d)
+{
+    return __atomic_load_n(&d->hash, __ATOMIC_RELAXED);
+}
+
+static inline void dtm_setHash(struct Datum *d, uint64_t hash)
+{
+    __atomic_store_n(&d->hash, hash, __ATOMIC_RELAXED);
+}
+
+static inline bool dtm_locked(const struct Datum *d)
+{
+    return d->isLocked ? true : false;
+}
+
+static inline void dtm_setLocked(struct Datum *d, bool locked)
+{
+    d->isLocked = locked ? 1 : 0;
+}
+
+#endif /* DATUM_COMPACT */
+
+/* datum_alloc.c: size class slabs for headers and small payloads */
+#define DTM_SLAB_MAXSIZE  256
+
+extern void *dtm_alloc(size_t size);
+extern void dtm_release(void *ptr, size_t size);
+
+/* datum.c */
+#define DATUM_TERM_BYTES 4  /* zero bytes after every string payload, enough to terminate any code unit */
+
+/* Heap payloads (DATUM_Dyn) start with a reference count, so that copies
+** of a datum share them. value.z points at z, past the header.
+*/
+struct dtm_payload {
+    atomic_uint refs;
+    uint32_t size;                  /* bytes allocated, header included */
+    _Alignas(8) char z[];
+};
+
+#define DTM_PAYLOAD(z)  ((struct dtm_payload *)((char *)(z) - offsetof(struct dtm_payload, z)))
+
+extern char *dtm_payloadNew(size_t size);
+extern void dtm_payloadFree(char *z);
+
+static inline void dtm_payloadRetain(char *z)
+{
+    atomic_fetch_add_explicit(&DTM_PAYLOAD(z)->refs, 1, memory_order_relaxed);
+}
+
+/* drops one reference; true when it was the last and z must be freed */
+static inline bool dtm_payloadUnref(char *z)
+{
+    struct dtm_payload *p = DTM_PAYLOAD(z);
+
+    /* a sole owner can not race with anyone taking a new reference */
+    if (atomic_load_explicit(&p->refs, memory_order_acquire) == 1)
+        return true;
+    return atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel) == 1;
+}
+
+static inline void dtm_payloadRelease(char *z)
+{
+    if (z && dtm_payloadUnref(z))
+        dtm_payloadFree(z);
+}
+
+extern size_t dtm_strMeasure(const char *str, int len, dtm_encoding_t encoding, size_t *n);
+extern size_t dtm_unitSize(dtm_encoding_t encoding);
+extern bool dtm_setInline(struct Datum *datum, const void *src, size_t sz, size_t n, dtm_encoding_t encoding);
+extern bool dtm_settle(struct Datum *d);
+
+/* true when the string can be used: checked and counted, on first use for
+   Datum_asRawBytes; false if it turned out not valid. Settling only changes
+   DATUM_Raw, DATUM_Malformed and the count, so the other flags and the size
+   can be read without synchronizing while a shared raw datum settles */
+static inline bool dtm_ready(struct Datum *d)
+{
+    size_t flags = __atomic_load_n(&d->flags, __ATOMIC_ACQUIRE);
+    if (!(flags & (DATUM_Raw | DATUM_Malformed)))
+        return true;
+    return (flags & DATUM_Raw) ? dtm_settle(d) : false;
+}
+
+/* the encoding the text reads in once dtm_ready: DTM_ENC_NONE is utf-8
+   when its bytes are valid utf-8 and ISO-8859-15 otherwise, ASCII when it
+   is both */
+static inline dtm_encoding_t dtm_textEnc(struct Datum *d)
+{
+    dtm_encoding_t enc = dtm_enc(d);
+    if (enc != DTM_ENC_NONE)
+        return enc;
+
+    /* counted as utf-8 only when valid, see dtm_charCount */
+    const uint8_t *s = (const uint8_t *)dtm_bytes(d);
+    size_t sz = dtm_sz(d);
+    if (dtm_n(d) < sz)
+        return DTM_ENC_UTF8;
+    for (size_t i = 0; i < sz; i++)
+        if (s[i] & 0x80)
+            return DTM_ENC_ISO8859_15;
+    return DTM_ENC_ASCII;
+}
+
+/* datum_hash.c */
+extern uint64_t dtm_hashBytes(const void *buf, size_t sz, uint64_t seed);
+
+/* datum_utf8.c */
+extern bool dtm_utf8_validate(const char *buf, size_t len);
+extern bool dtm_utf8_validateScalar(const char *buf, size_t len);
+extern size_t dtm_utf8_count(const char *buf, size_t len);
+extern size_t dtm_utf8_countScalar(const char *buf, size_t len);
+
+/* datum_codec.c: single byte encodings */
+extern bool dtm_sbcs_supported(dtm_encoding_t encoding);
+extern int32_t dtm_sbcs_decode(dtm_encoding_t encoding, uint8_t b);
+extern int dtm_sbcs_encode(dtm_encoding_t encoding, uint32_t cp);
+extern size_t dtm_sbcs_check(dtm_encoding_t encoding, const char *buf, size_t len);
+extern size_t dtm_sbcs_toUtf8(dtm_encoding_t encoding, const char *src, size_t len, char *dst);
+extern size_t dtm_sbcs_fromUtf8(dtm_encoding_t encoding, const char *src, size_t len, char *dst);
+extern size_t dtm_sbcs_convert(dtm_encoding_t from, dtm_encoding_t to, const char *src, size_t len, char *dst);
+
+/* datum_transcode.c: any supported encoding to any other */
+extern bool dtm_transcodable(dtm_encoding_t encoding);
+extern size_t dtm_transcodeBound(dtm_encoding_t from, dtm_encoding_t to, size_t len);
+extern size_t dtm_transcode(dtm_encoding_t from, dtm_encoding_t to, const char *src, size_t len,
+                            char *dst, size_t *errPos);
+extern int dtm_compareText(dtm_encoding_t ea, const char *a, size_t la,
+                           dtm_encoding_t eb, const char *b, size_t lb);
+
+/* datum_sort.c */
+extern int dtm_numCompare(struct Datum *a, struct Datum *b);
+
+/* datum_number.c */
+extern bool dtm_textToDouble(struct Datum *datum, double *out);
+extern bool dtm_textToInteger(struct Datum *datum, long long *out);
+extern dtm_numformat_t dtm_numFormat(void);
+
+/* the 128 bit product of a and b: the low half returned, the high in *hi */
+static inline uint64_t dtm_mul128(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rl = la * lb, m1 = ha * lb, m2 = la * hb, rh = ha * hb;
+    uint64_t mid = (rl >> 32) + (uint32_t)m1 + (uint32_t)m2;
+    *hi = rh + (m1 >> 32) + (m2 >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)rl;
+#endif
+}
+
+/* datum_conv.c: the string of a datum in other encodings */
+struct dtm_conv {
+    struct dtm_conv *next;
+    dtm_encoding_t enc;             /* the encoding, or a DTM_CONV_* tag */
+    uint32_t sz;                    /* bytes, without the terminator */
+    _Alignas(8) char z[];           /* sz bytes and DATUM_TERM_BYTES zeros */
+};
+
+/* tags of entries that are not the string in an encoding */
+#define DTM_CONV_COLLATE    0x100   /* + dtm_collation_t: collation key */
+#define DTM_CONV_NUMBER     0x200   /* + encoding: a number written as text */
+#define DTM_CONV_COMMA      0x080   /* + DTM_CONV_NUMBER: .. with a decimal comma */
+
+extern const char *dtm_convTo(struct Datum *d, dtm_encoding_t to, size_t *sz);
+extern const struct dtm_conv *dtm_convGet(struct Datum *d, dtm_encoding_t tag);
+extern const struct dtm_conv *dtm_convKeep(struct Datum *d, struct dtm_conv *c);
+extern void dtm_convRelease(struct Datum *d);
+
+/* datum_format.c */
+extern const char *dtm_numberText(struct Datum *d, dtm_encoding_t encoding);
+
+/* true when sz bytes of text with the given code unit size fit in the datum */
+static inline bool dtm_fitsInline(size_t sz, size_t unit)
+{
+#if DTM_INLINE_SIZE > 0
+    return sz + unit <= DTM_INLINE_SIZE;
+#else
+    (void)sz;
+    (void)unit;
+    return false;
+#endif
+}
@@ -0,0 +1,176 @@
+/*
+ * datum_intern.c
+ *
+ * Global table of interned strings. Datum_intern swaps the payload of a
+ * string datum for the table's copy of the same bytes, so every interned
+ * datum with the same value and encoding points at one immutable payload
+ * and equality between them is a pointer compare.
+ *
+ * The table is split in DTM_INTERN_SHARDS shards chosen by the top bits of
+ * the hash, each an open addressing array behind its own read/write lock.
+ * Lookups of strings already in the table only take the read lock, so
+ * threads interning the same values run in parallel.
+ *
+ * Interned payloads are never released: interning is meant for columns with
+ * few distinct values (municipalities, first names, status codes).
+ *
+ * Datum_intern is the one call that changes a datum in place, so it needs
+ * the datum to itself: intern a datum before sharing it with other threads.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#define DTM_INTERN_BITS     6
+#define DTM_INTERN_SHARDS   (1 << DTM_INTERN_BITS)
+#define DTM_INTERN_INITIAL  256     /* slots per shard at first use */
+
+struct dtm_istr {
+    uint64_t hash;
+    uint32_t sz;
+    uint32_t n;
+    dtm_encoding_t enc;
+    char z[];                       /* sz bytes and DATUM_TERM_BYTES zeros */
+};
+
+static struct dtm_ishard {
+    pthread_rwlock_t lock;
+    struct dtm_istr **slots;
+    size_t cap;                     /* power of two */
+    size_t count;
+} shards[DTM_INTERN_SHARDS];
+
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+static void dtm_internInit(void)
+{
+    for (size_t i = 0; i < DTM_INTERN_SHARDS; i++)
+        pthread_rwlock_init(&shards[i].lock, NULL);
+}
+
+static struct dtm_istr *dtm_internFind(struct dtm_ishard *sh, uint64_t hash,
+                                       const char *z, size_t sz, dtm_encoding_t enc)
+{
+    if (!sh->cap)
+        return NULL;
+
+    for (size_t i = hash & (sh->cap - 1); sh->slots[i]; i = (i + 1) & (sh->cap - 1)) {
+        struct dtm_istr *e = sh->slots[i];
+        if (e->hash == hash && e->sz == sz && e->enc == enc && memcmp(e->z, z, sz) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static bool dtm_internGrow(struct dtm_ishard *sh)
+{
+    size_t cap = sh->cap ? sh->cap * 2 : DTM_INTERN_INITIAL;
+    struct dtm_istr **slots = calloc(cap, sizeof(struct dtm_istr *));
+    if (!slots)
+        return false;
+
+    for (size_t i = 0; i < sh->cap; i++) {
+        struct dtm_istr *e = sh->slots[i];
+        if (!e)
+            continue;
+        size_t j = e->hash & (cap - 1);
+        while (slots[j])
+            j = (j + 1) & (cap - 1);
+        slots[j] = e;
+    }
+    free(sh->slots);
+    sh->slots = slots;
+    sh->cap = cap;
+    return true;
+}
+
+static struct dtm_istr *dtm_internAdd(struct dtm_ishard *sh, uint64_t hash, const char *z,
+                                      size_t sz, size_t n, dtm_encoding_t enc)
+{
+    if ((sh->count + 1) * 10 > sh->cap * 7 && !dtm_internGrow(sh))
+        return NULL;
+
+    struct dtm_istr *e = malloc(sizeof(struct dtm_istr) + sz + DATUM_TERM_BYTES);
+    if (!e)
+        return NULL;
+    e->hash = hash;
+    e->sz = (uint32_t)sz;
+    e->n = (uint32_t)n;
+    e->enc = enc;
+    memcpy(e->z, z, sz);
+    memset(e->z + sz, 0, DATUM_TERM_BYTES);
+
+    size_t i = hash & (sh->cap - 1);
+    while (sh->slots[i])
+        i = (i + 1) & (sh->cap - 1);
+    sh->slots[i] = e;
+    sh->count++;
+    return e;
+}
+
+/**
+ * @brief Interns a string datum
+ *
+ * The datum's payload is replaced by the table's shared copy of the same
+ * bytes in the same encoding, which is added on first use. Interned datums
+ * compare equal by pointer in Datum_isEqual. Datums that are not narrow
+ * strings, are interned already or hold raw bytes that are not valid are
+ * left as they are.
+ *
+ * The datum is changed in place and its old payload released, so no other
+ * thread may use the datum during the call.
+ *
+ * @param datum the datum to intern
+ * @return datum, or NULL if it is not a datum or the table can not grow
+ */
+Datum_T Datum_intern(Datum_T datum)
+{
+    if (!Datum_isDatum(datum))
+        return NULL;
+    if (!(datum->flags & DATUM_Str) || (datum->flags & DATUM_Interned) || !dtm_ready(datum))
+        return datum;
+
+    pthread_once(&intern_once, dtm_internInit);
+
+    const char *z = dtm_bytes(datum);
+    size_t sz = dtm_sz(datum), n = dtm_n(datum);
+    dtm_encoding_t enc = dtm_enc(datum);
+    uint64_t hash = dtm_hashBytes(z, sz, enc);
+    struct dtm_ishard *sh = &shards[hash >> (64 - DTM_INTERN_BITS)];
+
+    pthread_rwlock_rdlock(&sh->lock);
+    struct dtm_istr *e = dtm_internFind(sh, hash, z, sz, enc);
+    pthread_rwlock_unlock(&sh->lock);
+
+    if (!e) {
+        pthread_rwlock_wrlock(&sh->lock);
+        e = dtm_internFind(sh, hash, z, sz, enc);
+        if (!e)
+            e = dtm_internAdd(sh, hash, z, sz, n, enc);
+        pthread_rwlock_unlock(&sh->lock);
+        if (!e)
+            return NULL;
+    }
+
+    /* let go of the old payload, the value itself does not change */
+    if (!(datum->flags & (DATUM_Inline | DATUM_Arena | DATUM_Static | DATUM_Ephem)))
+        dtm_payloadRelease(datum->value.z);
+    datum->flags &= ~(DATUM_Inline | DATUM_Dyn | DATUM_Static | DATUM_Ephem);
+    datum->flags |= DATUM_Interned;
+    datum->value.z = e->z;
+    dtm_setSize(datum, sz, n);
+    return datum;
+}
+
+/**
+ * @brief Tells if the datum's payload is owned by the intern table
+ */
+bool Datum_isInterned(Datum_T datum)
+{
+    return (Datum_isDatum(datum) && datum->flags & DATUM_Interned) ? true : false;
+}
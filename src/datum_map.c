@@ -0,0 +1,401 @@
+/*
+ * datum_map.c
+ *
+ * DatumMap: a hash map from datums to datums, for lookup tables such as
+ * pseudonyms keyed by the real value.
+ *
+ * The layout follows Google's SwissTable. Slots come in groups of sixteen,
+ * each group with sixteen control bytes: DTM_MAP_EMPTY, DTM_MAP_DELETED, or
+ * for a full slot the low seven bits of its key's hash. A probe loads the
+ * sixteen control bytes of a group and compares them all with one SSE2
+ * instruction, so only slots whose seven bits match have their key looked
+ * at; an empty slot in the group ends the probe. Groups are visited in
+ * triangular order, which reaches every group of a power of two table.
+ *
+ * Keys hash with Datum_hash and compare with Datum_isEqual, so 3 and 3.0,
+ * or the same name in utf-8 and ISO-8859-15, are one key. Slots keep the
+ * full hash, so growing the table does not hash again and a probe compares
+ * hashes before calling Datum_isEqual.
+ *
+ * DatumMap_put stores copies of key and value (Datum_copy shares the
+ * payload); lookups take a borrowed key and allocate nothing. The batch
+ * calls hash the keys of a block first and prefetch their groups, so that
+ * the cache misses of the block overlap instead of coming one at a time.
+ *
+ * A map must not be changed by one thread while others use it; lookups
+ * alone may run in parallel.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DTM_MAP_GROUP   16
+#define DTM_MAP_EMPTY   0x80
+#define DTM_MAP_DELETED 0xfe
+#define DTM_MAP_BATCH   16          /* keys hashed and prefetched ahead in the batch calls */
+
+struct dtm_slot {
+    uint64_t hash;
+    Datum_T key;
+    Datum_T value;
+};
+
+struct DatumMap {
+    uint8_t *ctrl;                  /* cap control bytes */
+    struct dtm_slot *slots;         /* cap slots */
+    size_t cap;                     /* slots, a power of two and at least one group */
+    size_t len;                     /* keys in the map */
+    size_t growthLeft;              /* empty slots that may still be filled before growing */
+};
+
+static inline uint8_t dtm_h2(uint64_t hash)
+{
+    return (uint8_t)(hash & 0x7f);
+}
+
+static inline size_t dtm_firstGroup(const struct DatumMap *map, uint64_t hash)
+{
+    return (size_t)(hash >> 7) & (map->cap / DTM_MAP_GROUP - 1);
+}
+
+/* slots that may still be filled at capacity cap: seven of eight */
+static inline size_t dtm_maxLoad(size_t cap)
+{
+    return cap - cap / 8;
+}
+
+/* bit i set: control byte i of the group equals b */
+static inline unsigned dtm_match(const uint8_t *ctrl, uint8_t b)
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+    unsigned m = 0;
+    for (unsigned i = 0; i < DTM_MAP_GROUP; i++)
+        if (ctrl[i] == b)
+            m |= 1u << i;
+    return m;
+#endif
+}
+
+/* bit i set: slot i of the group is empty or deleted, i.e. its top bit is set */
+static inline unsigned dtm_matchFree(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    unsigned m = 0;
+    for (unsigned i = 0; i < DTM_MAP_GROUP; i++)
+        if (ctrl[i] & 0x80)
+            m |= 1u << i;
+    return m;
+#endif
+}
+
+static bool dtm_mapAlloc(struct DatumMap *map, size_t cap)
+{
+    uint8_t *ctrl = malloc(cap);
+    struct dtm_slot *slots = malloc(cap * sizeof(struct dtm_slot));
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        return false;
+    }
+    memset(ctrl, DTM_MAP_EMPTY, cap);
+    map->ctrl = ctrl;
+    map->slots = slots;
+    map->cap = cap;
+    map->growthLeft = dtm_maxLoad(cap) - map->len;
+    return true;
+}
+
+/**
+ * @brief Creates a new, empty map
+ *
+ * @param capacity number of keys to make room for, 0 for a small map
+ * @return New map or NULL on allocation failure
+ */
+DatumMap_T DatumMap_new(size_t capacity)
+{
+    DatumMap_T map = calloc(1, sizeof(struct DatumMap));
+    if (!map)
+        return NULL;
+
+    size_t cap = DTM_MAP_GROUP;
+    while (dtm_maxLoad(cap) < capacity)
+        cap *= 2;
+    if (!dtm_mapAlloc(map, cap)) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+/**
+ * @brief Releases the map with its copies of keys and values
+ */
+void DatumMap_free(DatumMap_T *map)
+{
+    if (!map || !*map)
+        return;
+
+    DatumMap_T m = *map;
+    for (size_t i = 0; i < m->cap; i++) {
+        if (m->ctrl[i] & 0x80)
+            continue;
+        Datum_free(&m->slots[i].key);
+        Datum_free(&m->slots[i].value);
+    }
+    free(m->ctrl);
+    free(m->slots);
+    free(m);
+    *map = NULL;
+}
+
+size_t DatumMap_length(DatumMap_T map)
+{
+    return map ? map->len : 0;
+}
+
+/**
+ * @brief index of the slot holding key, or (size_t)-1
+ */
+static size_t dtm_mapFind(const struct DatumMap *map, Datum_T key, uint64_t hash)
+{
+    size_t gmask = map->cap / DTM_MAP_GROUP - 1;
+    size_t g = dtm_firstGroup(map, hash);
+    uint8_t h2 = dtm_h2(hash);
+
+    for (size_t step = 1; ; step++) {
+        const uint8_t *ctrl = map->ctrl + g * DTM_MAP_GROUP;
+        for (unsigned m = dtm_match(ctrl, h2); m; m &= m - 1) {
+            size_t i = g * DTM_MAP_GROUP + (size_t)__builtin_ctz(m);
+            if (map->slots[i].hash == hash && Datum_isEqual(map->slots[i].key, key))
+                return i;
+        }
+        if (dtm_match(ctrl, DTM_MAP_EMPTY) || step > gmask)
+            return (size_t)-1;
+        g = (g + step) & gmask;
+    }
+}
+
+/**
+ * @brief index of the first empty or deleted slot on the probe path of hash
+ */
+static size_t dtm_mapFree(const struct DatumMap *map, uint64_t hash)
+{
+    size_t gmask = map->cap / DTM_MAP_GROUP - 1;
+    size_t g = dtm_firstGroup(map, hash);
+
+    for (size_t step = 1; ; step++) {
+        unsigned m = dtm_matchFree(map->ctrl + g * DTM_MAP_GROUP);
+        if (m)
+            return g * DTM_MAP_GROUP + (size_t)__builtin_ctz(m);
+        g = (g + step) & gmask;
+    }
+}
+
+/**
+ * @brief moves every key into a table of cap slots, dropping tombstones
+ */
+static bool dtm_mapResize(struct DatumMap *map, size_t cap)
+{
+    struct DatumMap old = *map;
+
+    if (!dtm_mapAlloc(map, cap)) {
+        *map = old;
+        return false;
+    }
+    for (size_t i = 0; i < old.cap; i++) {
+        if (old.ctrl[i] & 0x80)
+            continue;
+        size_t j = dtm_mapFree(map, old.slots[i].hash);
+        map->ctrl[j] = dtm_h2(old.slots[i].hash);
+        map->slots[j] = old.slots[i];
+    }
+    free(old.ctrl);
+    free(old.slots);
+    return true;
+}
+
+static bool dtm_mapPut(struct DatumMap *map, Datum_T key, Datum_T value, uint64_t hash)
+{
+    size_t i = dtm_mapFind(map, key, hash);
+    if (i != (size_t)-1) {
+        Datum_T copy = Datum_copy(value);
+        if (!copy)
+            return false;
+        Datum_free(&map->slots[i].value);
+        map->slots[i].value = copy;
+        return true;
+    }
+
+    if (!map->growthLeft) {
+        /* many tombstones: clean up in place, else double */
+        size_t cap = map->len * 2 < dtm_maxLoad(map->cap) ? map->cap : map->cap * 2;
+        if (!dtm_mapResize(map, cap))
+            return false;
+    }
+
+    Datum_T k = Datum_copy(key), v = Datum_copy(value);
+    if (!k || !v) {
+        Datum_free(&k);
+        Datum_free(&v);
+        return false;
+    }
+    i = dtm_mapFree(map, hash);
+    if (map->ctrl[i] == DTM_MAP_EMPTY)
+        map->growthLeft--;
+    map->ctrl[i] = dtm_h2(hash);
+    map->slots[i] = (struct dtm_slot){ hash, k, v };
+    map->len++;
+    return true;
+}
+
+/**
+ * @brief Adds key with value, or replaces the value of key
+ *
+ * The map keeps copies of both; the caller still owns key and value.
+ *
+ * @return true, or false if key or value is not a datum or on allocation
+ * failure
+ */
+bool DatumMap_put(DatumMap_T map, Datum_T key, Datum_T value)
+{
+    if (!map || !Datum_isDatum(key) || !Datum_isDatum(value))
+        return false;
+
+    return dtm_mapPut(map, key, value, Datum_hash(key));
+}
+
+/**
+ * @brief Returns the value of key
+ *
+ * @param key borrowed, any datum equal to the key put
+ * @return the value, owned by the map and valid until the key is put again
+ * or removed, or NULL if key is not in the map
+ */
+Datum_T DatumMap_get(DatumMap_T map, Datum_T key)
+{
+    if (!map || !Datum_isDatum(key))
+        return NULL;
+
+    size_t i = dtm_mapFind(map, key, Datum_hash(key));
+    return i == (size_t)-1 ? NULL : map->slots[i].value;
+}
+
+bool DatumMap_contains(DatumMap_T map, Datum_T key)
+{
+    return DatumMap_get(map, key) != NULL;
+}
+
+/**
+ * @brief Removes key and its value
+ *
+ * @return true if key was in the map
+ */
+bool DatumMap_remove(DatumMap_T map, Datum_T key)
+{
+    if (!map || !Datum_isDatum(key))
+        return false;
+
+    uint64_t hash = Datum_hash(key);
+    size_t i = dtm_mapFind(map, key, hash);
+    if (i == (size_t)-1)
+        return false;
+
+    Datum_free(&map->slots[i].key);
+    Datum_free(&map->slots[i].value);
+    map->len--;
+
+    /* a group that was never full ends every probe through it, so the slot
+       can be empty again instead of a tombstone */
+    if (dtm_match(map->ctrl + i / DTM_MAP_GROUP * DTM_MAP_GROUP, DTM_MAP_EMPTY)) {
+        map->ctrl[i] = DTM_MAP_EMPTY;
+        map->growthLeft++;
+    }
+    else
+        map->ctrl[i] = DTM_MAP_DELETED;
+    return true;
+}
+
+/* hashes keys[from, to) into hashes and prefetches the groups they start in */
+static void dtm_mapPrepare(const struct DatumMap *map, Datum_T *keys, size_t from, size_t to,
+                           uint64_t *hashes)
+{
+    for (size_t i = from; i < to; i++) {
+        hashes[i - from] = Datum_isDatum(keys[i]) ? Datum_hash(keys[i]) : 0;
+        size_t g = dtm_firstGroup(map, hashes[i - from]);
+        __builtin_prefetch(map->ctrl + g * DTM_MAP_GROUP);
+        __builtin_prefetch(map->slots + g * DTM_MAP_GROUP);
+    }
+}
+
+/**
+ * @brief Puts n keys with their values, as DatumMap_put one by one
+ *
+ * Makes room for all of them at once and works through the keys in blocks,
+ * hashing and prefetching a block before inserting it.
+ *
+ * @return number of pairs put; less than n if a key or value is not a datum
+ * or on allocation failure, in which case the pairs before it are in
+ */
+size_t DatumMap_putAll(DatumMap_T map, Datum_T *keys, Datum_T *values, size_t n)
+{
+    uint64_t hashes[DTM_MAP_BATCH];
+
+    if (!map || !keys || !values)
+        return 0;
+
+    size_t cap = map->cap;
+    while (dtm_maxLoad(cap) < map->len + n)
+        cap *= 2;
+    if (cap > map->cap && !dtm_mapResize(map, cap))
+        return 0;
+
+    for (size_t b = 0; b < n; b += DTM_MAP_BATCH) {
+        size_t e = b + DTM_MAP_BATCH < n ? b + DTM_MAP_BATCH : n;
+        dtm_mapPrepare(map, keys, b, e, hashes);
+        for (size_t i = b; i < e; i++) {
+            if (!Datum_isDatum(keys[i]) || !Datum_isDatum(values[i])
+                || !dtm_mapPut(map, keys[i], values[i], hashes[i - b]))
+                return i;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Looks up n keys, as DatumMap_get one by one
+ *
+ * @param out receives the value of each key, or NULL for keys not in the map
+ * @return number of keys found
+ */
+size_t DatumMap_getAll(DatumMap_T map, Datum_T *keys, size_t n, Datum_T *out)
+{
+    uint64_t hashes[DTM_MAP_BATCH];
+    size_t found = 0;
+
+    if (!map || !keys || !out)
+        return 0;
+
+    for (size_t b = 0; b < n; b += DTM_MAP_BATCH) {
+        size_t e = b + DTM_MAP_BATCH < n ? b + DTM_MAP_BATCH : n;
+        dtm_mapPrepare(map, keys, b, e, hashes);
+        for (size_t i = b; i < e; i++) {
+            size_t s = Datum_isDatum(keys[i]) ? dtm_mapFind(map, keys[i], hashes[i - b]) : (size_t)-1;
+            out[i] = s == (size_t)-1 ? NULL : map->slots[s].value;
+            found += out[i] != NULL;
+        }
+    }
+    return found;
+}
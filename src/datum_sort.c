@@ -0,0 +1,459 @@
+/*
+ * datum_sort.c
+ *
+ * A total order over datums, and sorting of datum arrays for merge joins.
+ *
+ * Datum_compare orders by kind first: null, bool, numbers, text, text that
+ * can not be decoded, blobs, arrays of datums, pointers. Within a kind:
+ *
+ *  - integers and doubles by exact numeric value, -0.0 equal to 0, NaN
+ *    after every other number,
+ *  - text by code point, whatever encoding either side is kept in,
+ *  - blobs and undecodable text byte by byte, a prefix before the longer,
+ *  - arrays of datums element by element.
+ *
+ * Datum_sortArray does not call Datum_compare through qsort. It extracts a
+ * sort key per datum once: the kind, a 64 bit prefix that orders like the
+ * value (the bits of the number as a double, made to sort as unsigned, or
+ * the first eight bytes of the text in utf-8) and, for text and blobs, the
+ * full bytes, text converted to utf-8, whose byte order is code point order.
+ * The keys are grouped by kind and radix sorted on the prefix, skipping the
+ * byte passes where every key has the same byte. Text and blobs that tie on
+ * the prefix are radix sorted again on their next eight bytes, as in a
+ * multi-key sort; the rest of the ties, and text that ends within the
+ * bytes compared, go through a stable merge sort on the extracted keys.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <datum.h>
+#include "datum_int.h"
+
+/* kinds, in sort order */
+enum {
+    DTM_SK_NULL, DTM_SK_BOOL, DTM_SK_NUM, DTM_SK_TEXT, DTM_SK_BADTEXT,
+    DTM_SK_BLOB, DTM_SK_DATUMS, DTM_SK_PTR, DTM_SK_OTHER, DTM_SK_NONE
+};
+
+#define DTM_SORT_SMALL  16          /* runs up to this length are insertion sorted */
+#define DTM_SORT_DEPTH  256         /* bytes of common beginning radix sorted, past that merged */
+
+struct dtm_sortKey {
+    uint64_t pre;                   /* orders like the value, ties need a closer look */
+    const uint8_t *s;               /* text in utf-8, or blob bytes */
+    size_t len;
+    Datum_T d;
+    uint8_t kind;
+};
+
+/* what the radix passes move around: the prefix and where its key is */
+struct dtm_sortRec {
+    uint64_t pre;
+    size_t i;
+};
+
+static int dtm_kind(Datum_T d)
+{
+    size_t flags = d->flags;
+
+    if (flags & (DATUM_Int | DATUM_Double))
+        return DTM_SK_NUM;
+    if (flags & DATUM_Text)
+        return (dtm_ready(d) && dtm_transcodable(dtm_textEnc(d))) ? DTM_SK_TEXT : DTM_SK_BADTEXT;
+    if (flags & DATUM_Null)
+        return DTM_SK_NULL;
+    if (flags & DATUM_Bool)
+        return DTM_SK_BOOL;
+    if (flags & DATUM_Blob)
+        return DTM_SK_BLOB;
+    if (flags & DATUM_Datums)
+        return DTM_SK_DATUMS;
+    if (flags & DATUM_UINTPTR)
+        return DTM_SK_PTR;
+    return DTM_SK_OTHER;
+}
+
+static int dtm_cmpIntDouble(long long i, double r)
+{
+    if (r != r)
+        return -1;                                  /* NaN after every number */
+    if (r >= 9223372036854775808.0)
+        return -1;
+    if (r < -9223372036854775808.0)
+        return 1;
+
+    long long t = (long long)r;                     /* toward zero, exact */
+    if (i != t)
+        return i < t ? -1 : 1;
+    double frac = r - (double)t;
+    return frac > 0 ? -1 : frac < 0 ? 1 : 0;
+}
+
+/**
+ * @brief orders two numbers, integers or doubles, by exact value
+ */
+int dtm_numCompare(Datum_T a, Datum_T b)
+{
+    bool ai = (a->flags & DATUM_Int) != 0, bi = (b->flags & DATUM_Int) != 0;
+
+    if (ai && bi)
+        return (a->value.i > b->value.i) - (a->value.i < b->value.i);
+    if (ai)
+        return dtm_cmpIntDouble(a->value.i, b->value.r);
+    if (bi)
+        return -dtm_cmpIntDouble(b->value.i, a->value.r);
+
+    double x = a->value.r, y = b->value.r;
+    if (x != x || y != y)
+        return (x != x) - (y != y);
+    return (x > y) - (x < y);
+}
+
+static int dtm_cmpBytes(const void *a, size_t la, const void *b, size_t lb)
+{
+    int c = memcmp(a, b, la < lb ? la : lb);
+    if (c)
+        return c < 0 ? -1 : 1;
+    return (la > lb) - (la < lb);
+}
+
+static int dtm_cmpText(Datum_T a, Datum_T b)
+{
+    dtm_encoding_t ea = dtm_textEnc(a), eb = dtm_textEnc(b);
+    const char *za = dtm_bytes(a), *zb = dtm_bytes(b);
+    size_t la = dtm_sz(a), lb = dtm_sz(b);
+
+    /* in these the order of the bytes is the order of the code points */
+    if (ea == eb && (ea == DTM_ENC_UTF8 || ea == DTM_ENC_ASCII || ea == DTM_ENC_ISO8859_1))
+        return dtm_cmpBytes(za, la, zb, lb);
+
+    int c = dtm_compareText(ea, za, la, eb, zb, lb);
+    return c == 2 ? dtm_cmpBytes(za, la, zb, lb) : c;
+}
+
+/**
+ * @brief Orders two datums
+ *
+ * A total order: nulls first, then bools, numbers, text, blobs, arrays of
+ * datums and pointers. Integers and doubles compare by exact value across
+ * the two types, text by code point whatever its encoding. Datums that
+ * compare 0 are Datum_isEqual. Not a datum sorts after everything.
+ *
+ * @return negative, 0 or positive as a sorts before, with or after b
+ */
+int Datum_compare(Datum_T a, Datum_T b)
+{
+    bool va = Datum_isDatum(a), vb = Datum_isDatum(b);
+    if (!va || !vb)
+        return (int)!va - (int)!vb;
+    if (a == b)
+        return 0;
+
+    int ka = dtm_kind(a), kb = dtm_kind(b);
+    if (ka != kb)
+        return ka < kb ? -1 : 1;
+
+    switch (ka)
+    {
+        case DTM_SK_NUM:
+            return dtm_numCompare(a, b);
+        case DTM_SK_TEXT:
+            return dtm_cmpText(a, b);
+        case DTM_SK_BADTEXT:
+            if (dtm_enc(a) != dtm_enc(b))
+                return dtm_enc(a) < dtm_enc(b) ? -1 : 1;
+            return dtm_cmpBytes(dtm_bytes(a), dtm_sz(a), dtm_bytes(b), dtm_sz(b));
+        case DTM_SK_BLOB:
+            return dtm_cmpBytes(dtm_bytes(a), dtm_sz(a), dtm_bytes(b), dtm_sz(b));
+        case DTM_SK_BOOL:
+            return (a->value.i > b->value.i) - (a->value.i < b->value.i);
+        case DTM_SK_DATUMS:
+            for (size_t i = 0; i < dtm_n(a) && i < dtm_n(b); i++) {
+                int c = Datum_compare(a->value.dtms[i], b->value.dtms[i]);
+                if (c)
+                    return c;
+            }
+            return (dtm_n(a) > dtm_n(b)) - (dtm_n(a) < dtm_n(b));
+        case DTM_SK_PTR:
+            return ((uintptr_t)a->value.uptr > (uintptr_t)b->value.uptr)
+                 - ((uintptr_t)a->value.uptr < (uintptr_t)b->value.uptr);
+        default:
+            return 0;
+    }
+}
+
+/* first eight bytes, big endian, zero padded: orders like the bytes */
+static uint64_t dtm_prefix(const uint8_t *s, size_t len)
+{
+    uint64_t p = 0;
+    for (size_t i = 0; i < 8; i++)
+        p = (p << 8) | (i < len ? s[i] : 0);
+    return p;
+}
+
+/* the bits of a double, made to order as an unsigned integer; NaN last */
+static uint64_t dtm_doubleKey(double r)
+{
+    uint64_t bits;
+
+    if (r != r)
+        return UINT64_MAX;
+    if (r == 0)
+        r = 0;                                      /* -0.0 */
+    memcpy(&bits, &r, sizeof bits);
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+static bool dtm_asciiOnly(const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (s[i] & 0x80)
+            return false;
+    return true;
+}
+
+/* text whose bytes are not its utf-8 */
+static bool dtm_needsUtf8(Datum_T d)
+{
+    dtm_encoding_t enc = dtm_textEnc(d);
+    return enc != DTM_ENC_UTF8
+        && !(dtm_unitSize(enc) == 1 && dtm_asciiOnly(dtm_bytes(d), dtm_sz(d)));
+}
+
+/**
+ * @brief fills in the sort keys; text not in utf-8 is converted into one
+ * buffer, returned in *buf
+ */
+static bool dtm_sortKeys(Datum_T *datums, size_t n, struct dtm_sortKey *keys, char **buf)
+{
+    size_t need = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        Datum_T d = datums[i];
+        struct dtm_sortKey *k = &keys[i];
+        k->d = d;
+        k->pre = 0;
+        k->s = NULL;
+        k->len = 0;
+        k->kind = Datum_isDatum(d) ? (uint8_t)dtm_kind(d) : DTM_SK_NONE;
+        if (k->kind == DTM_SK_TEXT && dtm_needsUtf8(d))
+            need += dtm_transcodeBound(dtm_textEnc(d), DTM_ENC_UTF8, dtm_sz(d));
+    }
+
+    *buf = NULL;
+    if (need && !(*buf = malloc(need)))
+        return false;
+
+    char *out = *buf;
+    for (size_t i = 0; i < n; i++) {
+        struct dtm_sortKey *k = &keys[i];
+        Datum_T d = k->d;
+        switch (k->kind)
+        {
+            case DTM_SK_NUM:
+                k->pre = dtm_doubleKey((d->flags & DATUM_Int) ? (double)d->value.i : d->value.r);
+                break;
+            case DTM_SK_BOOL:
+                k->pre = (uint64_t)d->value.i ^ (1ULL << 63);
+                break;
+            case DTM_SK_PTR:
+                k->pre = (uint64_t)(uintptr_t)d->value.uptr;
+                break;
+            case DTM_SK_TEXT:
+                k->s = (const uint8_t *)dtm_bytes(d);
+                k->len = dtm_sz(d);
+                if (dtm_needsUtf8(d)) {
+                    size_t sz = dtm_transcode(dtm_textEnc(d), DTM_ENC_UTF8, dtm_bytes(d), dtm_sz(d), out, NULL);
+                    if (sz == (size_t)-1) {
+                        k->kind = DTM_SK_BADTEXT;
+                        break;
+                    }
+                    k->s = (const uint8_t *)out;
+                    k->len = sz;
+                    out += sz;
+                }
+                k->pre = dtm_prefix(k->s, k->len);
+                break;
+            case DTM_SK_BLOB:
+                k->s = (const uint8_t *)dtm_bytes(d);
+                k->len = dtm_sz(d);
+                k->pre = dtm_prefix(k->s, k->len);
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+/* LSD radix sort of recs on pre; stable, the result ends up in recs */
+static void dtm_radixSort(struct dtm_sortRec *recs, struct dtm_sortRec *tmp, size_t n)
+{
+    size_t count[8][256];
+    struct dtm_sortRec *from = recs, *to = tmp;
+
+    memset(count, 0, sizeof count);
+    for (size_t i = 0; i < n; i++)
+        for (int b = 0; b < 8; b++)
+            count[b][(recs[i].pre >> (8 * b)) & 0xff]++;
+
+    for (int b = 0; b < 8; b++) {
+        if (count[b][(recs[0].pre >> (8 * b)) & 0xff] == n)
+            continue;                               /* every key has the same byte here */
+
+        size_t pos = 0;
+        for (int v = 0; v < 256; v++) {
+            size_t c = count[b][v];
+            count[b][v] = pos;
+            pos += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            to[count[b][(from[i].pre >> (8 * b)) & 0xff]++] = from[i];
+        struct dtm_sortRec *t = from;
+        from = to;
+        to = t;
+    }
+    if (from != recs)
+        memcpy(recs, from, n * sizeof *recs);
+}
+
+/* orders two keys completely */
+static int dtm_keyCompare(const struct dtm_sortKey *a, const struct dtm_sortKey *b)
+{
+    if (a->kind != b->kind)
+        return a->kind < b->kind ? -1 : 1;
+    if (a->pre != b->pre)
+        return a->pre < b->pre ? -1 : 1;
+
+    switch (a->kind)
+    {
+        case DTM_SK_TEXT:
+        case DTM_SK_BLOB:
+            return dtm_cmpBytes(a->s, a->len, b->s, b->len);
+        case DTM_SK_NUM:
+            return dtm_numCompare(a->d, b->d);
+        case DTM_SK_NULL:
+        case DTM_SK_NONE:
+            return 0;
+        default:
+            return Datum_compare(a->d, b->d);
+    }
+}
+
+/* stable merge sort of recs[0, n) with room for n records in tmp */
+static void dtm_mergeSort(const struct dtm_sortKey *keys, struct dtm_sortRec *recs,
+                          struct dtm_sortRec *tmp, size_t n)
+{
+    if (n <= DTM_SORT_SMALL) {
+        for (size_t i = 1; i < n; i++) {
+            struct dtm_sortRec r = recs[i];
+            size_t j = i;
+            for (; j > 0 && dtm_keyCompare(&keys[recs[j - 1].i], &keys[r.i]) > 0; j--)
+                recs[j] = recs[j - 1];
+            recs[j] = r;
+        }
+        return;
+    }
+
+    size_t h = n / 2;
+    dtm_mergeSort(keys, recs, tmp, h);
+    dtm_mergeSort(keys, recs + h, tmp + h, n - h);
+    if (dtm_keyCompare(&keys[recs[h - 1].i], &keys[recs[h].i]) <= 0)
+        return;                                     /* already in order */
+
+    memcpy(tmp, recs, h * sizeof *recs);
+    size_t i = 0, j = h, o = 0;
+    while (i < h && j < n)
+        recs[o++] = dtm_keyCompare(&keys[recs[j].i], &keys[tmp[i].i]) < 0 ? recs[j++] : tmp[i++];
+    while (i < h)
+        recs[o++] = tmp[i++];
+}
+
+/**
+ * @brief sorts recs[0, n), which tie on kind and on the bytes before depth
+ *
+ * Text and blobs that go on past depth + 8 take the next eight bytes as
+ * their prefix and are radix sorted again, one level per eight bytes, so
+ * that long common beginnings such as "Kunde 000.." cost no byte compares.
+ */
+static void dtm_sortRun(const struct dtm_sortKey *keys, struct dtm_sortRec *recs,
+                        struct dtm_sortRec *tmp, size_t n, size_t depth)
+{
+    uint8_t kind = keys[recs[0].i].kind;
+
+    if (depth) {
+        bool deeper = n > DTM_SORT_SMALL && depth < DTM_SORT_DEPTH
+                   && (kind == DTM_SK_TEXT || kind == DTM_SK_BLOB);
+        for (size_t i = 0; i < n && deeper; i++)
+            deeper = keys[recs[i].i].len > depth;
+        if (!deeper) {
+            dtm_mergeSort(keys, recs, tmp, n);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            const struct dtm_sortKey *k = &keys[recs[i].i];
+            recs[i].pre = dtm_prefix(k->s + depth, k->len - depth);
+        }
+    }
+    dtm_radixSort(recs, tmp, n);
+
+    /* runs that tie on the prefix */
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && recs[j].pre == recs[i].pre)
+            j++;
+        if (j - i > 1 && kind != DTM_SK_NULL && kind != DTM_SK_NONE)
+            dtm_sortRun(keys, recs + i, tmp, j - i, depth + 8);
+        i = j;
+    }
+}
+
+/**
+ * @brief Sorts an array of datums in the order of Datum_compare
+ *
+ * Stable. Sort keys are extracted once and radix sorted eight bytes at a
+ * time; datums are only compared one against the other where the bytes run
+ * out. Text not in utf-8 is converted once into a temporary buffer.
+ *
+ * @return true, or false on allocation failure with the array as it was
+ */
+bool Datum_sortArray(Datum_T *datums, size_t n)
+{
+    if (!datums || n < 2)
+        return true;
+
+    struct dtm_sortKey *keys = malloc(n * sizeof *keys);
+    struct dtm_sortRec *recs = malloc(2 * n * sizeof *recs);
+    char *buf = NULL;
+    if (!keys || !recs || !dtm_sortKeys(datums, n, keys, &buf)) {
+        free(keys);
+        free(recs);
+        return false;
+    }
+
+    /* kind first: a stable counting sort, then each kind on its own */
+    size_t start[DTM_SK_NONE + 2] = { 0 };
+    for (size_t i = 0; i < n; i++)
+        start[keys[i].kind + 1]++;
+    for (int k = 1; k <= DTM_SK_NONE + 1; k++)
+        start[k] += start[k - 1];
+
+    size_t pos[DTM_SK_NONE + 1];
+    memcpy(pos, start, sizeof pos);
+    for (size_t i = 0; i < n; i++)
+        recs[pos[keys[i].kind]++] = (struct dtm_sortRec){ keys[i].pre, i };
+
+    struct dtm_sortRec *tmp = recs + n;
+    for (int k = 0; k <= DTM_SK_NONE; k++)
+        if (start[k + 1] - start[k] > 1)
+            dtm_sortRun(keys, recs + start[k], tmp, start[k + 1] - start[k], 0);
+
+    for (size_t i = 0; i < n; i++)
+        datums[i] = keys[recs[i].i].d;
+    free(buf);
+    free(keys);
+    free(recs);
+    return true;
+}
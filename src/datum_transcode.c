@@ -0,0 +1,763 @@
+/*
+ * datum_transcode.c
+ *
+ * Conversions between any two of the encodings Datum knows: utf-8, utf-16
+ * and utf-32 in either byte order, and the single byte encodings of
+ * datum_codec.c.
+ *
+ * The work is done one code point at a time by a decoder for the source and
+ * an encoder for the target, which check everything: stray and unpaired
+ * surrogates, overlong utf-8, code points above U+10FFFF and characters the
+ * target can not hold. In front of that sit SSE2 fast paths for the common
+ * cases, each taking a block of code units at a time:
+ *
+ *  - ASCII runs between utf-8 (or a single byte encoding) and any other
+ *    encoding, copied, widened or narrowed with unpack and pack instructions,
+ *  - runs of BMP characters outside the surrogate range between utf-16 and
+ *    utf-32.
+ *
+ * Byte order is handled inside the fast paths, so LE and BE cost the same.
+ *
+ * dtm_compareText orders two strings in different encodings with the same
+ * decoders, without converting either.
+ *
+ * dtm_transcoder_new/feed/flush wrap dtm_transcode for input that comes in
+ * chunks, see the end of the file.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DTM_SCALAR_RUN 16           /* bytes handled one by one before a fast path is tried again */
+
+/* the loop is compiled once per pair of code unit sizes, see dtm_transcode */
+#define DTM_INLINE static inline __attribute__((always_inline))
+
+/* how the code units of an encoding look */
+struct dtm_form {
+    uint8_t unit;                   /* 1, 2 or 4 bytes */
+    bool be;                        /* big endian code units */
+    bool sbcs;                      /* single byte encoding, not utf-8 */
+};
+
+static bool dtm_form(dtm_encoding_t encoding, struct dtm_form *f)
+{
+    f->sbcs = false;
+    switch ((int)encoding)
+    {
+        case DATUM_UTF8:    f->unit = 1; f->be = false; return true;
+        case DATUM_UTF16LE: f->unit = 2; f->be = false; return true;
+        case DATUM_UTF16BE: f->unit = 2; f->be = true; return true;
+        case DATUM_UTF16:   f->unit = 2; f->be = DTM_HOST_BE; return true;
+        case DATUM_UTF32LE: f->unit = 4; f->be = false; return true;
+        case DATUM_UTF32BE: f->unit = 4; f->be = true; return true;
+        case DATUM_UTF32:   f->unit = 4; f->be = DTM_HOST_BE; return true;
+        default:
+            f->unit = 1;
+            f->be = false;
+            f->sbcs = dtm_sbcs_supported(encoding);
+            return f->sbcs;
+    }
+}
+
+static inline uint32_t dtm_rd16(const uint8_t *s, bool be)
+{
+    uint16_t u;
+    memcpy(&u, s, 2);
+    return be != DTM_HOST_BE ? __builtin_bswap16(u) : u;
+}
+
+static inline uint32_t dtm_rd32(const uint8_t *s, bool be)
+{
+    uint32_t u;
+    memcpy(&u, s, 4);
+    return be != DTM_HOST_BE ? __builtin_bswap32(u) : u;
+}
+
+static inline void dtm_wr16(uint8_t *d, uint32_t u, bool be)
+{
+    uint16_t w = (uint16_t)u;
+    if (be != DTM_HOST_BE)
+        w = __builtin_bswap16(w);
+    memcpy(d, &w, 2);
+}
+
+static inline void dtm_wr32(uint8_t *d, uint32_t u, bool be)
+{
+    if (be != DTM_HOST_BE)
+        u = __builtin_bswap32(u);
+    memcpy(d, &u, 4);
+}
+
+/**
+ * @brief decodes the code point at s; returns its length in bytes, 0 if it
+ * is not valid or cut short
+ */
+DTM_INLINE size_t dtm_decode(dtm_encoding_t enc, const struct dtm_form *f,
+                         const uint8_t *s, size_t left, uint32_t *cp)
+{
+    if (f->sbcs) {
+        int32_t c = dtm_sbcs_decode(enc, s[0]);
+        *cp = (uint32_t)c;
+        return c < 0 ? 0 : 1;
+    }
+
+    if (f->unit == 1) {
+        uint8_t c = s[0];
+        if (c < 0x80) {
+            *cp = c;
+            return 1;
+        }
+        if (c >= 0xc2 && c < 0xe0 && left >= 2 && (s[1] & 0xc0) == 0x80) {
+            /* two bytes cover Latin, Greek, Cyrillic, Hebrew and Arabic */
+            *cp = (uint32_t)(c & 0x1f) << 6 | (s[1] & 0x3f);
+            return 2;
+        }
+        size_t n = c < 0xc2 ? 0 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : c < 0xf5 ? 4 : 0;
+        if (!n || n > left)
+            return 0;
+        uint32_t u = c & (0x7f >> n);
+        for (size_t k = 1; k < n; k++) {
+            if ((s[k] & 0xc0) != 0x80)
+                return 0;
+            u = (u << 6) | (s[k] & 0x3f);
+        }
+        if ((n == 3 && u < 0x800) || (n == 4 && (u < 0x10000 || u > 0x10ffff))
+            || (u >= 0xd800 && u <= 0xdfff))
+            return 0;
+        *cp = u;
+        return n;
+    }
+
+    if (f->unit == 2) {
+        if (left < 2)
+            return 0;
+        uint32_t u = dtm_rd16(s, f->be);
+        if (u < 0xd800 || u > 0xdfff) {
+            *cp = u;
+            return 2;
+        }
+        if (u > 0xdbff || left < 4)
+            return 0;
+        uint32_t l = dtm_rd16(s + 2, f->be);
+        if (l < 0xdc00 || l > 0xdfff)
+            return 0;
+        *cp = 0x10000 + ((u - 0xd800) << 10) + (l - 0xdc00);
+        return 4;
+    }
+
+    if (left < 4)
+        return 0;
+    uint32_t u = dtm_rd32(s, f->be);
+    if (u > 0x10ffff || (u >= 0xd800 && u <= 0xdfff))
+        return 0;
+    *cp = u;
+    return 4;
+}
+
+/**
+ * @brief encodes cp at d; returns the number of bytes, 0 if the encoding
+ * has no room for it
+ */
+DTM_INLINE size_t dtm_encode(dtm_encoding_t enc, const struct dtm_form *f, uint32_t cp, uint8_t *d)
+{
+    if (f->sbcs) {
+        int b = dtm_sbcs_encode(enc, cp);
+        if (b < 0)
+            return 0;
+        d[0] = (uint8_t)b;
+        return 1;
+    }
+
+    if (f->unit == 1) {
+        if (cp < 0x80) {
+            d[0] = (uint8_t)cp;
+            return 1;
+        }
+        if (cp < 0x800) {
+            d[0] = (uint8_t)(0xc0 | (cp >> 6));
+            d[1] = (uint8_t)(0x80 | (cp & 0x3f));
+            return 2;
+        }
+        if (cp < 0x10000) {
+            d[0] = (uint8_t)(0xe0 | (cp >> 12));
+            d[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+            d[2] = (uint8_t)(0x80 | (cp & 0x3f));
+            return 3;
+        }
+        d[0] = (uint8_t)(0xf0 | (cp >> 18));
+        d[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3f));
+        d[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+        d[3] = (uint8_t)(0x80 | (cp & 0x3f));
+        return 4;
+    }
+
+    if (f->unit == 2) {
+        if (cp < 0x10000) {
+            dtm_wr16(d, cp, f->be);
+            return 2;
+        }
+        cp -= 0x10000;
+        dtm_wr16(d, 0xd800 + (cp >> 10), f->be);
+        dtm_wr16(d + 2, 0xdc00 + (cp & 0x3ff), f->be);
+        return 4;
+    }
+
+    dtm_wr32(d, cp, f->be);
+    return 4;
+}
+
+#ifdef __SSE2__
+
+static inline __m128i dtm_swap16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static inline __m128i dtm_swap32(__m128i v)
+{
+    v = dtm_swap16(v);
+    return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+}
+
+/**
+ * @brief converts whole blocks of code units that need no decoding
+ *
+ * @param in number of source bytes consumed
+ * @return number of bytes written
+ */
+DTM_INLINE size_t dtm_fastRun(const struct dtm_form *fi, const struct dtm_form *fo,
+                              const uint8_t *s, size_t len, uint8_t *d, size_t *in)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0, o = 0;
+    bool swapIn = fi->be != DTM_HOST_BE, swapOut = fo->be != DTM_HOST_BE;
+
+    if (fi->unit == 1 && fo->unit == 1) {
+        /* ASCII is the same in utf-8 and every single byte encoding */
+        for (; i + 16 <= len; i += 16, o += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            if (_mm_movemask_epi8(v))
+                break;
+            _mm_storeu_si128((__m128i *)(d + o), v);
+        }
+    }
+    else if (fi->unit == 1 && fo->unit > 1) {
+        /* 16 ASCII bytes to 16 wide code units */
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            if (_mm_movemask_epi8(v))
+                break;
+            __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+            if (fo->unit == 2) {
+                if (swapOut) {
+                    lo = dtm_swap16(lo);
+                    hi = dtm_swap16(hi);
+                }
+                _mm_storeu_si128((__m128i *)(d + o), lo);
+                _mm_storeu_si128((__m128i *)(d + o + 16), hi);
+                o += 32;
+            }
+            else {
+                __m128i w[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                                 _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+                for (int k = 0; k < 4; k++, o += 16)
+                    _mm_storeu_si128((__m128i *)(d + o), swapOut ? dtm_swap32(w[k]) : w[k]);
+            }
+        }
+    }
+    else if (fi->unit == 2 && fo->unit == 1) {
+        /* 8 utf-16 units below 0x80 to 8 bytes */
+        const __m128i high = _mm_set1_epi16((short)0xff80);
+        for (; i + 16 <= len; i += 16, o += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            if (swapIn)
+                v = dtm_swap16(v);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), zero)) != 0xffff)
+                break;
+            _mm_storel_epi64((__m128i *)(d + o), _mm_packus_epi16(v, v));
+        }
+    }
+    else if (fi->unit == 4 && fo->unit == 1) {
+        /* 8 utf-32 units below 0x80 to 8 bytes */
+        const __m128i high = _mm_set1_epi32((int)0xffffff80);
+        for (; i + 32 <= len; i += 32, o += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+            if (swapIn) {
+                a = dtm_swap32(a);
+                b = dtm_swap32(b);
+            }
+            __m128i bad = _mm_or_si128(_mm_and_si128(a, high), _mm_and_si128(b, high));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(bad, zero)) != 0xffff)
+                break;
+            __m128i w = _mm_packs_epi32(a, b);
+            _mm_storel_epi64((__m128i *)(d + o), _mm_packus_epi16(w, w));
+        }
+    }
+    else if (fi->unit == 2 && fo->unit == 4) {
+        /* 8 utf-16 units, none of them a surrogate, to 8 utf-32 units */
+        const __m128i mask = _mm_set1_epi16((short)0xf800), sur = _mm_set1_epi16((short)0xd800);
+        for (; i + 16 <= len; i += 16, o += 32) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            if (swapIn)
+                v = dtm_swap16(v);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask), sur)))
+                break;
+            __m128i lo = _mm_unpacklo_epi16(v, zero), hi = _mm_unpackhi_epi16(v, zero);
+            if (swapOut) {
+                lo = dtm_swap32(lo);
+                hi = dtm_swap32(hi);
+            }
+            _mm_storeu_si128((__m128i *)(d + o), lo);
+            _mm_storeu_si128((__m128i *)(d + o + 16), hi);
+        }
+    }
+    else if (fi->unit == 4 && fo->unit == 2) {
+        /* 8 utf-32 units in the BMP, none of them a surrogate, to 8 utf-16 units */
+        const __m128i upper = _mm_set1_epi32((int)0xffff0000);
+        const __m128i mask = _mm_set1_epi32(0xf800), sur = _mm_set1_epi32(0xd800);
+        const __m128i bias32 = _mm_set1_epi32(0x8000), bias16 = _mm_set1_epi16((short)0x8000);
+        for (; i + 32 <= len; i += 32, o += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+            if (swapIn) {
+                a = dtm_swap32(a);
+                b = dtm_swap32(b);
+            }
+            __m128i big = _mm_or_si128(_mm_and_si128(a, upper), _mm_and_si128(b, upper));
+            __m128i surA = _mm_cmpeq_epi32(_mm_and_si128(a, mask), sur);
+            __m128i surB = _mm_cmpeq_epi32(_mm_and_si128(b, mask), sur);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(big, zero)) != 0xffff
+                || _mm_movemask_epi8(_mm_or_si128(surA, surB)))
+                break;
+            /* packs saturates signed, so shift the range down and back up */
+            __m128i w = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+            w = _mm_xor_si128(w, bias16);
+            _mm_storeu_si128((__m128i *)(d + o), swapOut ? dtm_swap16(w) : w);
+        }
+    }
+    *in = i;
+    return o;
+}
+
+#else /* no SSE2 */
+
+DTM_INLINE size_t dtm_fastRun(const struct dtm_form *fi, const struct dtm_form *fo,
+                              const uint8_t *s, size_t len, uint8_t *d, size_t *in)
+{
+    (void)fi; (void)fo; (void)s; (void)len; (void)d;
+    *in = 0;
+    return 0;
+}
+
+#endif /* __SSE2__ */
+
+/**
+ * @brief Tells if dtm_transcode can convert from or to the encoding
+ */
+bool dtm_transcodable(dtm_encoding_t encoding)
+{
+    struct dtm_form f;
+    return dtm_form(encoding, &f);
+}
+
+/**
+ * @brief Returns the most bytes len bytes in from can take in to
+ */
+size_t dtm_transcodeBound(dtm_encoding_t from, dtm_encoding_t to, size_t len)
+{
+    struct dtm_form fi, fo;
+    if (!dtm_form(from, &fi) || !dtm_form(to, &fo))
+        return 0;
+
+    /* per source byte: utf-8 takes at most 3 bytes for a 2 byte unit, and a
+       single byte one 3 bytes of utf-8 or one unit of anything else */
+    if (fi.unit == 1)
+        return len * (fo.unit == 1 ? 3 : fo.unit);
+    if (fi.unit == 2)
+        return fo.unit == 1 ? len / 2 * 3 : len * fo.unit / 2;
+    return len;                                     /* a surrogate pair is as long as one utf-32 unit */
+}
+
+/**
+ * @brief the conversion loop: fast paths, then a few characters one by one
+ */
+DTM_INLINE size_t dtm_run(dtm_encoding_t from, dtm_encoding_t to, struct dtm_form fi, struct dtm_form fo,
+                          const uint8_t *s, size_t len, uint8_t *d, size_t *errPos)
+{
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        size_t used;
+        o += dtm_fastRun(&fi, &fo, s + i, len - i, d + o, &used);
+        i += used;
+
+        size_t stop = i + DTM_SCALAR_RUN;
+        while (i < len && i < stop) {
+            uint32_t cp;
+            size_t m = 0, n;
+            if (fi.unit == 1 && s[i] < 0x80 && (fo.unit != 1 || !fo.sbcs)) {
+                /* ASCII is the same everywhere, skip the tables */
+                cp = s[i];
+                n = 1;
+            }
+            else
+                n = dtm_decode(from, &fi, s + i, len - i, &cp);
+            if (n)
+                m = dtm_encode(to, &fo, cp, d + o);
+            if (!m) {
+                if (errPos)
+                    *errPos = i;
+                return (size_t)-1;
+            }
+            i += n;
+            o += m;
+        }
+    }
+    return o;
+}
+
+#define DTM_RUN(fu, tu) \
+    dtm_run(from, to, (struct dtm_form){ fu, fi.be, fi.sbcs }, (struct dtm_form){ tu, fo.be, fo.sbcs }, \
+            (const uint8_t *)src, len, (uint8_t *)dst, errPos)
+
+/**
+ * @brief Converts len bytes from one encoding to another
+ *
+ * @param dst room for dtm_transcodeBound(from, to, len) bytes
+ * @param errPos if not NULL, receives the offset in src of the first
+ * character that is not valid or has no place in to
+ * @return bytes written, or (size_t)-1 on such a character
+ */
+size_t dtm_transcode(dtm_encoding_t from, dtm_encoding_t to, const char *src, size_t len,
+                     char *dst, size_t *errPos)
+{
+    struct dtm_form fi, fo;
+
+    if (!dtm_form(from, &fi) || !dtm_form(to, &fo)) {
+        if (errPos)
+            *errPos = 0;
+        return (size_t)-1;
+    }
+
+    /* the table driven codecs check their input themselves */
+    if (fi.sbcs && (fo.sbcs || to == DTM_ENC_UTF8)) {
+        size_t out = fo.sbcs ? dtm_sbcs_convert(from, to, src, len, dst)
+                             : dtm_sbcs_toUtf8(from, src, len, dst);
+        if (out != (size_t)-1 || !errPos)
+            return out;
+        /* fall through to find the offending byte */
+    }
+    else if (fo.sbcs && from == DTM_ENC_UTF8 && dtm_utf8_validate(src, len)) {
+        size_t out = dtm_sbcs_fromUtf8(to, src, len, dst);
+        if (out != (size_t)-1 || !errPos)
+            return out;
+    }
+
+    switch (fi.unit * 8 + fo.unit)
+    {
+        case 011: return DTM_RUN(1, 1);
+        case 012: return DTM_RUN(1, 2);
+        case 014: return DTM_RUN(1, 4);
+        case 021: return DTM_RUN(2, 1);
+        case 022: return DTM_RUN(2, 2);
+        case 024: return DTM_RUN(2, 4);
+        case 041: return DTM_RUN(4, 1);
+        case 042: return DTM_RUN(4, 2);
+        default:  return DTM_RUN(4, 4);
+    }
+}
+
+/* walks both strings one code point at a time; runs of ASCII between two
+   byte encodings are compared sixteen bytes at a time. Returns -1, 0 or 1,
+   or 2 on a character that is not valid before the first difference */
+DTM_INLINE int dtm_cmpRun(dtm_encoding_t ea, struct dtm_form fa, const uint8_t *a, size_t la,
+                          dtm_encoding_t eb, struct dtm_form fb, const uint8_t *b, size_t lb)
+{
+    size_t i = 0, j = 0;
+
+    while (i < la && j < lb) {
+#ifdef __SSE2__
+        if (fa.unit == 1 && fb.unit == 1) {
+            /* ASCII reads the same in every byte encoding */
+            while (i + 16 <= la && j + 16 <= lb) {
+                __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+                __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+                if (_mm_movemask_epi8(_mm_or_si128(va, vb))
+                    || _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff)
+                    break;
+                i += 16;
+                j += 16;
+            }
+        }
+#endif
+        for (size_t stop = i + DTM_SCALAR_RUN; i < la && j < lb && i < stop; ) {
+            uint32_t ca = 0, cb = 0;
+            size_t na = dtm_decode(ea, &fa, a + i, la - i, &ca);
+            size_t nb = dtm_decode(eb, &fb, b + j, lb - j, &cb);
+            if (!na || !nb)
+                return 2;
+            if (ca != cb)
+                return ca < cb ? -1 : 1;
+            i += na;
+            j += nb;
+        }
+    }
+    return (i < la) - (j < lb);
+}
+
+#define DTM_CMP(ua, ub) \
+    dtm_cmpRun(ea, (struct dtm_form){ ua, fa.be, fa.sbcs }, (const uint8_t *)a, la, \
+               eb, (struct dtm_form){ ub, fb.be, fb.sbcs }, (const uint8_t *)b, lb)
+
+/**
+ * @brief Orders two strings in any two encodings by code point
+ *
+ * Nothing is converted or allocated: both are decoded side by side and the
+ * walk stops at the first difference.
+ *
+ * @return -1, 0 or 1 as a is before, the same as or after b; 2 if either
+ * encoding is not known or a character before the first difference is not
+ * valid
+ */
+int dtm_compareText(dtm_encoding_t ea, const char *a, size_t la, dtm_encoding_t eb, const char *b, size_t lb)
+{
+    struct dtm_form fa, fb;
+
+    if (!dtm_form(ea, &fa) || !dtm_form(eb, &fb))
+        return 2;
+
+    switch (fa.unit * 8 + fb.unit)
+    {
+        case 011: return DTM_CMP(1, 1);
+        case 012: return DTM_CMP(1, 2);
+        case 014: return DTM_CMP(1, 4);
+        case 021: return DTM_CMP(2, 1);
+        case 022: return DTM_CMP(2, 2);
+        case 024: return DTM_CMP(2, 4);
+        case 041: return DTM_CMP(4, 1);
+        case 042: return DTM_CMP(4, 2);
+        default:  return DTM_CMP(4, 4);
+    }
+}
+
+/*
+ * Streaming conversion
+ * --------------------
+ * A dtm_transcoder converts input that arrives in chunks of any size, for
+ * files too big for a datum. Each chunk goes through dtm_transcode in pieces
+ * that fit the room left in the caller's buffer, cut at character
+ * boundaries; a character split between two chunks waits in a small carry
+ * buffer for the rest of its bytes. Nothing is allocated after
+ * dtm_transcoder_new.
+ */
+struct dtm_transcoder {
+    dtm_encoding_t from;
+    dtm_encoding_t to;
+    struct dtm_form fi;
+    size_t bound4;                  /* dtm_transcodeBound of 4 bytes, the worst growth */
+    uint8_t carry[4];               /* start of a character cut short by the chunk's end */
+    uint8_t nCarry;
+};
+
+/* bytes of the character starting at s, as far as the first n bytes tell */
+static size_t dtm_charBytes(const struct dtm_form *f, const uint8_t *s, size_t n)
+{
+    if (f->sbcs)
+        return 1;
+    if (f->unit == 1)
+        return s[0] < 0xc2 ? 1 : s[0] < 0xe0 ? 2 : s[0] < 0xf0 ? 3 : s[0] < 0xf5 ? 4 : 1;
+    if (f->unit == 2) {
+        if (n < 2)
+            return 2;
+        uint32_t u = dtm_rd16(s, f->be);
+        return (u >= 0xd800 && u <= 0xdbff) ? 4 : 2;
+    }
+    return 4;
+}
+
+/* the longest start of s[0..n) that does not end inside a character */
+static size_t dtm_cut(const struct dtm_form *f, const uint8_t *s, size_t n)
+{
+    if (f->sbcs)
+        return n;
+    if (f->unit == 1) {
+        size_t j = n;
+        while (j > 0 && n - j < 4 && (s[j - 1] & 0xc0) == 0x80)
+            j--;
+        if (j == 0 || n - j == 4)
+            return n;                               /* a stray continuation byte, let dtm_transcode refuse it */
+        return (dtm_charBytes(f, s + j - 1, n - j + 1) > n - j + 1) ? j - 1 : n;
+    }
+    if (f->unit == 2) {
+        n &= ~(size_t)1;
+        if (n >= 2) {
+            uint32_t u = dtm_rd16(s + n - 2, f->be);
+            if (u >= 0xd800 && u <= 0xdbff)
+                n -= 2;
+        }
+        return n;
+    }
+    return n & ~(size_t)3;
+}
+
+/**
+ * @brief Creates a converter for input that arrives in chunks
+ *
+ * @return the converter, or NULL if there is no conversion between the
+ * encodings or no memory
+ */
+dtm_transcoder_T dtm_transcoder_new(dtm_encoding_t from, dtm_encoding_t to)
+{
+    struct dtm_transcoder *tc;
+
+    if (!dtm_transcodable(to) || !(tc = calloc(1, sizeof(struct dtm_transcoder))))
+        return NULL;
+    if (!dtm_form(from, &tc->fi)) {
+        free(tc);
+        return NULL;
+    }
+    tc->from = from;
+    tc->to = to;
+    tc->bound4 = dtm_transcodeBound(from, to, 4);
+    return tc;
+}
+
+/**
+ * @brief Converts the carried character once the chunk has completed it
+ *
+ * @return bytes written, 0 if the chunk ended before the character did, or
+ * (size_t)-1 if it is not valid
+ */
+static size_t dtm_transcoder_carry(dtm_transcoder_T tc, const char **src, size_t *len,
+                                   char *dst, size_t size)
+{
+    const uint8_t *s = (const uint8_t *)*src;
+    size_t need = dtm_charBytes(&tc->fi, tc->carry, tc->nCarry), take = 0;
+    bool broken = false;
+
+    while (tc->nCarry + take < need && take < *len) {
+        if (tc->fi.unit == 1 && (s[take] & 0xc0) != 0x80) {
+            broken = true;                          /* the sequence stops short */
+            break;
+        }
+        tc->carry[tc->nCarry + take] = s[take];
+        take++;
+        if (tc->fi.unit == 2 && tc->nCarry + take == 2)
+            need = dtm_charBytes(&tc->fi, tc->carry, 2);
+    }
+    if (tc->nCarry + take < need && !broken) {
+        tc->nCarry = (uint8_t)(tc->nCarry + take);
+        *src += take;
+        *len -= take;
+        return 0;
+    }
+    if (dtm_transcodeBound(tc->from, tc->to, tc->nCarry + take) > size)
+        return 0;                                   /* no room yet, the caller comes back */
+
+    size_t out = dtm_transcode(tc->from, tc->to, (const char *)tc->carry, tc->nCarry + take, dst, NULL);
+    if (out == (size_t)-1)
+        return out;
+    tc->nCarry = 0;
+    *src += take;
+    *len -= take;
+    return out;
+}
+
+/**
+ * @brief Converts the next chunk of input
+ *
+ * Takes as much of the chunk as there is room for in dst and advances *src
+ * and *len past what it took. A character cut short by the end of the chunk
+ * is kept until the next one. dst should have room for 16 bytes at least.
+ *
+ * A character that is not valid, or has no place in the target encoding,
+ * stops the conversion in front of it; the call that starts on it returns
+ * (size_t)-1 with *src pointing at it.
+ *
+ * @return bytes written to dst, or (size_t)-1 as above
+ */
+size_t dtm_transcoder_feed(dtm_transcoder_T tc, const char **src, size_t *len, char *dst, size_t size)
+{
+    size_t o = 0;
+
+    if (!tc || !src || !len || (*len && !*src))
+        return (size_t)-1;
+
+    if (tc->nCarry && *len) {
+        size_t out = dtm_transcoder_carry(tc, src, len, dst, size);
+        if (out == (size_t)-1)
+            return out;
+        if (tc->nCarry)
+            return 0;                               /* still waiting for bytes, or for room */
+        o = out;
+    }
+
+    while (*len) {
+        size_t piece = (size - o) * 4 / tc->bound4;
+        bool last = piece >= *len;
+        if (last)
+            piece = *len;
+        size_t k = dtm_cut(&tc->fi, (const uint8_t *)*src, piece);
+        if (k) {
+            size_t errPos;
+            size_t out = dtm_transcode(tc->from, tc->to, *src, k, dst + o, &errPos);
+            if (out == (size_t)-1) {
+                if (!errPos && !o)
+                    return out;
+                /* keep what comes before the bad character */
+                out = errPos ? dtm_transcode(tc->from, tc->to, *src, errPos, dst + o, NULL) : 0;
+                *src += errPos;
+                *len -= errPos;
+                return o + out;
+            }
+            *src += k;
+            *len -= k;
+            o += out;
+        }
+        if (last && *len && *len < 4) {
+            memcpy(tc->carry, *src, *len);         /* the start of a character */
+            tc->nCarry = (uint8_t)*len;
+            *src += *len;
+            *len = 0;
+        }
+        else if (!k)
+            break;                                  /* dst is full */
+    }
+    return o;
+}
+
+/**
+ * @brief Ends the input
+ *
+ * @return 0, or (size_t)-1 if the input stopped inside a character. Either
+ * way the converter is ready for new input.
+ */
+size_t dtm_transcoder_flush(dtm_transcoder_T tc)
+{
+    if (!tc)
+        return (size_t)-1;
+    bool cut = tc->nCarry != 0;
+    tc->nCarry = 0;
+    return cut ? (size_t)-1 : 0;
+}
+
+/**
+ * @brief Frees a converter and sets the pointer to NULL
+ */
+void dtm_transcoder_free(dtm_transcoder_T *tc)
+{
+    if (!tc || !*tc)
+        return;
+    free(*tc);
+    *tc = NULL;
+}
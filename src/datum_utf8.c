@@ -0,0 +1,374 @@
+/*
+ * datum_utf8.c
+ *
+ * Bulk UTF-8 validation. dtm_utf8_validate checks a whole buffer against
+ * the well-formed byte sequences of Unicode Table 3-7: no stray or missing
+ * continuation bytes, no overlong forms, no surrogates (U+D800..U+DFFF) and
+ * nothing above U+10FFFF.
+ *
+ * Three kernels do the work, the best one the CPU supports is chosen on
+ * first use:
+ *
+ *  - scalar: skips ASCII eight bytes at a time and checks the rest one
+ *    sequence at a time, for any CPU and for short strings,
+ *  - SSE2: skips ASCII sixteen bytes at a time, hands non-ASCII blocks to
+ *    the scalar checks,
+ *  - AVX2: classifies 32 bytes at a time with three nibble lookups (the
+ *    method of Keiser and Lemire, "Validating UTF-8 in less than one
+ *    instruction per byte"), with no branches on the data but one for
+ *    all-ASCII blocks.
+ *
+ * dtm_utf8_count counts the code points of a buffer that is known to be
+ * well formed, i.e. the bytes that are not continuation bytes, with the
+ * same choice of kernels.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <datum.h>
+#include "datum_int.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define DTM_UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+#define DTM_UTF8_SHORT  32      /* shorter buffers always take the scalar kernel */
+
+/**
+ * @brief checks the sequence at s; returns its length, 0 if it is not well formed
+ */
+static inline size_t dtm_utf8_sequence(const uint8_t *s, size_t left)
+{
+    uint8_t c = s[0];
+
+    if (c < 0x80)
+        return 1;
+    if (c < 0xc2)                                   /* continuation or overlong 2 byte lead */
+        return 0;
+    if (c < 0xe0)
+        return (left >= 2 && (s[1] & 0xc0) == 0x80) ? 2 : 0;
+    if (c < 0xf0) {
+        if (left < 3 || (s[2] & 0xc0) != 0x80)
+            return 0;
+        if (c == 0xe0 ? (s[1] < 0xa0 || s[1] > 0xbf)            /* overlong */
+            : c == 0xed ? (s[1] < 0x80 || s[1] > 0x9f)          /* surrogates */
+            : (s[1] & 0xc0) != 0x80)
+            return 0;
+        return 3;
+    }
+    if (c < 0xf5) {
+        if (left < 4 || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80)
+            return 0;
+        if (c == 0xf0 ? (s[1] < 0x90 || s[1] > 0xbf)            /* overlong */
+            : c == 0xf4 ? (s[1] < 0x80 || s[1] > 0x8f)          /* above U+10FFFF */
+            : (s[1] & 0xc0) != 0x80)
+            return 0;
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks that len bytes are well formed utf-8, without SIMD
+ */
+bool dtm_utf8_validateScalar(const char *buf, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)buf;
+    size_t i = 0;
+
+    while (i < len) {
+        /* ASCII runs eight bytes at a time */
+        while (i + 8 <= len) {
+            uint64_t w;
+            memcpy(&w, s + i, 8);
+            if (w & 0x8080808080808080ull)
+                break;
+            i += 8;
+        }
+        while (i < len && s[i] < 0x80)
+            i++;
+        if (i == len)
+            break;
+
+        size_t clen = dtm_utf8_sequence(s + i, len - i);
+        if (!clen)
+            return false;
+        i += clen;
+    }
+    return true;
+}
+
+/**
+ * @brief Counts the code points of len bytes of well formed utf-8, without SIMD
+ */
+size_t dtm_utf8_countScalar(const char *buf, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)buf;
+    size_t n = len, i = 0;
+
+    /* continuation bytes are 10xxxxxx: top bit set, the next one clear */
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        n -= (size_t)__builtin_popcountll(w & ~(w << 1) & 0x8080808080808080ull);
+    }
+    for (; i < len; i++)
+        n -= (s[i] & 0xc0) == 0x80;
+    return n;
+}
+
+#ifdef DTM_UTF8_X86
+
+__attribute__((target("sse2")))
+static size_t dtm_utf8_countSSE2(const char *buf, size_t len)
+{
+    const __m128i cont = _mm_set1_epi8((char)0xbf);    /* -65: continuations are below */
+    size_t n = 0, i = 0;
+
+    while (i + 16 <= len) {
+        /* at most 255 blocks before the byte counters could wrap */
+        __m128i acc = _mm_setzero_si128();
+        for (size_t k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, cont));
+        }
+        __m128i sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+        n += (size_t)_mm_extract_epi16(sum, 0) + (size_t)_mm_extract_epi16(sum, 4);
+    }
+    return n + dtm_utf8_countScalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t dtm_utf8_countAVX2(const char *buf, size_t len)
+{
+    const __m256i cont = _mm256_set1_epi8((char)0xbf);
+    size_t n = 0, i = 0;
+
+    while (i + 32 <= len) {
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t k = 0; k < 255 && i + 32 <= len; k++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, cont));
+        }
+        __m256i sum = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+        /* each 64 bit sum is at most 8 * 255 and fits the low 16 bits */
+        n += (size_t)_mm256_extract_epi16(sum, 0) + (size_t)_mm256_extract_epi16(sum, 4)
+           + (size_t)_mm256_extract_epi16(sum, 8) + (size_t)_mm256_extract_epi16(sum, 12);
+    }
+    return n + dtm_utf8_countScalar(buf + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static bool dtm_utf8_validateSSE2(const char *buf, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)buf;
+    size_t i = 0;
+
+    while (i < len) {
+        while (i + 16 <= len
+               && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))))
+            i += 16;
+        if (i + 16 > len)
+            return dtm_utf8_validateScalar(buf + i, len - i);
+
+        /* check sequences until the next aligned ASCII block could start */
+        size_t stop = i + 16;
+        while (i < stop) {
+            size_t clen = dtm_utf8_sequence(s + i, len - i);
+            if (!clen)
+                return false;
+            i += clen;
+        }
+    }
+    return true;
+}
+
+/* error bits of the lookup tables, see Keiser and Lemire */
+#define TOO_SHORT       (1 << 0)    /* lead byte not followed by enough continuations */
+#define TOO_LONG        (1 << 1)    /* continuation byte after ASCII */
+#define OVERLONG_3      (1 << 2)
+#define TOO_LARGE       (1 << 3)
+#define SURROGATE       (1 << 4)
+#define OVERLONG_2      (1 << 5)
+#define TOO_LARGE_1000  (1 << 6)
+#define OVERLONG_4      (1 << 6)
+#define TWO_CONTS       (1 << 7)    /* two continuations in a row, checked against must23 */
+#define CARRY           (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("avx2")))
+static inline __m256i dtm_lookup16(__m256i table, __m256i idx)
+{
+    return _mm256_shuffle_epi8(table, idx);
+}
+
+/* the input shifted right by n bytes across the 32 byte lanes, the gap filled from prev */
+#define DTM_PREV(input, prev, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static bool dtm_utf8_validateAVX2(const char *buf, size_t len)
+{
+    const __m256i byte1High = _mm256_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m256i byte1Low = _mm256_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m256i byte2High = _mm256_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    /* the last three bytes of a block may not start a sequence that does not fit */
+    const __m256i maxTail = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    const uint8_t *s = (const uint8_t *)buf;
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    uint8_t tail[32];
+    size_t i = 0;
+
+    for (;;) {
+        __m256i input;
+        if (i + 32 <= len)
+            input = _mm256_loadu_si256((const __m256i *)(s + i));
+        else {
+            /* zeros are ASCII and show up sequences cut short by the end */
+            memset(tail, 0, sizeof tail);
+            memcpy(tail, s + i, len - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        }
+
+        if (!_mm256_movemask_epi8(input))
+            error = _mm256_or_si256(error, incomplete);
+        else {
+            __m256i prev1 = DTM_PREV(input, prev, 1);
+            __m256i b1h = dtm_lookup16(byte1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+            __m256i b1l = dtm_lookup16(byte1Low, _mm256_and_si256(prev1, nibble));
+            __m256i b2h = dtm_lookup16(byte2High, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+            __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+            /* third and fourth bytes must be continuations, and only they */
+            __m256i third = _mm256_subs_epu8(DTM_PREV(input, prev, 2), _mm256_set1_epi8((char)(0xe0 - 0x80)));
+            __m256i fourth = _mm256_subs_epu8(DTM_PREV(input, prev, 3), _mm256_set1_epi8((char)(0xf0 - 0x80)));
+            __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+            error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+            incomplete = _mm256_subs_epu8(input, maxTail);
+        }
+        prev = input;
+
+        if (i + 32 > len)
+            break;
+        i += 32;
+    }
+    return _mm256_testz_si256(error, error) ? true : false;
+}
+
+#endif /* DTM_UTF8_X86 */
+
+static bool (*dtm_utf8_kernel)(const char *, size_t) = dtm_utf8_validateScalar;
+static size_t (*dtm_utf8_counter)(const char *, size_t) = dtm_utf8_countScalar;
+static pthread_once_t utf8_once = PTHREAD_ONCE_INIT;
+
+static void dtm_utf8_select(void)
+{
+#ifdef DTM_UTF8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        dtm_utf8_kernel = dtm_utf8_validateAVX2;
+        dtm_utf8_counter = dtm_utf8_countAVX2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        dtm_utf8_kernel = dtm_utf8_validateSSE2;
+        dtm_utf8_counter = dtm_utf8_countSSE2;
+    }
+#endif
+}
+
+/**
+ * @brief Checks that len bytes are well formed utf-8
+ *
+ * @return true if buf holds only complete, shortest form sequences of
+ * scalar values, i.e. no surrogates and nothing above U+10FFFF
+ */
+bool dtm_utf8_validate(const char *buf, size_t len)
+{
+    if (len < DTM_UTF8_SHORT)
+        return dtm_utf8_validateScalar(buf, len);
+
+    pthread_once(&utf8_once, dtm_utf8_select);
+    return dtm_utf8_kernel(buf, len);
+}
+
+/**
+ * @brief Counts the code points of len bytes of well formed utf-8
+ *
+ * Only lead bytes are counted, so the result for input that is not well
+ * formed is meaningless; check it with dtm_utf8_validate first.
+ */
+size_t dtm_utf8_count(const char *buf, size_t len)
+{
+    if (len < DTM_UTF8_SHORT)
+        return dtm_utf8_countScalar(buf, len);
+
+    pthread_once(&utf8_once, dtm_utf8_select);
+    return dtm_utf8_counter(buf, len);
+}
@@ -0,0 +1,505 @@
+/*
+ * datum_vector.c
+ *
+ * DatumVector: one column of values of one type, stored contiguously
+ * instead of as an array of individually allocated datums.
+ *
+ *  - integers and doubles live in one typed array,
+ *  - strings and blobs live back to back in one byte buffer, with an
+ *    offsets array marking where each one starts; strings are followed by a
+ *    terminating code unit so that views of them are nul terminated,
+ *  - strings in variable width encodings also keep their character counts,
+ *  - nulls are marked in a bitmap that is only allocated once the first
+ *    null is appended.
+ *
+ * DatumVector_at hands out views: datums whose header lives in caller
+ * storage (Datum_View) and whose payload points into the vector, so random
+ * access neither allocates nor copies.
+ *
+ * Created by: p2hansen
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <datum.h>
+#include "datum_int.h"
+
+_Static_assert(sizeof(struct Datum) <= sizeof(Datum_View), "Datum_View too small for struct Datum");
+
+#define DTM_VEC_INITIAL 64
+
+struct DatumVector {
+    long type;                      /* DATUM_Int, DATUM_Double, DATUM_Str or DATUM_Blob */
+    dtm_encoding_t enc;
+    size_t unit;                    /* terminator size for strings, 0 for blobs */
+    size_t len;
+    size_t cap;                     /* elements room in values/offsets/counts */
+    union {
+        long long *i;
+        double *r;
+        uint32_t *off;              /* len + 1 offsets into data */
+    } values;
+    uint32_t *counts;               /* characters per string, variable width encodings only */
+    char *data;
+    size_t dataLen;
+    size_t dataCap;
+    uint8_t *nulls;                 /* bit set: element is null; NULL while there are none */
+};
+
+static bool dtm_isVariableWidth(dtm_encoding_t enc)
+{
+    return enc == DTM_ENC_UTF8 || enc == DTM_ENC_NONE
+        || enc == DTM_ENC_UTF16 || enc == DTM_ENC_UTF16LE || enc == DTM_ENC_UTF16BE;
+}
+
+/**
+ * @brief Creates a new, empty vector
+ *
+ * @param type DATUM_Int, DATUM_Double, DATUM_Str or DATUM_Blob
+ * @param encoding encoding of the strings, or of the blob content
+ * @return New vector or NULL on invalid type or allocation failure
+ */
+DatumVector_T DatumVector_new(long type, dtm_encoding_t encoding)
+{
+    if (type != DATUM_Int && type != DATUM_Double && type != DATUM_Str && type != DATUM_Blob)
+        return NULL;
+
+    DatumVector_T vec = calloc(1, sizeof(struct DatumVector));
+    if (!vec)
+        return NULL;
+
+    vec->type = type;
+    vec->enc = encoding;
+    vec->unit = (type == DATUM_Str) ? dtm_unitSize(encoding) : 0;
+    return vec;
+}
+
+/**
+ * @brief Releases the vector; views handed out become invalid
+ */
+void DatumVector_free(DatumVector_T *vec)
+{
+    if (!vec || !*vec)
+        return;
+
+    free((*vec)->values.i);
+    free((*vec)->counts);
+    free((*vec)->data);
+    free((*vec)->nulls);
+    free(*vec);
+    *vec = NULL;
+}
+
+size_t DatumVector_length(DatumVector_T vec)
+{
+    return vec ? vec->len : 0;
+}
+
+long DatumVector_getType(DatumVector_T vec)
+{
+    return vec ? vec->type : DATUM_Invalid;
+}
+
+/**
+ * @brief makes room for extra more elements and extraBytes more bytes of data
+ */
+static bool dtm_vecReserve(DatumVector_T vec, size_t extra, size_t extraBytes)
+{
+    size_t need = vec->len + extra;
+    if (need > vec->cap) {
+        size_t cap = vec->cap ? vec->cap : DTM_VEC_INITIAL;
+        while (cap < need)
+            cap *= 2;
+
+        bool offsets = (vec->type == DATUM_Str || vec->type == DATUM_Blob);
+        size_t esize = offsets ? sizeof(uint32_t) : sizeof(long long);
+        void *values = realloc(vec->values.i, (cap + offsets) * esize);
+        if (!values)
+            return false;
+        vec->values.i = values;
+        if (offsets && vec->cap == 0)
+            vec->values.off[0] = 0;
+
+        if (vec->type == DATUM_Str && dtm_isVariableWidth(vec->enc)) {
+            uint32_t *counts = realloc(vec->counts, cap * sizeof(uint32_t));
+            if (!counts)
+                return false;
+            vec->counts = counts;
+        }
+        if (vec->nulls) {
+            uint8_t *nulls = realloc(vec->nulls, (cap + 7) / 8);
+            if (!nulls)
+                return false;
+            memset(nulls + (vec->cap + 7) / 8, 0, (cap + 7) / 8 - (vec->cap + 7) / 8);
+            vec->nulls = nulls;
+        }
+        vec->cap = cap;
+    }
+
+    if (vec->dataLen + extraBytes > vec->dataCap) {
+        size_t cap = vec->dataCap ? vec->dataCap : 1024;
+        while (cap < vec->dataLen + extraBytes)
+            cap *= 2;
+        if (cap > UINT32_MAX)
+            return false;
+        char *data = realloc(vec->data, cap);
+        if (!data)
+            return false;
+        vec->data = data;
+        vec->dataCap = cap;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends a null
+ */
+bool DatumVector_appendNull(DatumVector_T vec)
+{
+    if (!vec || !dtm_vecReserve(vec, 1, 0))
+        return false;
+
+    if (!vec->nulls) {
+        vec->nulls = calloc((vec->cap + 7) / 8, 1);
+        if (!vec->nulls)
+            return false;
+    }
+    size_t i = vec->len++;
+    vec->nulls[i / 8] |= (uint8_t)(1 << (i % 8));
+
+    switch (vec->type) {
+        case DATUM_Int:    vec->values.i[i] = 0; break;
+        case DATUM_Double: vec->values.r[i] = 0; break;
+        default:
+            vec->values.off[i + 1] = (uint32_t)vec->dataLen;
+            if (vec->counts)
+                vec->counts[i] = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends n integers in one go
+ */
+bool DatumVector_appendIntegers(DatumVector_T vec, const long long *vals, size_t n)
+{
+    if (!vec || vec->type != DATUM_Int || (!vals && n) || !dtm_vecReserve(vec, n, 0))
+        return false;
+
+    memcpy(vec->values.i + vec->len, vals, n * sizeof(long long));
+    vec->len += n;
+    return true;
+}
+
+/**
+ * @brief Appends n doubles in one go
+ */
+bool DatumVector_appendDoubles(DatumVector_T vec, const double *vals, size_t n)
+{
+    if (!vec || vec->type != DATUM_Double || (!vals && n) || !dtm_vecReserve(vec, n, 0))
+        return false;
+
+    memcpy(vec->values.r + vec->len, vals, n * sizeof(double));
+    vec->len += n;
+    return true;
+}
+
+bool DatumVector_appendInteger(DatumVector_T vec, long long val)
+{
+    return DatumVector_appendIntegers(vec, &val, 1);
+}
+
+bool DatumVector_appendDouble(DatumVector_T vec, double val)
+{
+    return DatumVector_appendDoubles(vec, &val, 1);
+}
+
+/**
+ * @brief ends the element whose sz bytes have been written at the end of data
+ */
+static void dtm_vecCommit(DatumVector_T vec, size_t sz, size_t n)
+{
+    size_t i = vec->len++;
+
+    memset(vec->data + vec->dataLen + sz, 0, vec->unit);
+    vec->dataLen += sz + vec->unit;
+    vec->values.off[i + 1] = (uint32_t)vec->dataLen;
+    if (vec->counts)
+        vec->counts[i] = (uint32_t)n;
+}
+
+/**
+ * @brief appends one string or blob of sz bytes that has been checked already
+ */
+static void dtm_vecPush(DatumVector_T vec, const char *bytes, size_t sz, size_t n)
+{
+    memcpy(vec->data + vec->dataLen, bytes, sz);
+    dtm_vecCommit(vec, sz, n);
+}
+
+/**
+ * @brief appends the string of a datum kept in another encoding, converted
+ * into the vector's
+ *
+ * @return false if a character has no place in the vector's encoding
+ */
+static bool dtm_vecPushConverted(DatumVector_T vec, Datum_T d)
+{
+    size_t sz = dtm_transcode(dtm_textEnc(d), vec->enc, dtm_bytes(d), dtm_sz(d),
+                              vec->data + vec->dataLen, NULL);
+    if (sz == (size_t)-1)
+        return false;
+    dtm_vecCommit(vec, sz, dtm_n(d));
+    return true;
+}
+
+/**
+ * @brief takes the vector back to its first len elements
+ */
+static void dtm_vecTruncate(DatumVector_T vec, size_t len)
+{
+    if (vec->nulls)
+        for (size_t i = len; i < vec->len; i++)
+            vec->nulls[i / 8] &= (uint8_t)~(1 << (i % 8));
+    vec->len = len;
+    if (vec->type == DATUM_Str || vec->type == DATUM_Blob)
+        vec->dataLen = vec->values.off[len];
+}
+
+#define DTM_VEC_CHUNK 256
+
+/**
+ * @brief Appends n strings (or blobs) in one go
+ *
+ * Strings are checked against the vector's encoding as in Datum_asString;
+ * nothing is appended if one of them is not valid. A NULL entry in strs
+ * appends a null.
+ *
+ * @param strs the strings
+ * @param lens their lengths in bytes, -1 for nul terminated; NULL when all
+ * are nul terminated
+ * @param n number of strings
+ */
+bool DatumVector_appendStrings(DatumVector_T vec, const char *const *strs, const int *lens, size_t n)
+{
+    size_t sz[DTM_VEC_CHUNK], cnt[DTM_VEC_CHUNK];
+
+    if (!vec || (vec->type != DATUM_Str && vec->type != DATUM_Blob) || (!strs && n))
+        return false;
+
+    /* measure a chunk, make room for it, then copy it in */
+    size_t start = vec->len;
+    for (size_t base = 0; base < n; base += DTM_VEC_CHUNK) {
+        size_t m = (n - base < DTM_VEC_CHUNK) ? n - base : DTM_VEC_CHUNK;
+        size_t total = 0;
+
+        for (size_t k = 0; k < m; k++) {
+            const char *str = strs[base + k];
+            int len = lens ? lens[base + k] : -1;
+            if (!str)
+                continue;
+            if (vec->type == DATUM_Str)
+                sz[k] = dtm_strMeasure(str, len, vec->enc, &cnt[k]);
+            else
+                sz[k] = (len < 0) ? (size_t)-1 : (size_t)len;
+            if (sz[k] == (size_t)-1) {
+                dtm_vecTruncate(vec, start);
+                return false;
+            }
+            total += sz[k] + vec->unit;
+        }
+        if (!dtm_vecReserve(vec, m, total)) {
+            dtm_vecTruncate(vec, start);
+            return false;
+        }
+        for (size_t k = 0; k < m; k++) {
+            if (strs[base + k])
+                dtm_vecPush(vec, strs[base + k], sz[k], cnt[k]);
+            else
+                DatumVector_appendNull(vec);
+        }
+    }
+    return true;
+}
+
+bool DatumVector_appendString(DatumVector_T vec, const char *str, int len)
+{
+    return str ? DatumVector_appendStrings(vec, &str, &len, 1) : false;
+}
+
+/**
+ * @brief Appends the values of n datums
+ *
+ * Null datums append nulls. Integers go into integer and double vectors,
+ * doubles into double vectors, blobs into blob vectors of the same encoding
+ * and strings into string vectors. A string kept in another encoding than
+ * the vector's, such as utf-16 text that Datum_asString narrowed, is
+ * converted when dtm_transcode knows both encodings. Nothing is appended if
+ * a datum does not fit.
+ */
+bool DatumVector_appendDatums(DatumVector_T vec, Datum_T *dtms, size_t n)
+{
+    size_t total = 0, start = vec ? vec->len : 0;
+    if (!vec || (!dtms && n))
+        return false;
+
+    for (size_t k = 0; k < n; k++) {
+        Datum_T d = dtms[k];
+        if (!Datum_isDatum(d))
+            return false;
+        if (d->flags & DATUM_Null)
+            continue;
+        switch (vec->type) {
+            case DATUM_Int:
+                if (!(d->flags & DATUM_Int)) return false;
+                break;
+            case DATUM_Double:
+                if (!(d->flags & (DATUM_Int | DATUM_Double))) return false;
+                break;
+            case DATUM_Blob:
+                if (!(d->flags & DATUM_Blob) || dtm_enc(d) != vec->enc)
+                    return false;
+                total += dtm_sz(d);
+                break;
+            default:
+                if (!(d->flags & DATUM_Str) || !dtm_ready(d))
+                    return false;
+                if (dtm_enc(d) == vec->enc)
+                    total += dtm_sz(d) + vec->unit;
+                else if (dtm_transcodable(vec->enc) && dtm_transcodable(dtm_textEnc(d)))
+                    total += dtm_transcodeBound(dtm_textEnc(d), vec->enc, dtm_sz(d)) + vec->unit;
+                else
+                    return false;
+        }
+    }
+    if (!dtm_vecReserve(vec, n, total))
+        return false;
+
+    for (size_t k = 0; k < n; k++) {
+        Datum_T d = dtms[k];
+        if (d->flags & DATUM_Null) {
+            DatumVector_appendNull(vec);
+            continue;
+        }
+        switch (vec->type) {
+            case DATUM_Int:    vec->values.i[vec->len++] = d->value.i; break;
+            case DATUM_Double: vec->values.r[vec->len++] = Datum_getAsDouble(d); break;
+            default:
+                if (vec->type == DATUM_Blob || dtm_enc(d) == vec->enc)
+                    dtm_vecPush(vec, dtm_bytes(d), dtm_sz(d), dtm_n(d));
+                else if (!dtm_vecPushConverted(vec, d)) {
+                    dtm_vecTruncate(vec, start);
+                    return false;
+                }
+        }
+    }
+    return true;
+}
+
+bool DatumVector_isNull(DatumVector_T vec, size_t i)
+{
+    return vec && i < vec->len && vec->nulls && (vec->nulls[i / 8] >> (i % 8)) & 1;
+}
+
+/**
+ * @brief Returns a view of element i
+ *
+ * The view is a datum whose header lives in *view and whose payload points
+ * into the vector. It can be used like any other datum until the vector is
+ * changed or freed; Datum_free on it does nothing but clear the pointer,
+ * and Datum_copy gives an independent datum.
+ *
+ * @param vec the vector
+ * @param i index of the element
+ * @param view storage for the view's header
+ * @return the view, or NULL if i is out of range
+ */
+Datum_T DatumVector_at(DatumVector_T vec, size_t i, Datum_View *view)
+{
+    if (!vec || !view || i >= vec->len)
+        return NULL;
+
+    Datum_T d = (Datum_T)view;
+    memset(d, 0, sizeof(struct Datum));
+    dtm_init(d);
+    d->flags |= DATUM_Arena;
+
+    if (DatumVector_isNull(vec, i)) {
+        d->flags |= DATUM_Null;
+        return d;
+    }
+    switch (vec->type) {
+        case DATUM_Int:
+            d->flags |= DATUM_Int;
+            d->value.i = vec->values.i[i];
+            break;
+        case DATUM_Double:
+            d->flags |= DATUM_Double;
+            d->value.r = vec->values.r[i];
+            break;
+        default: {
+            size_t start = vec->values.off[i];
+            size_t sz = vec->values.off[i + 1] - start - vec->unit;
+            d->flags |= vec->type | DATUM_Ephem | (vec->unit ? DATUM_Term : 0);
+            d->value.z = vec->data + start;
+            dtm_setEnc(d, vec->enc);
+            dtm_setSize(d, sz, vec->counts ? vec->counts[i]
+                             : (vec->type == DATUM_Str ? sz / vec->unit : sz));
+        }
+    }
+    return d;
+}
+
+/**
+ * @brief Returns the integers of an integer vector, nulls read as 0
+ */
+const long long *DatumVector_integers(DatumVector_T vec)
+{
+    return (vec && vec->type == DATUM_Int) ? vec->values.i : NULL;
+}
+
+/**
+ * @brief Returns the doubles of a double vector, nulls read as 0
+ */
+const double *DatumVector_doubles(DatumVector_T vec)
+{
+    return (vec && vec->type == DATUM_Double) ? vec->values.r : NULL;
+}
+
+/**
+ * @brief Returns the bytes of a string or blob vector and the len + 1
+ * offsets into them; element i spans offsets[i] to offsets[i + 1], strings
+ * including their terminator
+ */
+const char *DatumVector_bytes(DatumVector_T vec, const uint32_t **offsets)
+{
+    if (!vec || (vec->type != DATUM_Str && vec->type != DATUM_Blob))
+        return NULL;
+
+    if (offsets)
+        *offsets = vec->values.off;
+    return vec->data;
+}
+
+/**
+ * @brief Creates independent datums of count elements starting at from
+ *
+ * @param out receives count new datums, owned by the caller
+ * @return number of datums written, less than count on allocation failure
+ * or when the range runs past the end
+ */
+size_t DatumVector_toDatums(DatumVector_T vec, size_t from, size_t count, Datum_T *out)
+{
+    Datum_View view;
+    size_t k;
+
+    if (!vec || !out)
+        return 0;
+
+    for (k = 0; k < count && from + k < vec->len; k++) {
+        out[k] = Datum_copy(DatumVector_at(vec, from + k, &view));
+        if (!out[k])
+            break;
+    }
+    return k;
+}
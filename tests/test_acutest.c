@@ -1,3 +1,9 @@
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <limits.h>
+#include <pthread.h>
+#include <wchar.h>
 #include "acutest.h"
 #include "datum.h"
 
@@ -15,8 +21,1290 @@ static void test_invalid_pointer(void) {
     Datum_free(NULL);  // Skal ikke kræsje
 }
 
+static void test_numbers(void) {
+    Datum_T i = Datum_asInteger(-42);
+    Datum_T r = Datum_asDouble(2.5);
+
+    TEST_CHECK(Datum_isInteger(i) && !Datum_isDouble(i));
+    TEST_CHECK(Datum_getAsInteger(i) == -42);
+    TEST_CHECK(Datum_getAsDouble(i) == -42.0);
+    TEST_CHECK(Datum_getAsDouble(r) == 2.5);
+    TEST_CHECK(Datum_getAsInteger(r) == 2);
+    TEST_CHECK(Datum_getType(r) == DATUM_Double);
+    TEST_CHECK(Datum_getSize(i) == sizeof(long long));
+
+    Datum_free(&i);
+    Datum_free(&r);
+}
+
+static void test_string(void) {
+    Datum_T d = Datum_asString("bl\xc3\xa5" "b\xc3\xa6r", -1, DTM_ENC_UTF8);
+
+    TEST_ASSERT(d != NULL);
+    TEST_CHECK(Datum_isString(d));
+    TEST_CHECK(Datum_getSize(d) == 8);
+    TEST_CHECK(Datum_getEncoding(d) == DTM_ENC_UTF8);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(d, DTM_ENC_UTF8), "bl\xc3\xa5" "b\xc3\xa6r") == 0);
+    Datum_free(&d);
+
+    TEST_CHECK(Datum_asString("\xc3\x28", 2, DTM_ENC_UTF8) == NULL);
+    TEST_CHECK(Datum_asString("\xe5", 1, DTM_ENC_ASCII) == NULL);
+
+    d = Datum_asString("abc", 3, DTM_ENC_ASCII);
+    TEST_CHECK(Datum_getAsString(d, DTM_ENC_ISO8859_15) != NULL);
+    Datum_free(&d);
+}
+
+static void test_blob_and_datums(void) {
+    unsigned char bytes[] = { 0, 1, 2, 0xff };
+    Datum_T b = Datum_asBLOB(bytes, sizeof bytes, DTM_ENC_NONE);
+
+    TEST_ASSERT(b != NULL);
+    TEST_CHECK(Datum_isBlob(b));
+    TEST_CHECK(Datum_getSize(b) == 4);
+    TEST_CHECK(memcmp(Datum_getAsBlob(b), bytes, 4) == 0);
+
+    Datum_T items[] = { b, Datum_asInteger(7) };
+    Datum_T arr = Datum_asDatums(items, 2);
+    TEST_ASSERT(arr != NULL);
+    TEST_CHECK(Datum_isDatums(arr));
+    TEST_CHECK(Datum_getAsDatums(arr)[1] == items[1]);
+    TEST_CHECK(Datum_getAsDatums(arr)[2] == NULL);
+    Datum_free(&arr);
+}
+
+static void test_locked(void) {
+    Datum_T d = Datum_asInteger(1);
+
+    TEST_CHECK(!Datum_isLocked(d));
+    TEST_CHECK(Datum_toggleLocked(d) == 1);
+    TEST_CHECK(Datum_isLocked(d));
+    TEST_CHECK(Datum_getAsInteger(d) == 1);
+    TEST_CHECK(Datum_toggleLocked(d) == 0);
+    Datum_free(&d);
+}
+
+static void test_slab_reuse(void) {
+    Datum_AllocStats before, after;
+    Datum_T d = Datum_asInteger(1);
+
+    Datum_free(&d);
+    Datum_getAllocStats(&before);
+    d = Datum_asInteger(2);
+    Datum_getAllocStats(&after);
+    TEST_CHECK(after.allocs == before.allocs + 1);
+#ifndef DATUM_NO_SLAB
+    TEST_CHECK(after.hits == before.hits + 1);
+    TEST_CHECK(after.sysAllocs == before.sysAllocs);
+#endif
+    Datum_free(&d);
+}
+
+#define CHURN 20000
+
+static void *churn(void *arg) {
+    Datum_T *dtms = arg;
+    long long sum = 0;
+
+    /* frees what another thread allocated, then allocates its own */
+    for (int i = 0; i < CHURN; i++) {
+        sum += Datum_getAsInteger(dtms[i]);
+        Datum_free(&dtms[i]);
+    }
+    for (int i = 0; i < CHURN; i++)
+        dtms[i] = Datum_asString("x", 1, DTM_ENC_ASCII);
+    for (int i = 0; i < CHURN; i++)
+        Datum_free(&dtms[i]);
+    return (void *)(intptr_t)(sum == (long long)CHURN * (CHURN - 1) / 2);
+}
+
+static void test_slab_threads(void) {
+    static Datum_T dtms[4][CHURN];
+    pthread_t th[4];
+    void *ok;
+
+    for (int t = 0; t < 4; t++)
+        for (int i = 0; i < CHURN; i++)
+            dtms[t][i] = Datum_asInteger(i);
+    for (int t = 0; t < 4; t++)
+        pthread_create(&th[t], NULL, churn, dtms[t]);
+    for (int t = 0; t < 4; t++) {
+        pthread_join(th[t], &ok);
+        TEST_CHECK(ok != NULL);
+    }
+}
+
+static void test_arena(void) {
+    Datum_Arena_T arena = Datum_Arena_new(1024);
+    Datum_T dtms[500];
+
+    TEST_ASSERT(arena != NULL);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 500; i++)
+            dtms[i] = (i % 2) ? Datum_asInteger_in(arena, i)
+                              : Datum_asString_in(arena, "Troms\xc3\xb8", -1, DTM_ENC_UTF8);
+        TEST_CHECK(Datum_getAsInteger(dtms[499]) == 499);
+        TEST_CHECK(strcmp((char *)Datum_getAsString(dtms[0], DTM_ENC_UTF8), "Troms\xc3\xb8") == 0);
+        TEST_CHECK(Datum_getSize(dtms[0]) == 7);
+        TEST_CHECK(Datum_asString_in(arena, "\xff", 1, DTM_ENC_UTF8) == NULL);
+        TEST_CHECK(Datum_Arena_used(arena) > 0);
+
+        /* Datum_free leaves the memory to the arena */
+        Datum_free(&dtms[1]);
+        TEST_CHECK(dtms[1] == NULL);
+
+        Datum_Arena_reset(arena);
+        TEST_CHECK(Datum_Arena_used(arena) == 0);
+    }
+
+    /* bigger than a block */
+    char big[4000];
+    memset(big, 'a', sizeof big);
+    Datum_T d = Datum_asBLOB_in(arena, big, sizeof big, DTM_ENC_NONE);
+    TEST_CHECK(Datum_getSize(d) == sizeof big);
+    Datum_Arena_free(&arena);
+    TEST_CHECK(arena == NULL);
+}
+
+static void test_inline_string(void) {
+    Datum_AllocStats before, after;
+    const char *longer = "Kautokeino kommune, Finnmark fylke";
+
+    Datum_getAllocStats(&before);
+    Datum_T s = Datum_asString("Alta", -1, DTM_ENC_UTF8);
+    Datum_T l = Datum_asString(longer, -1, DTM_ENC_UTF8);
+    Datum_getAllocStats(&after);
+
+#ifndef DATUM_NO_INLINE
+    /* the short one needs its header only, the long one a payload as well */
+    TEST_CHECK(after.allocs - before.allocs == 3);
+#endif
+    TEST_CHECK(strcmp((char *)Datum_getAsString(s, DTM_ENC_UTF8), "Alta") == 0);
+    TEST_CHECK(Datum_getSize(s) == 4);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(l, DTM_ENC_UTF8), longer) == 0);
+    TEST_CHECK(Datum_getSize(l) == (long)strlen(longer));
+    Datum_free(&s);
+    Datum_free(&l);
+
+    wchar_t w[] = L"\u00c5s";
+    Datum_T dw = Datum_asStringW(w, -1);
+    TEST_CHECK(wcscmp(Datum_getAsStringW(dw), w) == 0);
+    Datum_free(&dw);
+}
+
+static void test_equal(void) {
+    Datum_T a = Datum_asInteger(3), b = Datum_asDouble(3.0), c = Datum_asDouble(3.5);
+    Datum_T s1 = Datum_asString("Bod\xc3\xb8", -1, DTM_ENC_UTF8);
+    Datum_T s2 = Datum_asString("Bod\xc3\xb8", -1, DTM_ENC_UTF8);
+    Datum_T s3 = Datum_asString("Bodo", -1, DTM_ENC_UTF8);
+
+    TEST_CHECK(Datum_isEqual(a, b));
+    TEST_CHECK(!Datum_isEqual(a, c));
+    TEST_CHECK(Datum_isEqual(s1, s2));
+    TEST_CHECK(!Datum_isEqual(s1, s3));
+    TEST_CHECK(!Datum_isEqual(s1, a));
+    TEST_CHECK(!Datum_isEqual(s1, NULL));
+
+    Datum_free(&a); Datum_free(&b); Datum_free(&c);
+    Datum_free(&s1); Datum_free(&s2); Datum_free(&s3);
+}
+
+static void test_intern(void) {
+    const char *name = "Nordre Follo kommune i Akershus";
+    Datum_T a = Datum_intern(Datum_asString(name, -1, DTM_ENC_UTF8));
+    Datum_T b = Datum_intern(Datum_asString(name, -1, DTM_ENC_UTF8));
+    Datum_T c = Datum_intern(Datum_asString("Moss", -1, DTM_ENC_UTF8));
+    Datum_T d = Datum_intern(Datum_asString("Moss", -1, DTM_ENC_UTF8));
+    Datum_T e = Datum_intern(Datum_asString("Moss", -1, DTM_ENC_ISO8859_15));
+
+    TEST_CHECK(Datum_isInterned(a) && Datum_isInterned(c));
+    TEST_CHECK(Datum_getAsString(a, DTM_ENC_UTF8) == Datum_getAsString(b, DTM_ENC_UTF8));
+    TEST_CHECK(Datum_getAsString(c, DTM_ENC_UTF8) == Datum_getAsString(d, DTM_ENC_UTF8));
+    TEST_CHECK(strcmp((char *)Datum_getAsString(c, DTM_ENC_UTF8), "Moss") == 0);
+    TEST_CHECK(Datum_getSize(c) == 4);
+    TEST_CHECK(Datum_isEqual(a, b));
+    TEST_CHECK(!Datum_isEqual(a, c));
+    /* one payload per encoding, the same text */
+    TEST_CHECK(Datum_getEncoding(e) == DTM_ENC_ISO8859_15);
+    TEST_CHECK(Datum_isEqual(c, e));
+
+    Datum_free(&a); Datum_free(&b); Datum_free(&c); Datum_free(&d); Datum_free(&e);
+}
+
+static void *intern_many(void *arg) {
+    char buf[32];
+    const char **first = arg;
+
+    for (int i = 0; i < 5000; i++) {
+        snprintf(buf, sizeof buf, "kommune %d", i % 500);
+        Datum_T d = Datum_intern(Datum_asString(buf, -1, DTM_ENC_UTF8));
+        if (i == 7)
+            *first = (const char *)Datum_getAsString(d, DTM_ENC_UTF8);
+        Datum_free(&d);
+    }
+    return NULL;
+}
+
+static void test_intern_threads(void) {
+    pthread_t th[4];
+    const char *first[4];
+
+    for (int t = 0; t < 4; t++)
+        pthread_create(&th[t], NULL, intern_many, &first[t]);
+    for (int t = 0; t < 4; t++)
+        pthread_join(th[t], NULL);
+    for (int t = 1; t < 4; t++)
+        TEST_CHECK(first[t] == first[0]);
+}
+
+static void test_copy_shares(void) {
+    char big[1000];
+    memset(big, 'x', sizeof big);
+    Datum_T b = Datum_asBLOB(big, sizeof big, DTM_ENC_NONE);
+    Datum_T s = Datum_asString("Longyearbyen, Svalbard og Jan Mayen", -1, DTM_ENC_UTF8);
+    Datum_T i = Datum_asInteger(11);
+
+    Datum_T bc = Datum_copy(b), sc = Datum_copy(s), ic = Datum_copy(i);
+    TEST_CHECK(Datum_getAsBlob(bc) == Datum_getAsBlob(b));
+    TEST_CHECK(Datum_getAsString(sc, DTM_ENC_UTF8) == Datum_getAsString(s, DTM_ENC_UTF8));
+    TEST_CHECK(Datum_isEqual(ic, i) && ic != i);
+
+    /* the payload lives on in the copies */
+    Datum_free(&b);
+    Datum_free(&s);
+    TEST_CHECK(memcmp(Datum_getAsBlob(bc), big, sizeof big) == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(sc, DTM_ENC_UTF8), "Longyearbyen, Svalbard og Jan Mayen") == 0);
+    Datum_free(&bc);
+    Datum_free(&sc);
+    Datum_free(&i);
+    Datum_free(&ic);
+
+    Datum_T items[] = { Datum_asInteger(1), Datum_asString("to", 2, DTM_ENC_UTF8) };
+    Datum_T arr = Datum_asDatums(items, 2);
+    Datum_T arrc = Datum_copy(arr);
+    TEST_CHECK(Datum_getAsDatums(arrc) == Datum_getAsDatums(arr));
+    Datum_free(&arr);
+    TEST_CHECK(Datum_getAsInteger(Datum_getAsDatums(arrc)[0]) == 1);
+    Datum_free(&arrc);
+}
+
+static void test_copy_from_arena(void) {
+    Datum_Arena_T arena = Datum_Arena_new(0);
+    Datum_T a = Datum_asString_in(arena, "Hammerfest og Kvalsund kommuner", -1, DTM_ENC_UTF8);
+    Datum_T c = Datum_copy(a);
+
+    Datum_Arena_free(&arena);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(c, DTM_ENC_UTF8), "Hammerfest og Kvalsund kommuner") == 0);
+    Datum_free(&c);
+}
+
+static void *copy_and_free(void *arg) {
+    Datum_T src = arg;
+    for (int i = 0; i < 10000; i++) {
+        Datum_T c = Datum_copy(src);
+        Datum_free(&c);
+    }
+    return NULL;
+}
+
+static void test_copy_threads(void) {
+    pthread_t th[4];
+    char big[600];
+    memset(big, 'y', sizeof big);
+    Datum_T src = Datum_asBLOB(big, sizeof big, DTM_ENC_NONE);
+
+    for (int t = 0; t < 4; t++)
+        pthread_create(&th[t], NULL, copy_and_free, src);
+    for (int t = 0; t < 4; t++)
+        pthread_join(th[t], NULL);
+    TEST_CHECK(((char *)Datum_getAsBlob(src))[599] == 'y');
+    Datum_free(&src);
+}
+
+static void test_borrowed(void) {
+    static const char lit[] = "Karasjok";
+    char record[] = "0301;Oslo kommune sentrum;2025";
+    Datum_AllocStats before, after;
+
+    Datum_T st = Datum_asStringStatic(lit, -1, DTM_ENC_UTF8);
+    TEST_CHECK((const char *)Datum_getAsString(st, DTM_ENC_UTF8) == lit);
+
+    Datum_getAllocStats(&before);
+    Datum_T fld = Datum_asStringBorrowed(record + 5, 20, DTM_ENC_UTF8);
+    Datum_getAllocStats(&after);
+    TEST_CHECK(after.allocs - before.allocs == 1);      /* the header only */
+    TEST_CHECK((char *)Datum_getAsString(fld, DTM_ENC_UTF8) == record + 5);
+    TEST_CHECK(Datum_getSize(fld) == 20);
+    TEST_CHECK(Datum_asStringBorrowed("\xc3", 1, DTM_ENC_UTF8) == NULL);
+
+    /* copies of a borrowed string own their bytes, static ones may share */
+    Datum_T fc = Datum_copy(fld);
+    Datum_T sc = Datum_copy(st);
+    TEST_CHECK((const char *)Datum_getAsString(sc, DTM_ENC_UTF8) == lit);
+    TEST_CHECK((char *)Datum_getAsString(fc, DTM_ENC_UTF8) != record + 5);
+
+    Datum_T blob = Datum_asBLOBBorrowed(record, 4, DTM_ENC_NONE);
+    TEST_CHECK(Datum_getAsBlob(blob) == record);
+    TEST_CHECK(Datum_promote(blob) == blob);
+    TEST_CHECK(Datum_promote(fld) == fld);
+    memset(record, '#', sizeof record - 1);
+    TEST_CHECK(memcmp(Datum_getAsBlob(blob), "0301", 4) == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(fld, DTM_ENC_UTF8), "Oslo kommune sentrum") == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(fc, DTM_ENC_UTF8), "Oslo kommune sentrum") == 0);
+
+    Datum_free(&st); Datum_free(&fld); Datum_free(&fc); Datum_free(&sc); Datum_free(&blob);
+}
+
+static void test_vector_numbers(void) {
+    long long ints[1000];
+    Datum_View view;
+
+    for (int i = 0; i < 1000; i++)
+        ints[i] = i * 7;
+
+    DatumVector_T vec = DatumVector_new(DATUM_Int, DTM_ENC_NONE);
+    TEST_CHECK(DatumVector_appendIntegers(vec, ints, 1000));
+    TEST_CHECK(DatumVector_appendNull(vec));
+    TEST_CHECK(DatumVector_appendInteger(vec, -1));
+    TEST_CHECK(!DatumVector_appendDouble(vec, 1.5));
+    TEST_CHECK(DatumVector_length(vec) == 1002);
+    TEST_CHECK(DatumVector_integers(vec)[999] == 6993);
+    TEST_CHECK(DatumVector_isNull(vec, 1000) && !DatumVector_isNull(vec, 1001));
+
+    Datum_T v = DatumVector_at(vec, 10, &view);
+    TEST_CHECK(Datum_isInteger(v) && Datum_getAsInteger(v) == 70);
+    TEST_CHECK(Datum_isNull(DatumVector_at(vec, 1000, &view)));
+    TEST_CHECK(DatumVector_at(vec, 1002, &view) == NULL);
+    Datum_free(&v);
+    TEST_CHECK(v == NULL);
+
+    Datum_T dtms[3] = { Datum_asInteger(5), Datum_asDouble(2.5), Datum_asNull() };
+    DatumVector_T dbl = DatumVector_new(DATUM_Double, DTM_ENC_NONE);
+    TEST_CHECK(!DatumVector_appendDatums(vec, dtms, 3));     /* the double does not fit */
+    TEST_CHECK(DatumVector_length(vec) == 1002);
+    TEST_CHECK(DatumVector_appendDatums(dbl, dtms, 3));
+    TEST_CHECK(DatumVector_doubles(dbl)[0] == 5.0 && DatumVector_doubles(dbl)[1] == 2.5);
+    TEST_CHECK(DatumVector_isNull(dbl, 2));
+
+    for (int i = 0; i < 3; i++)
+        Datum_free(&dtms[i]);
+    DatumVector_free(&vec);
+    DatumVector_free(&dbl);
+    TEST_CHECK(vec == NULL);
+}
+
+static void test_vector_strings(void) {
+    const char *names[] = { "Oslo", NULL, "Troms\xc3\xb8", "", "Lillestr\xc3\xb8m kommune i Viken fylke" };
+    const char *bad[] = { "Bod\xc3\xb8", "\xc3" };
+    const uint32_t *off;
+    Datum_View view;
+    Datum_T out[5];
+
+    DatumVector_T vec = DatumVector_new(DATUM_Str, DTM_ENC_UTF8);
+    TEST_CHECK(DatumVector_appendStrings(vec, names, NULL, 5));
+    TEST_CHECK(!DatumVector_appendStrings(vec, bad, NULL, 2));
+    TEST_CHECK(DatumVector_length(vec) == 5);
+    TEST_CHECK(DatumVector_isNull(vec, 1));
+
+    Datum_T v = DatumVector_at(vec, 2, &view);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(v, DTM_ENC_UTF8), "Troms\xc3\xb8") == 0);
+    TEST_CHECK(Datum_getSize(v) == 7);
+
+    const char *bytes = DatumVector_bytes(vec, &off);
+    TEST_CHECK(strcmp(bytes + off[4], names[4]) == 0);
+    TEST_CHECK(off[1] == off[2]);
+
+    /* the copies outlive the vector */
+    TEST_CHECK(DatumVector_toDatums(vec, 0, 10, out) == 5);
+    DatumVector_free(&vec);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(out[0], DTM_ENC_UTF8), "Oslo") == 0);
+    TEST_CHECK(Datum_isNull(out[1]));
+    TEST_CHECK(strcmp((char *)Datum_getAsString(out[4], DTM_ENC_UTF8), names[4]) == 0);
+    for (int i = 0; i < 5; i++)
+        Datum_free(&out[i]);
+
+    /* blobs carry their exact bytes, no terminator */
+    DatumVector_T blobs = DatumVector_new(DATUM_Blob, DTM_ENC_NONE);
+    TEST_CHECK(DatumVector_appendString(blobs, "\0\1\2", 3));
+    TEST_CHECK(!DatumVector_appendString(blobs, "abc", -1));
+    v = DatumVector_at(blobs, 0, &view);
+    TEST_CHECK(Datum_isBlob(v) && Datum_getSize(v) == 3);
+    TEST_CHECK(memcmp(Datum_getAsBlob(v), "\0\1\2", 3) == 0);
+    DatumVector_free(&blobs);
+
+    /* utf-16 in a fixed byte order counts a surrogate pair as one character */
+    const char le[] = "\x3d\xd8\x00\xde" "a\0";
+    int leLen = 6;
+    const char *les[] = { le };
+    DatumVector_T wide = DatumVector_new(DATUM_Str, DTM_ENC_UTF16LE);
+    TEST_CHECK(DatumVector_appendStrings(wide, les, &leLen, 1));
+    v = DatumVector_at(wide, 0, &view);
+    TEST_CHECK(Datum_getSize(v) == 6);
+    TEST_CHECK(Datum_getLength(v) == 2);
+    TEST_CHECK(Datum_getCharAt(v, 0) == 0x1f600 && Datum_getCharAt(v, 1) == 'a');
+    DatumVector_free(&wide);
+}
+
+/* reference check, one code point at a time as in Unicode Table 3-7 */
+static bool ref_utf8(const unsigned char *s, size_t len) {
+    for (size_t i = 0; i < len; ) {
+        unsigned c = s[i], n, cp, min;
+        if (c < 0x80) { i++; continue; }
+        else if ((c & 0xe0) == 0xc0) { n = 2; cp = c & 0x1f; min = 0x80; }
+        else if ((c & 0xf0) == 0xe0) { n = 3; cp = c & 0x0f; min = 0x800; }
+        else if ((c & 0xf8) == 0xf0) { n = 4; cp = c & 0x07; min = 0x10000; }
+        else return false;
+        if (len - i < n) return false;
+        for (unsigned k = 1; k < n; k++) {
+            if ((s[i + k] & 0xc0) != 0x80) return false;
+            cp = (cp << 6) | (s[i + k] & 0x3f);
+        }
+        if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return false;
+        i += n;
+    }
+    return true;
+}
+
+static void test_utf8_validate(void) {
+    static const char *bad[] = {
+        "\xc0\xaf", "\xe0\x80\xaf", "\xf0\x80\x80\xaf",      /* overlong '/' */
+        "\xed\xa0\x80", "\xed\xbf\xbf",                       /* surrogates */
+        "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xff",      /* too large */
+        "\x80", "\xc3", "\xe2\x82", "\xc3\xa5\xa5",             /* stray and missing continuations */
+    };
+    char buf[256];
+
+    /* every placement of each bad sequence in a long ASCII/Nordic string */
+    for (size_t b = 0; b < sizeof bad / sizeof bad[0]; b++) {
+        size_t blen = strlen(bad[b]);
+        for (size_t at = 0; at + blen <= 100; at++) {
+            memset(buf, 'a', 100);
+            memcpy(buf, "Troms\xc3\xb8 og Finnmark", 19);
+            memcpy(buf + at, bad[b], blen);
+            Datum_T d = Datum_asString(buf, 100, DTM_ENC_UTF8);
+            TEST_CHECK((d != NULL) == ref_utf8((unsigned char *)buf, 100));
+            Datum_free(&d);
+        }
+        /* cut short exactly at the end of a 32 and 64 byte buffer */
+        memset(buf, 'a', 64);
+        memcpy(buf + 64 - blen, bad[b], blen);
+        TEST_CHECK(Datum_asString(buf, 64, DTM_ENC_UTF8) == NULL);
+        TEST_CHECK(Datum_asString(buf + 32, 32, DTM_ENC_UTF8) == NULL);
+    }
+
+    /* random mixes of valid sequences and noise against the reference */
+    static const char *pieces[] = { "a", "\xc3\xb8", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+                                    "\xef\xbf\xbf", "\xf4\x8f\xbf\xbf", "\xc2\x80", "0123456789abcdef" };
+    unsigned seed = 2026;
+    for (int round = 0; round < 20000; round++) {
+        size_t len = 0;
+        while (len < 200) {
+            seed = seed * 1103515245 + 12345;
+            const char *p = pieces[(seed >> 16) % 8];
+            size_t plen = strlen(p);
+            if (len + plen > sizeof buf) break;
+            memcpy(buf + len, p, plen);
+            len += plen;
+        }
+        if (round % 2) {
+            seed = seed * 1103515245 + 12345;
+            buf[(seed >> 8) % len] = (char)(seed >> 20);
+        }
+        Datum_T d = Datum_asString(buf, (int)len, DTM_ENC_UTF8);
+        TEST_CHECK((d != NULL) == ref_utf8((unsigned char *)buf, len));
+        Datum_free(&d);
+    }
+}
+
+static void test_length(void) {
+    const char *sami = "\xc4\x8c\xc3\xa1hcesuolu";                 /* Čáhcesuolu */
+    char longer[200];
+    Datum_View view;
+
+    Datum_T s = Datum_asString(sami, -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getLength(s) == 10);
+    TEST_CHECK(Datum_getSize(s) == 12);
+
+    /* long enough for the SIMD counter, with a tail */
+    for (int i = 0; i < 50; i++)
+        memcpy(longer + 3 * i, "\xe2\x82\xac", 3);                 /* € */
+    memcpy(longer + 150, "kr", 2);
+    Datum_T l = Datum_asString(longer, 152, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getLength(l) == 52);
+
+    Datum_T w = Datum_asStringW(L"Troms\u00f8", -1);
+    TEST_CHECK(Datum_getLength(w) == 6);
+    Datum_T b = Datum_asBLOB("\xc3\xb8\0", 3, DTM_ENC_NONE);
+    TEST_CHECK(Datum_getLength(b) == 3);
+    Datum_T i = Datum_asInteger(42);
+    TEST_CHECK(Datum_getLength(i) == 0);
+    TEST_CHECK(Datum_getLength(NULL) == -1);
+
+    Datum_Arena_T arena = Datum_Arena_new(0);
+    TEST_CHECK(Datum_getLength(Datum_asString_in(arena, longer, 152, DTM_ENC_UTF8)) == 52);
+    Datum_Arena_free(&arena);
+
+    DatumVector_T vec = DatumVector_new(DATUM_Str, DTM_ENC_UTF8);
+    DatumVector_appendString(vec, sami, -1);
+    TEST_CHECK(Datum_getLength(DatumVector_at(vec, 0, &view)) == 10);
+    DatumVector_free(&vec);
+
+    Datum_free(&s); Datum_free(&l); Datum_free(&w); Datum_free(&b); Datum_free(&i);
+}
+
+static void test_single_byte(void) {
+    static const dtm_encoding_t encs[] = {
+        DTM_ENC_ISO8859_1, DTM_ENC_ISO8859_2, DTM_ENC_ISO8859_15,
+        DTM_ENC_CH1252, DTM_ENC_ISO_IR_197, DTM_ENC_ISO_IR_197W,
+    };
+
+    Datum_T l1 = Datum_asString("Troms\xf8", -1, DTM_ENC_ISO8859_1);
+    unsigned char *u = Datum_getAsString(l1, DTM_ENC_UTF8);
+    TEST_CHECK(u && strcmp((char *)u, "Troms\xc3\xb8") == 0);
+    TEST_CHECK(Datum_getAsString(l1, DTM_ENC_UTF8) == u);      /* kept with the datum */
+
+    /* Sami letters only exist in ISO-IR-197 and Windows Sami 2 */
+    Datum_T sami = Datum_asString("\xc4\x8c\xc3\xa1hcesuolu", -1, DTM_ENC_UTF8);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(sami, DTM_ENC_ISO_IR_197), "\xa1\xe1hcesuolu") == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(sami, DTM_ENC_ISO_IR_197W), "\x82\xe1hcesuolu") == 0);
+    TEST_CHECK(Datum_getAsString(sami, DTM_ENC_ISO8859_1) == NULL);
+
+    /* the euro sign moves between the Latin-9 and Windows tables */
+    Datum_T euro = Datum_asString("pris 100 \x80 eks. mva", -1, DTM_ENC_CH1252);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(euro, DTM_ENC_ISO8859_15), "pris 100 \xa4 eks. mva") == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(euro, DTM_ENC_UTF8), "pris 100 \xe2\x82\xac eks. mva") == 0);
+    TEST_CHECK(Datum_getAsString(euro, DTM_ENC_ISO8859_1) == NULL);
+    TEST_CHECK(Datum_asString("\x81", 1, DTM_ENC_CH1252) == NULL);   /* undefined in Windows-1252 */
+    TEST_CHECK(Datum_asString("\xe6", 1, DTM_ENC_ASCII) == NULL);
+
+    /* every defined byte survives the way to utf-8 and back */
+    for (size_t e = 0; e < sizeof encs / sizeof encs[0]; e++) {
+        char all[256];
+        int len = 0;
+        for (int b = 1; b < 256; b++) {
+            char c = (char)b;
+            Datum_T one = Datum_asString(&c, 1, encs[e]);
+            if (one)
+                all[len++] = c;
+            Datum_free(&one);
+        }
+        TEST_CHECK(len >= 240);
+        Datum_T d = Datum_asString(all, len, encs[e]);
+        Datum_T back = Datum_asString((char *)Datum_getAsString(d, DTM_ENC_UTF8), -1, DTM_ENC_UTF8);
+        unsigned char *again = Datum_getAsString(back, encs[e]);
+        TEST_CHECK_(again && memcmp(again, all, (size_t)len) == 0, "round trip of encoding %d", encs[e]);
+        Datum_free(&d);
+        Datum_free(&back);
+    }
+
+    /* no copies for datums that are not freed one by one */
+    Datum_Arena_T arena = Datum_Arena_new(0);
+    Datum_T a = Datum_asString_in(arena, "Troms\xf8", -1, DTM_ENC_ISO8859_1);
+    TEST_CHECK(Datum_getAsString(a, DTM_ENC_UTF8) == NULL);
+    Datum_T ac = Datum_copy(a);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(ac, DTM_ENC_UTF8), "Troms\xc3\xb8") == 0);
+    Datum_Arena_free(&arena);
+
+    Datum_T c = Datum_copy(l1);
+    TEST_CHECK(Datum_getAsString(c, DTM_ENC_UTF8) != u);
+    Datum_free(&l1);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(c, DTM_ENC_UTF8), "Troms\xc3\xb8") == 0);
+
+    Datum_free(&c); Datum_free(&ac); Datum_free(&sami); Datum_free(&euro);
+}
+
+static void test_transcode(void) {
+    /* "Sápmi 😀" as utf-16 big endian, with a surrogate pair */
+    static const char be16[] = "\0S\0\xe1\0p\0m\0i\0 \xd8\x3d\xde\x00";
+    const char *utf8 = "S\xc3\xa1pmi \xf0\x9f\x98\x80";
+
+    Datum_T d = Datum_asString(be16, sizeof be16 - 1, DTM_ENC_UTF16BE);
+    TEST_CHECK(Datum_getLength(d) == 7);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(d, DTM_ENC_UTF8), utf8) == 0);
+
+    uint32_t *u = Datum_getAsStringU(d);
+    TEST_CHECK(u && u[1] == 0xe1 && u[6] == 0x1f600 && u[7] == 0);
+    unsigned char *le = Datum_getAsString(d, DTM_ENC_UTF16LE);
+    TEST_CHECK(le && memcmp(le, "S\0\xe1\0", 4) == 0 && memcmp(le + 12, "\x3d\xd8\x00\xde", 4) == 0);
+    TEST_CHECK(Datum_getAsString(d, DTM_ENC_ISO8859_1) == NULL);      /* no room for the emoji */
+
+    /* from utf-8 to wide characters and back, long enough for the fast paths */
+    char text[300];
+    strcpy(text, "Guovdageaidnu suohkan / Kautokeino kommune, Finnmark fylke, ");
+    strcat(text, "\xc4\x8c\xc3\xa1hcesuolu ja Romsa, \xe2\x82\xac 100");
+    Datum_T n = Datum_asString(text, -1, DTM_ENC_UTF8);
+    wchar_t *w = Datum_getAsStringW(n);
+    TEST_CHECK(w && wcslen(w) == (size_t)Datum_getLength(n));
+    TEST_CHECK(w[60] == 0x10c && w[wcslen(w) - 5] == 0x20ac);
+    Datum_T back = Datum_asStringW(w, -1);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(back, DTM_ENC_UTF8), text) == 0);
+    TEST_CHECK(Datum_getAsStringW(back) == Datum_getAsStringW(back));
+    unsigned char *be32 = Datum_getAsString(back, DTM_ENC_UTF32BE);
+    TEST_CHECK(be32 && memcmp(be32, "\0\0\0G", 4) == 0);
+
+    /* the native encodings are the same as their byte order twin */
+    Datum_T native = Datum_asString("A\0", 2, DTM_ENC_UTF16);
+    TEST_CHECK(Datum_getAsString(native, DTM_ENC_UTF16LE) == Datum_getAsString(native, DTM_ENC_UTF16)
+               || Datum_getAsString(native, DTM_ENC_UTF16BE) == Datum_getAsString(native, DTM_ENC_UTF16));
+
+    /* DTM_ENC_NONE reads as utf-8 when valid, as ISO-8859-15 otherwise */
+    Datum_T none8 = Datum_asString("Troms\xc3\xb8", -1, DTM_ENC_NONE);
+    Datum_T none15 = Datum_asString("\xa4 100", -1, DTM_ENC_NONE);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(none8, DTM_ENC_UTF8), "Troms\xc3\xb8") == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(none15, DTM_ENC_UTF8), "\xe2\x82\xac 100") == 0);
+    const uint16_t *w8 = (const uint16_t *)Datum_getAsString(none8, DTM_ENC_UTF16);
+    const uint16_t *w15 = (const uint16_t *)Datum_getAsString(none15, DTM_ENC_UTF16);
+    TEST_CHECK(w8 && w8[0] == 'T' && w8[5] == 0xf8 && w8[6] == 0);
+    TEST_CHECK(w15 && w15[0] == 0x20ac && w15[4] == '0' && w15[5] == 0);
+    Datum_free(&none8); Datum_free(&none15);
+
+    /* unpaired surrogates are refused */
+    TEST_CHECK(Datum_asString("\xd8\x3d\0A", 4, DTM_ENC_UTF16BE) == NULL);
+    TEST_CHECK(Datum_asString("\xde\x00", 2, DTM_ENC_UTF16BE) == NULL);
+
+    Datum_free(&d); Datum_free(&n); Datum_free(&back); Datum_free(&native);
+}
+
+static const dtm_encoding_t conv_encs[] = {
+    DTM_ENC_UTF16LE, DTM_ENC_UTF32BE, DTM_ENC_ISO8859_15, DTM_ENC_ISO_IR_197, DTM_ENC_CH1252,
+};
+
+struct conv_run {
+    Datum_T src;
+    const unsigned char *got[5];
+    bool same;
+};
+
+static void *convert_many(void *arg) {
+    struct conv_run *run = arg;
+    run->same = true;
+    for (int i = 0; i < 2000; i++)
+        for (int e = 0; e < 5; e++) {
+            const unsigned char *z = Datum_getAsString(run->src, conv_encs[e]);
+            if (i == 0)
+                run->got[e] = z;
+            else if (z != run->got[e])
+                run->same = false;
+        }
+    return NULL;
+}
+
+static void test_conv_threads(void) {
+    Datum_T src = Datum_asString("R\xc3\xb8ros og Tydal, \xc3\x85" "fjord, \xc3\x98" "ksnes", -1, DTM_ENC_UTF8);
+    struct conv_run run[4];
+    pthread_t th[4];
+
+    for (int t = 0; t < 4; t++) {
+        run[t].src = src;
+        pthread_create(&th[t], NULL, convert_many, &run[t]);
+    }
+    for (int t = 0; t < 4; t++)
+        pthread_join(th[t], NULL);
+
+    /* every thread sees the one copy per encoding that won */
+    for (int t = 0; t < 4; t++) {
+        TEST_CHECK(run[t].same);
+        for (int e = 0; e < 5; e++)
+            TEST_CHECK(run[t].got[e] != NULL && run[t].got[e] == run[0].got[e]);
+    }
+    TEST_CHECK(strcmp((char *)run[0].got[2], "R\xf8ros og Tydal, \xc5" "fjord, \xd8" "ksnes") == 0);
+    TEST_CHECK(Datum_getAsString(src, DTM_ENC_ISO8859_15) == run[0].got[2]);
+    Datum_free(&src);
+}
+
+static void test_detect(void) {
+    int conf;
+
+    TEST_CHECK(Datum_detectEncoding("Hamar 2025", 10, &conf) == DTM_ENC_ASCII && conf == 100);
+    TEST_CHECK(Datum_detectEncoding("Bod\xc3\xb8 og Troms\xc3\xb8", 16, &conf) == DTM_ENC_UTF8 && conf >= 80);
+    TEST_CHECK(Datum_detectEncoding("\xef\xbb\xbfHei", 6, NULL) == DTM_ENC_UTF8);
+    TEST_CHECK(Datum_detectEncoding("\xff\xfeH\0e\0i\0", 8, &conf) == DTM_ENC_UTF16LE && conf == 100);
+
+    /* utf-16 without a byte order mark, from the zero high bytes */
+    Datum_T d = Datum_asString("Fl\xc3\xa5m og Aurland kommune", -1, DTM_ENC_UTF8);
+    size_t sz;
+    const char *be = (const char *)Datum_getAsString(d, DTM_ENC_UTF16BE);
+    sz = 2 * (size_t)Datum_getLength(d);
+    TEST_CHECK(Datum_detectEncoding(be, sz, &conf) == DTM_ENC_UTF16BE && conf > 50);
+    TEST_CHECK(Datum_detectEncoding(Datum_getAsString(d, DTM_ENC_UTF16LE), sz, NULL) == DTM_ENC_UTF16LE);
+    Datum_free(&d);
+
+    /* Nordic letters alone: the default single byte encoding */
+    const char *nb = "R\xf8ros, \xc5lesund og Tr\xe6na";
+    TEST_CHECK(Datum_detectEncoding(nb, strlen(nb), &conf) == DTM_ENC_ISO8859_15 && conf > 40);
+    /* typographic quotes and dashes only exist in Windows-1252 */
+    const char *win = "\x93" "Bl\xe5 resept\x94 \x96 s\xe6rlig for \xf8yne";
+    TEST_CHECK(Datum_detectEncoding(win, strlen(win), NULL) == DTM_ENC_CH1252);
+    /* Sami letters sit where Latin-1 has symbols */
+    const char *se = "\xa1\xe1hcesuolu ja \xa1\xe1hcesuolu, \xb9\xe1vvir";
+    TEST_CHECK(Datum_detectEncoding(se, strlen(se), NULL) == DTM_ENC_ISO_IR_197);
+    /* the euro sign is 0xa4 in Latin-9 and the currency sign in Latin-1 */
+    const char *eur = "100 \xa4 for \xe6" "bler";
+    TEST_CHECK(Datum_detectEncoding(eur, strlen(eur), NULL) == DTM_ENC_ISO8859_15);
+
+    /* zeros all over: not text */
+    static const char bin[] = "\0\0\x01\x02\0\x7f\0\0\x10\0\0\0";
+    TEST_CHECK(Datum_detectEncoding(bin, sizeof bin - 1, &conf) == DTM_ENC_NONE && conf == 0);
+}
+
+static void test_transcoder(void) {
+    /* "Čáhcesuolu, Tromsø 😀" in utf-8, fed one byte at a time */
+    const char *utf8 = "\xc4\x8c\xc3\xa1hcesuolu, Troms\xc3\xb8 \xf0\x9f\x98\x80";
+    dtm_transcoder_T tc = dtm_transcoder_new(DTM_ENC_UTF8, DTM_ENC_UTF16BE);
+    char out[64];
+    size_t o = 0;
+
+    TEST_CHECK(tc != NULL);
+    for (const char *p = utf8; *p; ) {
+        size_t len = 1;
+        size_t n = dtm_transcoder_feed(tc, &p, &len, out + o, sizeof out - o);
+        TEST_CHECK(n != (size_t)-1 && len == 0);
+        o += n;
+    }
+    TEST_CHECK(dtm_transcoder_flush(tc) == 0);
+    TEST_CHECK(o == 42 && memcmp(out, "\x01\x0c\0\xe1", 4) == 0 && memcmp(out + 38, "\xd8\x3d\xde\x00", 4) == 0);
+    dtm_transcoder_free(&tc);
+    TEST_CHECK(tc == NULL);
+
+    /* a small buffer takes the input in several rounds */
+    char text[400], big[1200], part[16];
+    for (int i = 0; i < 40; i++)
+        memcpy(text + 10 * i, "Kj\xf8p \x80 10 ", 10);
+    tc = dtm_transcoder_new(DTM_ENC_CH1252, DTM_ENC_UTF8);
+    const char *p = text;
+    size_t len = sizeof text, total = 0;
+    while (len) {
+        size_t n = dtm_transcoder_feed(tc, &p, &len, part, sizeof part);
+        TEST_CHECK(n != (size_t)-1 && n > 0);
+        memcpy(big + total, part, n);
+        total += n;
+    }
+    TEST_CHECK(total == 520 && memcmp(big, "Kj\xc3\xb8p \xe2\x82\xac 10 ", 13) == 0);
+    dtm_transcoder_free(&tc);
+
+    /* a bad byte stops the conversion in front of it */
+    tc = dtm_transcoder_new(DTM_ENC_UTF8, DTM_ENC_ISO8859_1);
+    const char *badIn = "Bod\xc3\xb8 \xff";
+    p = badIn;
+    len = 8;
+    TEST_CHECK(dtm_transcoder_feed(tc, &p, &len, out, sizeof out) == 5 && p == badIn + 6);
+    TEST_CHECK(dtm_transcoder_feed(tc, &p, &len, out, sizeof out) == (size_t)-1 && len == 2);
+
+    /* input that ends inside a character */
+    p = "\xc3";
+    len = 1;
+    TEST_CHECK(dtm_transcoder_feed(tc, &p, &len, out, sizeof out) == 0 && len == 0);
+    TEST_CHECK(dtm_transcoder_flush(tc) == (size_t)-1);
+    dtm_transcoder_free(&tc);
+
+    TEST_CHECK(dtm_transcoder_new(DTM_ENC_UTF8, DTM_ENC_NONE) == NULL);
+}
+
+static void test_adaptive(void) {
+    /* Norwegian text takes one byte per character, whatever width it comes in */
+    Datum_T w = Datum_asStringW(L"Troms\u00f8 og Finnmark fylkeskommune", -1);
+    TEST_CHECK(Datum_getLength(w) == 32);
+#ifndef DATUM_NO_ADAPTIVE
+    TEST_CHECK(Datum_getEncoding(w) == DTM_ENC_ISO8859_1 && Datum_getSize(w) == 32);
+#endif
+    TEST_CHECK(Datum_isStringW(w) && wcscmp(Datum_getAsStringW(w), L"Troms\u00f8 og Finnmark fylkeskommune") == 0);
+    TEST_CHECK(Datum_getCharAt(w, 5) == 0xf8 && Datum_getCharAt(w, 32) == -1);
+
+    /* Sami letters need two bytes, an emoji four */
+    static const uint32_t sami[] = { 0x10c, 0xe1, 'h', 'c', 'e', 0 };
+    static const uint32_t smile[] = { 'j', 'a', ' ', 0x1f600, 0 };
+    Datum_T s = Datum_asStringU(sami, -1), e = Datum_asStringU(smile, -1);
+#ifndef DATUM_NO_ADAPTIVE
+    TEST_CHECK(Datum_getEncoding(s) == DTM_ENC_UTF16 && Datum_getSize(s) == 10);
+    TEST_CHECK(Datum_getEncoding(e) == DTM_ENC_UTF32);
+#endif
+    TEST_CHECK(Datum_getCharAt(s, 0) == 0x10c && Datum_getCharAt(e, 3) == 0x1f600);
+    TEST_CHECK(memcmp(Datum_getAsStringU(s), sami, sizeof sami) == 0);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(s, DTM_ENC_UTF8), "\xc4\x8c\xc3\xa1hce") == 0);
+
+    /* utf-16 with a surrogate pair widens to utf-32 */
+    Datum_T p = Datum_asString("\x3d\xd8\x00\xde!\0", 6, DTM_ENC_UTF16LE);
+    TEST_CHECK(Datum_getLength(p) == 2 && Datum_getCharAt(p, 0) == 0x1f600 && Datum_getCharAt(p, 1) == '!');
+    unsigned char *le = Datum_getAsString(p, DTM_ENC_UTF16LE);
+    TEST_CHECK(le && memcmp(le, "\x3d\xd8\x00\xde!\0\0\0", 8) == 0);
+
+    /* utf-8 is kept as given and walked */
+    Datum_T u = Datum_asString("\xc3\x85lesund", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getEncoding(u) == DTM_ENC_UTF8 && Datum_getCharAt(u, 0) == 0xc5 && Datum_getCharAt(u, 1) == 'l');
+
+    /* DTM_ENC_NONE reads as utf-8 when valid, as ISO-8859-15 otherwise */
+    Datum_T euro = Datum_asString("\xa4" "5", -1, DTM_ENC_NONE);
+    Datum_T euro8 = Datum_asString("\xe2\x82\xac" "5", -1, DTM_ENC_NONE);
+    TEST_CHECK(Datum_getCharAt(euro, 0) == 0x20ac && Datum_getCharAt(euro, 1) == '5');
+    TEST_CHECK(Datum_getCharAt(euro8, 0) == 0x20ac && Datum_getCharAt(euro8, 1) == '5');
+
+    /* narrowed datums still go into a vector of the encoding they were made in */
+    Datum_T o = Datum_asString("O\0s\0l\0o\0", 8, DTM_ENC_UTF16LE);
+    Datum_T both[] = { o, p };
+    Datum_View view;
+    DatumVector_T vec = DatumVector_new(DATUM_Str, DTM_ENC_UTF16LE);
+    TEST_CHECK(DatumVector_appendDatums(vec, both, 2));
+    Datum_T v = DatumVector_at(vec, 0, &view);
+    TEST_CHECK(Datum_getSize(v) == 8 && memcmp(Datum_getAsString(v, DTM_ENC_NONE), "O\0s\0l\0o\0\0\0", 10) == 0);
+    v = DatumVector_at(vec, 1, &view);
+    TEST_CHECK(Datum_getLength(v) == 2 && memcmp(Datum_getAsString(v, DTM_ENC_NONE), "\x3d\xd8\x00\xde!\0", 6) == 0);
+    DatumVector_free(&vec);
+
+    /* nothing is appended when a character has no place in the vector */
+    DatumVector_T latin = DatumVector_new(DATUM_Str, DTM_ENC_ISO8859_1);
+    TEST_CHECK(!DatumVector_appendDatums(latin, both, 2));
+    TEST_CHECK(DatumVector_length(latin) == 0);
+    DatumVector_free(&latin);
+
+    Datum_free(&w); Datum_free(&s); Datum_free(&e); Datum_free(&p); Datum_free(&u); Datum_free(&o);
+    Datum_free(&euro); Datum_free(&euro8);
+}
+
+static void test_raw_bytes(void) {
+    Datum_T r = Datum_asRawBytes("Bod\xc3\xb8 og Fauske", -1, DTM_ENC_UTF8);
+    TEST_CHECK(r && Datum_isString(r) && Datum_getSize(r) == 15);
+    TEST_CHECK(Datum_getType(r) == DATUM_Str);
+
+    /* checked and counted on first use */
+    TEST_CHECK(Datum_getLength(r) == 14);
+    TEST_CHECK(strcmp((char *)Datum_getAsString(r, DTM_ENC_ISO8859_1), "Bod\xf8 og Fauske") == 0);
+    Datum_T s = Datum_asString("Bod\xc3\xb8 og Fauske", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_isEqual(r, s));
+
+    /* bytes that are not valid only show when looked at */
+    Datum_T bad = Datum_asRawBytes("Bod\xf8", 4, DTM_ENC_UTF8);
+    TEST_CHECK(bad != NULL && Datum_getSize(bad) == 4);
+    TEST_CHECK(Datum_getAsString(bad, DTM_ENC_UTF8) == NULL);
+    TEST_CHECK(Datum_getLength(bad) == -1 && Datum_getLength(bad) == -1);
+    TEST_CHECK(Datum_intern(bad) == bad && !Datum_isInterned(bad));
+
+    /* a copy is checked on its own */
+    Datum_T w = Datum_asRawBytes("\xd8\x3d\xde\x00", 4, DTM_ENC_UTF16BE);
+    Datum_T wc = Datum_copy(w);
+    TEST_CHECK(Datum_getLength(wc) == 1 && Datum_getCharAt(wc, 0) == 0x1f600);
+    TEST_CHECK(Datum_getLength(w) == 1);
+
+    Datum_free(&r); Datum_free(&s); Datum_free(&bad); Datum_free(&w); Datum_free(&wc);
+}
+
+static void *length_of(void *arg) {
+    return (void *)(intptr_t)Datum_getLength((Datum_T)arg);
+}
+
+static void test_raw_threads(void) {
+    /* threads settling the same raw datum all see the one count */
+    for (int round = 0; round < 50; round++) {
+        Datum_T r = Datum_asRawBytes("Troms\xc3\xb8 og Finnmark fylkeskommune, Vads\xc3\xb8", -1, DTM_ENC_UTF8);
+        pthread_t th[4];
+        void *got[4];
+        for (int t = 0; t < 4; t++)
+            pthread_create(&th[t], NULL, length_of, r);
+        for (int t = 0; t < 4; t++)
+            pthread_join(th[t], &got[t]);
+        for (int t = 0; t < 4; t++)
+            TEST_CHECK((intptr_t)got[t] == 39);
+        TEST_CHECK(Datum_getSize(r) == 41);
+        Datum_free(&r);
+    }
+}
+
+static void test_hash(void) {
+    Datum_T i3 = Datum_asInteger(3), d3 = Datum_asDouble(3.0), d35 = Datum_asDouble(3.5);
+    TEST_CHECK(Datum_hash(i3) != 0 && Datum_hash(i3) == Datum_hash(d3));
+    TEST_CHECK(Datum_hash(d3) != Datum_hash(d35));
+    TEST_CHECK(Datum_hash(i3) == Datum_hash(i3));       /* cached */
+
+    Datum_T z = Datum_asDouble(0.0), nz = Datum_asDouble(-0.0), i0 = Datum_asInteger(0);
+    TEST_CHECK(Datum_hash(z) == Datum_hash(nz) && Datum_hash(z) == Datum_hash(i0));
+
+    /* the same code points in every storage encoding */
+    Datum_T u8 = Datum_asString("Bod\xc3\xb8", -1, DTM_ENC_UTF8);
+    Datum_T l1 = Datum_asString("Bod\xf8", -1, DTM_ENC_ISO8859_1);
+    Datum_T w = Datum_asStringW(L"Bod\u00f8", -1);
+    Datum_T raw = Datum_asRawBytes("Bod\xc3\xb8", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_hash(u8) == Datum_hash(l1));
+    TEST_CHECK(Datum_hash(u8) == Datum_hash(w));
+    TEST_CHECK(Datum_hash(u8) == Datum_hash(raw));
+    Datum_T a8 = Datum_asString("Fauske", -1, DTM_ENC_UTF8), a15 = Datum_asString("Fauske", -1, DTM_ENC_ISO8859_15);
+    TEST_CHECK(Datum_hash(a8) == Datum_hash(a15) && Datum_hash(a8) != Datum_hash(u8));
+
+    /* a long one goes through the heap */
+    char lng[600];
+    for (int k = 0; k < 599; k++)
+        lng[k] = (k % 7) ? 'a' + k % 26 : '\xe6';
+    lng[599] = 0;
+    Datum_T ll = Datum_asString(lng, -1, DTM_ENC_ISO8859_1);
+    Datum_T lu = Datum_asString((char *)Datum_getAsString(ll, DTM_ENC_UTF8), -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_hash(ll) == Datum_hash(lu));
+
+    Datum_T blob = Datum_asBLOB("Fauske", 6, 0);
+    TEST_CHECK(Datum_hash(blob) != Datum_hash(a8));
+    TEST_CHECK(Datum_hash(NULL) == 0);
+
+    Datum_T *all[] = { &i3, &d3, &d35, &z, &nz, &i0, &u8, &l1, &w, &raw, &a8, &a15, &ll, &lu, &blob };
+    for (size_t k = 0; k < sizeof all / sizeof all[0]; k++)
+        Datum_free(all[k]);
+}
+
+static void test_equal_encodings(void) {
+    /* the same text in a legacy and a migrated column */
+    const char *l15 = "Kr\xf8ttere i Tromsdalen betaler \xa4 40 i \xe5rsavgift til Sami \xb4";
+    Datum_T a = Datum_asString(l15, -1, DTM_ENC_ISO8859_15);
+    Datum_T b = Datum_asString((char *)Datum_getAsString(a, DTM_ENC_UTF8), -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getEncoding(b) == DTM_ENC_UTF8);
+    TEST_CHECK(Datum_isEqual(a, b) && Datum_isEqual(b, a));
+    TEST_CHECK(Datum_hash(a) == Datum_hash(b));
+
+    /* a difference late in a long ASCII run, and one in a letter */
+    Datum_T c = Datum_asString("Kr\xc3\xb8ttere i Tromsdalen betaler \xe2\x82\xac 41 i \xc3\xa5rsavgift til Sami \xc5\xbd", -1, DTM_ENC_UTF8);
+    Datum_T e = Datum_asString("Kr\xc3\xb8ttere i Tromsdalen betaler \xe2\x82\xac 40 i \xc3\xa6rsavgift til Sami \xc5\xbd", -1, DTM_ENC_UTF8);
+    TEST_CHECK(!Datum_isEqual(a, c));
+    TEST_CHECK(!Datum_isEqual(a, e));
+
+    /* wide strings, raw utf-16 and text of another length */
+    Datum_T w = Datum_asStringW(L"Kr\u00f8ttere", -1);
+    Datum_T u16 = Datum_asRawBytes("\0K\0r\0\xf8\0t\0t\0e\0r\0e", 16, DTM_ENC_UTF16BE);
+    Datum_T n8 = Datum_asString("Kr\xc3\xb8ttere", -1, DTM_ENC_UTF8);
+    Datum_T s8 = Datum_asString("Kr\xc3\xb8tter", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_isEqual(w, n8) && Datum_isEqual(u16, n8) && Datum_isEqual(w, u16));
+    TEST_CHECK(!Datum_isEqual(w, s8) && !Datum_isEqual(s8, u16));
+
+    /* a text is not a blob, and a cached hash rules out a pair early */
+    Datum_T blob = Datum_asBLOB("Kr\xc3\xb8ttere", 10, 0);
+    TEST_CHECK(!Datum_isEqual(blob, n8));
+    Datum_hash(n8);
+    Datum_hash(s8);
+    TEST_CHECK(!Datum_isEqual(n8, s8));
+
+    /* DTM_ENC_NONE is utf-8 when valid and ISO-8859-15 otherwise */
+    Datum_T oslo = Datum_asString("Oslo", -1, DTM_ENC_NONE), oslo8 = Datum_asString("Oslo", -1, DTM_ENC_UTF8);
+    Datum_T none8 = Datum_asString("Kr\xc3\xb8ttere", -1, DTM_ENC_NONE);
+    Datum_T none15 = Datum_asString("Kr\xf8ttere", -1, DTM_ENC_NONE);
+    TEST_CHECK(Datum_isEqual(oslo, oslo8) && Datum_hash(oslo) == Datum_hash(oslo8));
+    TEST_CHECK(Datum_isEqual(none8, n8) && Datum_isEqual(none15, n8) && Datum_isEqual(none15, w));
+    TEST_CHECK(Datum_hash(none8) == Datum_hash(n8) && Datum_hash(none15) == Datum_hash(n8));
+    TEST_CHECK(Datum_compare(oslo, oslo8) == 0 && Datum_compare(none15, n8) == 0);
+    TEST_CHECK(Datum_compare(none15, s8) > 0 && Datum_compare(oslo, none15) > 0);
+    size_t k15, k8;
+    const uint8_t *key15 = Datum_collationKey(none15, DTM_COLLATE_NB, &k15);
+    const uint8_t *key8 = Datum_collationKey(n8, DTM_COLLATE_NB, &k8);
+    TEST_CHECK(key15 && key8 && k15 == k8 && memcmp(key15, key8, k8) == 0);
+
+    Datum_T *all[] = { &a, &b, &c, &e, &w, &u16, &n8, &s8, &blob, &oslo, &oslo8, &none8, &none15 };
+    for (size_t k = 0; k < sizeof all / sizeof all[0]; k++)
+        Datum_free(all[k]);
+}
+
+static void test_map(void) {
+    DatumMap_T map = DatumMap_new(0);
+    char buf[32];
+
+    /* pseudonyms for 1000 national id numbers, enough to grow a few times */
+    for (int k = 0; k < 1000; k++) {
+        snprintf(buf, sizeof buf, "P%05d", k);
+        Datum_T key = Datum_asInteger(10000000000LL + k), val = Datum_asString(buf, -1, DTM_ENC_UTF8);
+        TEST_CHECK(DatumMap_put(map, key, val));
+        Datum_free(&key);
+        Datum_free(&val);
+    }
+    TEST_CHECK(DatumMap_length(map) == 1000);
+
+    Datum_T probe = Datum_asDouble(10000000042.0);     /* equal to the integer key */
+    Datum_T got = DatumMap_get(map, probe);
+    TEST_CHECK(got && strcmp((char *)Datum_getAsString(got, DTM_ENC_UTF8), "P00042") == 0);
+    Datum_free(&probe);
+
+    /* a string key found in another encoding, and replaced */
+    Datum_T k8 = Datum_asString("Tr\xc3\xb8ndelag", -1, DTM_ENC_UTF8), k15 = Datum_asString("Tr\xf8ndelag", -1, DTM_ENC_ISO8859_15);
+    Datum_T v1 = Datum_asInteger(50), v2 = Datum_asInteger(51);
+    TEST_CHECK(DatumMap_put(map, k8, v1));
+    TEST_CHECK(Datum_getAsInteger(DatumMap_get(map, k15)) == 50);
+    TEST_CHECK(DatumMap_put(map, k15, v2) && DatumMap_length(map) == 1001);
+    TEST_CHECK(Datum_getAsInteger(DatumMap_get(map, k8)) == 51);
+
+    /* remove every other id, the rest stay reachable */
+    for (int k = 0; k < 1000; k += 2) {
+        Datum_T key = Datum_asInteger(10000000000LL + k);
+        TEST_CHECK(DatumMap_remove(map, key));
+        TEST_CHECK(!DatumMap_remove(map, key));
+        Datum_free(&key);
+    }
+    TEST_CHECK(DatumMap_length(map) == 501 && DatumMap_contains(map, k8));
+
+    /* batch lookup */
+    Datum_T keys[40], out[40];
+    for (int k = 0; k < 40; k++)
+        keys[k] = Datum_asInteger(10000000000LL + k);
+    TEST_CHECK(DatumMap_getAll(map, keys, 40, out) == 20);
+    TEST_CHECK(out[0] == NULL && out[7] && strcmp((char *)Datum_getAsString(out[7], DTM_ENC_UTF8), "P00007") == 0);
+
+    /* batch insert into a fresh map */
+    DatumMap_T m2 = DatumMap_new(0);
+    TEST_CHECK(DatumMap_putAll(m2, keys, keys, 40) == 40 && DatumMap_length(m2) == 40);
+    TEST_CHECK(DatumMap_getAll(m2, keys, 40, out) == 40 && Datum_isEqual(out[39], keys[39]));
+    TEST_CHECK(DatumMap_get(m2, k8) == NULL && DatumMap_get(m2, NULL) == NULL);
+
+    for (int k = 0; k < 40; k++)
+        Datum_free(&keys[k]);
+    Datum_free(&k8); Datum_free(&k15); Datum_free(&v1); Datum_free(&v2);
+    DatumMap_free(&map);
+    DatumMap_free(&m2);
+    TEST_CHECK(map == NULL);
+}
+
+static int compare_datums(const void *a, const void *b) {
+    return Datum_compare(*(Datum_T *)a, *(Datum_T *)b);
+}
+
+static void test_compare(void) {
+    Datum_T nul = Datum_asNull(), i2 = Datum_asInteger(2), d25 = Datum_asDouble(2.5);
+    Datum_T big = Datum_asInteger((1LL << 53) + 1), bigd = Datum_asDouble((double)(1LL << 53));
+    Datum_T nan = Datum_asDouble(0.0 / 0.0);
+    Datum_T aa = Datum_asString("Aas", -1, DTM_ENC_UTF8);
+    Datum_T oe8 = Datum_asString("\xc3\x98ksnes", -1, DTM_ENC_UTF8);       /* U+00D8 */
+    Datum_T oe15 = Datum_asString("\xd8ksnes", -1, DTM_ENC_ISO8859_15);
+    Datum_T euro = Datum_asString("\x80", -1, DTM_ENC_CH1252);              /* U+20AC */
+    Datum_T blob = Datum_asBLOB("Aas", 3, 0);
+
+    TEST_CHECK(Datum_compare(nul, i2) < 0 && Datum_compare(i2, nul) > 0);
+    TEST_CHECK(Datum_compare(i2, d25) < 0 && Datum_compare(d25, i2) > 0);
+    TEST_CHECK(Datum_compare(big, bigd) > 0 && !Datum_isEqual(big, bigd));
+    TEST_CHECK(Datum_compare(d25, nan) < 0 && Datum_compare(nan, nan) == 0);
+    TEST_CHECK(Datum_compare(nan, aa) < 0 && Datum_compare(aa, blob) < 0);
+    TEST_CHECK(Datum_compare(aa, oe15) < 0 && Datum_compare(oe8, oe15) == 0);
+    TEST_CHECK(Datum_compare(oe15, euro) < 0 && Datum_compare(euro, oe8) > 0);
+
+    /* the sort agrees with qsort over Datum_compare */
+    Datum_T arr[] = { euro, blob, oe8, nan, aa, bigd, i2, nul, oe15, d25, big };
+    Datum_T ref[sizeof arr / sizeof arr[0]];
+    size_t n = sizeof arr / sizeof arr[0];
+    memcpy(ref, arr, sizeof arr);
+    qsort(ref, n, sizeof ref[0], compare_datums);
+    TEST_CHECK(Datum_sortArray(arr, n));
+    for (size_t k = 0; k < n; k++)
+        TEST_CHECK(Datum_compare(arr[k], ref[k]) == 0);
+    TEST_CHECK(arr[0] == nul && arr[n - 1] == blob);
+    TEST_CHECK(arr[7] == oe8 && arr[8] == oe15);                    /* stable */
+
+    /* long common beginnings */
+    Datum_T many[300];
+    char buf[40];
+    for (int k = 0; k < 300; k++) {
+        snprintf(buf, sizeof buf, "Kunde nummer %08d i Troms\xf8", (k * 7919) % 300);
+        many[k] = Datum_asString(buf, -1, k % 2 ? DTM_ENC_ISO8859_1 : DTM_ENC_ISO8859_15);
+    }
+    TEST_CHECK(Datum_sortArray(many, 300));
+    for (int k = 1; k < 300; k++)
+        TEST_CHECK(Datum_compare(many[k - 1], many[k]) < 0);
+    for (int k = 0; k < 300; k++)
+        Datum_free(&many[k]);
+
+    Datum_T *all[] = { &nul, &i2, &d25, &big, &bigd, &nan, &aa, &oe8, &oe15, &euro, &blob };
+    for (size_t k = 0; k < sizeof all / sizeof all[0]; k++)
+        Datum_free(all[k]);
+}
+
+static int key_cmp(Datum_T a, Datum_T b, dtm_collation_t coll) {
+    size_t la, lb;
+    const uint8_t *ka = Datum_collationKey(a, coll, &la), *kb = Datum_collationKey(b, coll, &lb);
+    int c = memcmp(ka, kb, la < lb ? la : lb);
+    return c ? c : (la > lb) - (la < lb);
+}
+
+static void test_collation(void) {
+    /* Norwegian: ole < Ole < olé < Olsen < Zahl < Ærø < Ødegård < Åsen */
+    const char *nb[] = { "ole", "Ole", "ol\xc3\xa9", "Olsen", "Zahl", "\xc3\x86r\xc3\xb8",
+                         "\xc3\x98" "deg\xc3\xa5rd", "\xc3\x85sen" };
+    Datum_T d[8];
+    for (int k = 0; k < 8; k++)
+        d[k] = Datum_asString(nb[k], -1, DTM_ENC_UTF8);
+    for (int k = 1; k < 8; k++)
+        TEST_CHECK(key_cmp(d[k - 1], d[k], DTM_COLLATE_NB) < 0);
+
+    /* the key is kept: the same bytes the second time */
+    size_t l1, l2;
+    const uint8_t *k1 = Datum_collationKey(d[6], DTM_COLLATE_NB, &l1);
+    TEST_CHECK(k1 == Datum_collationKey(d[6], DTM_COLLATE_NB, &l2) && l1 == l2);
+
+    /* the same name in another encoding has the same key */
+    Datum_T l15 = Datum_asString("\xd8" "deg\xe5rd", -1, DTM_ENC_ISO8859_15);
+    TEST_CHECK(key_cmp(l15, d[6], DTM_COLLATE_NB) == 0);
+
+    /* Swedish puts å first and ø with ö */
+    Datum_T aa = Datum_asString("\xc3\xa5", -1, DTM_ENC_UTF8), ae = Datum_asString("\xc3\xa6", -1, DTM_ENC_UTF8);
+    Datum_T oe = Datum_asString("\xc3\xb6", -1, DTM_ENC_UTF8), os = Datum_asString("\xc3\xb8", -1, DTM_ENC_UTF8);
+    TEST_CHECK(key_cmp(aa, ae, DTM_COLLATE_SE) < 0 && key_cmp(ae, aa, DTM_COLLATE_NB) < 0);
+    TEST_CHECK(key_cmp(ae, oe, DTM_COLLATE_SE) < 0 && key_cmp(oe, os, DTM_COLLATE_SE) < 0);
+
+    /* Sami: č after c, đ after d, ŋ after n and before o */
+    Datum_T cz = Datum_asString("cz", -1, DTM_ENC_UTF8), ca = Datum_asString("\xc4\x8d" "a", -1, DTM_ENC_UTF8);
+    Datum_T ng = Datum_asString("\xc5\x8b", -1, DTM_ENC_UTF8), o = Datum_asString("o", -1, DTM_ENC_UTF8);
+    Datum_T nz = Datum_asString("nz", -1, DTM_ENC_UTF8);
+    TEST_CHECK(key_cmp(cz, ca, DTM_COLLATE_SMI) < 0 && key_cmp(ca, cz, DTM_COLLATE_NB) < 0);
+    TEST_CHECK(key_cmp(nz, ng, DTM_COLLATE_SMI) < 0 && key_cmp(ng, o, DTM_COLLATE_SMI) < 0);
+
+    Datum_T nul = Datum_asNull();
+    TEST_CHECK(Datum_collationKey(nul, DTM_COLLATE_NB, &l1) == NULL);
+    Datum_free(&nul);
+
+    for (int k = 0; k < 8; k++)
+        Datum_free(&d[k]);
+    Datum_T *all[] = { &l15, &aa, &ae, &oe, &os, &cz, &ca, &ng, &o, &nz };
+    for (size_t k = 0; k < sizeof all / sizeof all[0]; k++)
+        Datum_free(all[k]);
+}
+
+static double text_double(const char *s, dtm_encoding_t enc) {
+    Datum_T d = Datum_asString(s, -1, enc);
+    double r = Datum_getAsDouble(d);
+    Datum_free(&d);
+    return r;
+}
+
+static void test_number_coercion(void) {
+    /* correctly rounded, as strtod */
+    TEST_CHECK(text_double("0.1", DTM_ENC_UTF8) == 0.1);
+    TEST_CHECK(text_double("-2.5e-3", DTM_ENC_ASCII) == -2.5e-3);
+    TEST_CHECK(text_double("1.7976931348623157e308", DTM_ENC_UTF8) == 1.7976931348623157e308);
+    TEST_CHECK(text_double("4.9406564584124654e-324", DTM_ENC_UTF8) == 4.9406564584124654e-324);
+    /* more digits than fit in 64 bits, halfway between two doubles but for the last */
+    TEST_CHECK(text_double("9007199254740993.0000000000000000001", DTM_ENC_UTF8) == 9007199254740994.0);
+    TEST_CHECK(text_double("9007199254740993", DTM_ENC_UTF8) == 9007199254740992.0);
+
+    /* groups of three, and the decimal separator of the thread */
+    TEST_CHECK(text_double(" 1,234.5 ", DTM_ENC_UTF8) == 1234.5);
+    TEST_CHECK(text_double("1 234 567", DTM_ENC_UTF8) == 1234567);
+    TEST_CHECK(text_double("1,23.5", DTM_ENC_UTF8) == DBL_MAX);
+    TEST_CHECK(Datum_setNumberFormat(DTM_NUM_COMMA) == DTM_NUM_POINT);
+    TEST_CHECK(text_double("1 234,56", DTM_ENC_UTF8) == 1234.56);
+    TEST_CHECK(text_double("1.234.567,5", DTM_ENC_UTF8) == 1234567.5);
+    TEST_CHECK(text_double("1\xc2\xa0" "234,5", DTM_ENC_UTF8) == 1234.5);      /* no-break space */
+    TEST_CHECK(text_double("-1\xa0" "234,5", DTM_ENC_ISO8859_15) == -1234.5);
+    TEST_CHECK(text_double("1,234.5", DTM_ENC_UTF8) == DBL_MAX);
+    TEST_CHECK(Datum_setNumberFormat(DTM_NUM_POINT) == DTM_NUM_COMMA);
+
+    /* read where they are, in utf-16 and utf-32 */
+    static const char be16[] = "\0-\0" "1\0" "2\0.\0" "5\0e\0" "2";
+    Datum_T d = Datum_asString(be16, sizeof be16 - 1, DTM_ENC_UTF16BE);
+    TEST_CHECK(Datum_getAsDouble(d) == -1250.0);
+    TEST_CHECK(Datum_getAsInteger(d) == -1250);
+    Datum_free(&d);
+    static const char le32[] = "4\0\0\0" "2\0\0\0" "\x2f\x20\0\0" "0\0\0\0" "0\0\0\0" "0\0\0\0";
+    d = Datum_asString(le32, sizeof le32 - 1, DTM_ENC_UTF32LE);
+    TEST_CHECK(Datum_getAsInteger(d) == 42000);                            /* narrow no-break space */
+    Datum_free(&d);
+
+    /* integers exactly, fractions truncated, the rest is an error */
+    d = Datum_asString("-9223372036854775808", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getAsInteger(d) == LLONG_MIN);
+    Datum_free(&d);
+    d = Datum_asString("9223372036854775808", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getAsInteger(d) == LONG_MAX);
+    Datum_free(&d);
+    d = Datum_asString("-12.9", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_getAsInteger(d) == -12);
+    Datum_free(&d);
+    const char *bad[] = { "", " ", "abc", "12abc", "1e", ".", "--1", "1 2", "0x10" };
+    for (size_t k = 0; k < sizeof bad / sizeof bad[0]; k++) {
+        TEST_CHECK_(text_double(bad[k], DTM_ENC_UTF8) == DBL_MAX, "\"%s\"", bad[k]);
+    }
+}
+
+static bool number_text(Datum_T d, const char *want) {
+    const char *got = (const char *)Datum_getAsString(d, DTM_ENC_UTF8);
+    bool ok = got && strcmp(got, want) == 0;
+    TEST_MSG("got %s, want %s", got ? got : "NULL", want);
+    Datum_free(&d);
+    return ok;
+}
+
+static void test_number_format(void) {
+    /* as short as reads back as the same double */
+    TEST_CHECK(number_text(Datum_asDouble(0.1), "0.1"));
+    TEST_CHECK(number_text(Datum_asDouble(2.0 / 3), "0.6666666666666666"));
+    TEST_CHECK(number_text(Datum_asDouble(-1234.5), "-1234.5"));
+    TEST_CHECK(number_text(Datum_asDouble(1e20), "100000000000000000000"));
+    TEST_CHECK(number_text(Datum_asDouble(1e21), "1e+21"));
+    TEST_CHECK(number_text(Datum_asDouble(1e-6), "0.000001"));
+    TEST_CHECK(number_text(Datum_asDouble(-1.5e-6), "-0.0000015"));
+    TEST_CHECK(number_text(Datum_asDouble(1e-7), "1e-7"));
+    TEST_CHECK(number_text(Datum_asDouble(1.5e-7), "1.5e-7"));
+    TEST_CHECK(number_text(Datum_asDouble(5e-324), "5e-324"));
+    TEST_CHECK(number_text(Datum_asDouble(1.7976931348623157e308), "1.7976931348623157e+308"));
+    TEST_CHECK(number_text(Datum_asDouble(0x1p89), "6.189700196426902e+26"));     /* printf needs 17 digits */
+    TEST_CHECK(number_text(Datum_asInteger(LLONG_MIN), "-9223372036854775808"));
+
+    /* with the decimals asked for, rounded as written */
+    TEST_CHECK(number_text(Datum_asDecimal(2.675, 2), "2.68"));
+    TEST_CHECK(number_text(Datum_asDecimal(9.995, 2), "10.00"));
+    TEST_CHECK(number_text(Datum_asDecimal(-0.004, 2), "0.00"));
+    TEST_CHECK(number_text(Datum_asDecimal(0.006, 2), "0.01"));
+    TEST_CHECK(number_text(Datum_asDecimal(1234, 3), "1234.000"));
+
+    /* the separator of the thread, and the text reads back */
+    Datum_setNumberFormat(DTM_NUM_COMMA);
+    Datum_T d = Datum_asDecimal(-1234.5, 2);
+    Datum_T t = Datum_asString((const char *)Datum_getAsString(d, DTM_ENC_UTF8), -1, DTM_ENC_UTF8);
+    TEST_CHECK(strcmp((const char *)Datum_getAsString(d, DTM_ENC_UTF8), "-1234,50") == 0);
+    TEST_CHECK(Datum_getAsDouble(t) == -1234.5);
+    Datum_setNumberFormat(DTM_NUM_POINT);
+    TEST_CHECK(strcmp((const char *)Datum_getAsString(d, DTM_ENC_UTF8), "-1234.50") == 0);
+    Datum_free(&t);
+
+    /* kept with the datum, and written in the wanted code units */
+    unsigned char *u = Datum_getAsString(d, DTM_ENC_ISO8859_15);
+    TEST_CHECK(u == Datum_getAsString(d, DTM_ENC_UTF8));
+    const char *be = (const char *)Datum_getAsString(d, DTM_ENC_UTF16BE);
+    TEST_CHECK(be && memcmp(be, "\0-\0" "1\0" "2\0" "3\0" "4\0.\0" "5\0" "0\0\0", 18) == 0);
+    TEST_CHECK(wcscmp(Datum_getAsStringW(d), L"-1234.50") == 0);
+
+    /* into a buffer of the caller */
+    char buf[16];
+    TEST_CHECK(Datum_formatNumber(d, DTM_ENC_UTF32LE, buf, sizeof buf) == 0);  /* no room */
+    TEST_CHECK(Datum_formatNumber(d, DTM_ENC_UTF8, buf, sizeof buf) == 8 && strcmp(buf, "-1234.50") == 0);
+    Datum_free(&d);
+
+    Datum_T s = Datum_asString("12", -1, DTM_ENC_UTF8);
+    TEST_CHECK(Datum_formatNumber(s, DTM_ENC_UTF8, buf, sizeof buf) == 0);
+    Datum_free(&s);
+}
+
 TEST_LIST = {
     { "new_and_free", test_new_and_free },
     { "invalid_pointer", test_invalid_pointer },
+    { "numbers", test_numbers },
+    { "string", test_string },
+    { "blob_and_datums", test_blob_and_datums },
+    { "locked", test_locked },
+    { "slab_reuse", test_slab_reuse },
+    { "slab_threads", test_slab_threads },
+    { "arena", test_arena },
+    { "inline_string", test_inline_string },
+    { "equal", test_equal },
+    { "intern", test_intern },
+    { "intern_threads", test_intern_threads },
+    { "copy_shares", test_copy_shares },
+    { "copy_from_arena", test_copy_from_arena },
+    { "copy_threads", test_copy_threads },
+    { "borrowed", test_borrowed },
+    { "vector_numbers", test_vector_numbers },
+    { "vector_strings", test_vector_strings },
+    { "utf8_validate", test_utf8_validate },
+    { "length", test_length },
+    { "single_byte", test_single_byte },
+    { "transcode", test_transcode },
+    { "conv_threads", test_conv_threads },
+    { "detect", test_detect },
+    { "transcoder", test_transcoder },
+    { "adaptive", test_adaptive },
+    { "raw_bytes", test_raw_bytes },
+    { "raw_threads", test_raw_threads },
+    { "hash", test_hash },
+    { "equal_encodings", test_equal_encodings },
+    { "map", test_map },
+    { "compare", test_compare },
+    { "collation", test_collation },
+    { "number_coercion", test_number_coercion },
+    { "number_format", test_number_format },
     { NULL, NULL }
-};
\ No newline at end of file
+};
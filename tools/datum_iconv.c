@@ -0,0 +1,375 @@
+/*
+ * datum_iconv.c
+ *
+ * datum-iconv: converts a file from one encoding to another with the
+ * library's codecs, ISO-IR-197 and Windows Sami 2 included.
+ *
+ *     datum-iconv -f iso-ir-197 -t utf-8 [-j threads] [-o out] [-v] [file]
+ *
+ * A file is mapped into memory and converted a window at a time: each
+ * window is split in one range per thread, the ranges are moved to
+ * character boundaries and converted in parallel, and the results are
+ * written out in order with one write per range. Output buffers are made
+ * once, so memory use does not grow with the file. Input from a pipe goes
+ * through the streaming transcoder instead. `-f auto` guesses the source
+ * encoding with Datum_detectEncoding from the first megabyte.
+ *
+ * Build with `make datum-iconv`.
+ *
+ * Created by: p2hansen
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "datum.h"
+#include "datum_int.h"
+
+#define RANGE_BYTES (16 * 1024 * 1024)  /* input per thread and window */
+#define MAX_THREADS 64
+#define STREAM_BUF  (1024 * 1024)
+#define DETECT_BYTES (1024 * 1024)
+
+static const struct {
+    const char *name;
+    dtm_encoding_t enc;
+} names[] = {
+    { "utf-8", DTM_ENC_UTF8 },          { "utf8", DTM_ENC_UTF8 },
+    { "utf-16", DTM_ENC_UTF16 },        { "utf-16le", DTM_ENC_UTF16LE },
+    { "utf-16be", DTM_ENC_UTF16BE },    { "utf-32", DTM_ENC_UTF32 },
+    { "utf-32le", DTM_ENC_UTF32LE },    { "utf-32be", DTM_ENC_UTF32BE },
+    { "ascii", DTM_ENC_ASCII },         { "us-ascii", DTM_ENC_ASCII },
+    { "iso-8859-1", DTM_ENC_ISO8859_1 }, { "latin1", DTM_ENC_ISO8859_1 },
+    { "iso-8859-2", DTM_ENC_ISO8859_2 }, { "latin2", DTM_ENC_ISO8859_2 },
+    { "iso-8859-15", DTM_ENC_ISO8859_15 }, { "latin9", DTM_ENC_ISO8859_15 },
+    { "windows-1252", DTM_ENC_CH1252 }, { "cp1252", DTM_ENC_CH1252 },
+    { "iso-ir-197", DTM_ENC_ISO_IR_197 }, { "winsami2", DTM_ENC_ISO_IR_197W },
+    { "ws2", DTM_ENC_ISO_IR_197W },
+};
+
+struct range {
+    const char *src;
+    size_t len;
+    char *out;                      /* dtm_transcodeBound of RANGE_BYTES and a character */
+    size_t outLen;
+    size_t errPos;                  /* (size_t)-1 if the range converted */
+    dtm_encoding_t from, to;
+    pthread_t thread;
+};
+
+static bool lookup(const char *name, dtm_encoding_t *enc)
+{
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; i++)
+        if (strcasecmp(name, names[i].name) == 0) {
+            *enc = names[i].enc;
+            return true;
+        }
+    return false;
+}
+
+static const char *nameOf(dtm_encoding_t enc)
+{
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; i++)
+        if (names[i].enc == enc)
+            return names[i].name;
+    return "?";
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool writeAll(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* moves pos forward to the start of a character, at most a few bytes */
+static size_t align(dtm_encoding_t enc, const unsigned char *s, size_t pos, size_t len)
+{
+    switch ((int)enc)
+    {
+        case DATUM_UTF8:
+            while (pos < len && (s[pos] & 0xc0) == 0x80)
+                pos++;
+            return pos;
+        case DATUM_UTF16:
+        case DATUM_UTF16LE:
+        case DATUM_UTF16BE: {
+            pos &= ~(size_t)1;
+            if (pos + 1 < len) {
+                bool be = enc == DTM_ENC_UTF16BE || (enc == DTM_ENC_UTF16 && DTM_HOST_BE);
+                unsigned u = be ? (unsigned)(s[pos] << 8 | s[pos + 1]) : (unsigned)(s[pos + 1] << 8 | s[pos]);
+                if (u >= 0xdc00 && u <= 0xdfff)
+                    pos += 2;                       /* the low half of a pair */
+            }
+            return pos < len ? pos : len;
+        }
+        case DATUM_UTF32:
+        case DATUM_UTF32LE:
+        case DATUM_UTF32BE:
+            return pos & ~(size_t)3;
+        default:
+            return pos;
+    }
+}
+
+static void *convert(void *arg)
+{
+    struct range *r = arg;
+    size_t err = 0;
+
+    r->outLen = dtm_transcode(r->from, r->to, r->src, r->len, r->out, &err);
+    r->errPos = (r->outLen == (size_t)-1) ? err : (size_t)-1;
+    return NULL;
+}
+
+static int badInput(const char *file, size_t offset, dtm_encoding_t to)
+{
+    fprintf(stderr, "datum-iconv: %s: byte %zu is not valid or has no place in %s\n",
+            file, offset, nameOf(to));
+    return 1;
+}
+
+/* a mapped file, a window of nthreads ranges at a time */
+static int convertMapped(const char *file, const char *src, size_t len, dtm_encoding_t from,
+                         dtm_encoding_t to, int nthreads, int out, size_t *written)
+{
+    struct range r[MAX_THREADS];
+    size_t cap = dtm_transcodeBound(from, to, RANGE_BYTES + 8);
+    int ret = 0;
+
+    for (int t = 0; t < nthreads; t++) {
+        r[t].out = malloc(cap);
+        r[t].from = from;
+        r[t].to = to;
+        if (!r[t].out) {
+            fprintf(stderr, "datum-iconv: out of memory\n");
+            while (t--)
+                free(r[t].out);
+            return 1;
+        }
+    }
+
+    for (size_t pos = 0; pos < len && !ret; ) {
+        int used = 0;
+        for (; used < nthreads && pos < len; used++) {
+            size_t end = pos + RANGE_BYTES < len ? align(from, (const unsigned char *)src, pos + RANGE_BYTES, len) : len;
+            r[used].src = src + pos;
+            r[used].len = end - pos;
+            pos = end;
+        }
+        if (used == 1)
+            convert(&r[0]);                         /* no thread for a small file */
+        else {
+            bool started[MAX_THREADS];
+            for (int t = 0; t < used; t++) {
+                /* without a thread the range is converted here instead */
+                started[t] = pthread_create(&r[t].thread, NULL, convert, &r[t]) == 0;
+                if (!started[t])
+                    convert(&r[t]);
+            }
+            for (int t = 0; t < used; t++)
+                if (started[t])
+                    pthread_join(r[t].thread, NULL);
+        }
+        for (int t = 0; t < used && !ret; t++) {
+            if (r[t].errPos != (size_t)-1)
+                ret = badInput(file, (size_t)(r[t].src - src) + r[t].errPos, to);
+            else if (!writeAll(out, r[t].out, r[t].outLen)) {
+                perror("datum-iconv: write");
+                ret = 1;
+            }
+            else
+                *written += r[t].outLen;
+        }
+    }
+
+    for (int t = 0; t < nthreads; t++)
+        free(r[t].out);
+    return ret;
+}
+
+/* a pipe, through the streaming transcoder */
+static int convertStream(int in, dtm_encoding_t from, dtm_encoding_t to, int out,
+                         size_t *read_, size_t *written)
+{
+    dtm_transcoder_T tc = dtm_transcoder_new(from, to);
+    char *ibuf = malloc(STREAM_BUF), *obuf = malloc(STREAM_BUF);
+    int ret = 0;
+
+    if (!tc || !ibuf || !obuf) {
+        fprintf(stderr, "datum-iconv: out of memory\n");
+        ret = 1;
+    }
+    while (!ret) {
+        ssize_t n = read(in, ibuf, STREAM_BUF);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            perror("datum-iconv: read");
+            ret = 1;
+            break;
+        }
+        if (n == 0) {
+            if (dtm_transcoder_flush(tc) == (size_t)-1)
+                ret = badInput("stdin", *read_, to);
+            break;
+        }
+        const char *p = ibuf;
+        size_t left = (size_t)n;
+        while (left && !ret) {
+            size_t w = dtm_transcoder_feed(tc, &p, &left, obuf, STREAM_BUF);
+            if (w == (size_t)-1)
+                ret = badInput("stdin", *read_ + (size_t)(p - ibuf), to);
+            else if (!writeAll(out, obuf, w)) {
+                perror("datum-iconv: write");
+                ret = 1;
+            }
+            else
+                *written += w;
+        }
+        *read_ += (size_t)n;
+    }
+
+    dtm_transcoder_free(&tc);
+    free(ibuf);
+    free(obuf);
+    return ret;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: datum-iconv -f from -t to [-j threads] [-o out] [-v] [file]\n"
+            "  -f  source encoding, or auto to guess it\n"
+            "  -t  target encoding\n"
+            "  -j  threads for mapped files (default: online CPUs)\n"
+            "  -o  output file (default: stdout)\n"
+            "  -v  report sizes and throughput on stderr\n"
+            "encodings:");
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; i++)
+        fprintf(stderr, " %s", names[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *fromName = NULL, *toName = NULL, *outName = NULL, *file = NULL;
+    dtm_encoding_t from = DTM_ENC_NONE, to = DTM_ENC_NONE;
+    int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN), opt;
+    bool verbose = false;
+
+    while ((opt = getopt(argc, argv, "f:t:j:o:vh")) != -1) {
+        switch (opt)
+        {
+            case 'f': fromName = optarg; break;
+            case 't': toName = optarg; break;
+            case 'j': nthreads = atoi(optarg); break;
+            case 'o': outName = optarg; break;
+            case 'v': verbose = true; break;
+            default:  usage(); return 2;
+        }
+    }
+    if (optind < argc)
+        file = argv[optind];
+    if (!fromName || !toName || optind + 1 < argc) {
+        usage();
+        return 2;
+    }
+    bool detect = strcasecmp(fromName, "auto") == 0;
+    if (!detect && !lookup(fromName, &from)) {
+        fprintf(stderr, "datum-iconv: unknown encoding %s\n", fromName);
+        return 2;
+    }
+    if (!lookup(toName, &to)) {
+        fprintf(stderr, "datum-iconv: unknown encoding %s\n", toName);
+        return 2;
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    int in = file ? open(file, O_RDONLY) : STDIN_FILENO;
+    if (in < 0) {
+        perror(file);
+        return 1;
+    }
+    int out = outName ? open(outName, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    if (out < 0) {
+        perror(outName);
+        return 1;
+    }
+
+    struct stat st;
+    const char *map = NULL;
+    size_t len = 0;
+    if (fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        len = (size_t)st.st_size;
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, in, 0);
+        if (map == MAP_FAILED) {
+            perror("datum-iconv: mmap");
+            return 1;
+        }
+        madvise((void *)map, len, MADV_SEQUENTIAL);
+    }
+
+    if (detect) {
+        int conf = 0;
+        if (!map) {
+            fprintf(stderr, "datum-iconv: -f auto needs a file\n");
+            return 2;
+        }
+        from = Datum_detectEncoding(map, len < DETECT_BYTES ? len : DETECT_BYTES, &conf);
+        if (from == DTM_ENC_NONE) {
+            fprintf(stderr, "datum-iconv: %s does not look like text\n", file);
+            return 1;
+        }
+        if (verbose)
+            fprintf(stderr, "datum-iconv: %s looks like %s (%d%% sure)\n", file, nameOf(from), conf);
+    }
+
+    size_t written = 0, read_ = 0;
+    double t0 = now();
+    int ret;
+    if (map) {
+        ret = convertMapped(file, map, len, from, to, nthreads, out, &written);
+        read_ = len;
+        munmap((void *)map, len);
+    }
+    else
+        ret = convertStream(in, from, to, out, &read_, &written);
+    double secs = now() - t0;
+
+    if (verbose && !ret)
+        fprintf(stderr, "datum-iconv: %zu bytes %s -> %zu bytes %s in %.3f s, %.1f MB/s\n",
+                read_, nameOf(from), written, nameOf(to), secs, secs > 0 ? read_ / secs / 1e6 : 0.0);
+    if (file)
+        close(in);
+    if (outName && close(out) != 0) {
+        perror(outName);
+        ret = 1;
+    }
+    return ret;
+}